@@ -0,0 +1,142 @@
+/*
+ * Benchmark of GridMeshBuilder: rows/sec against thread count for the scalar
+ * and SIMD paths, plus an accuracy check of the SIMD output against the scalar
+ * one (and against the old trimesh loader when built with CG_BENCH_TRIMESH).
+ *
+ * Standalone, e.g.:
+ *   g++ -O2 -mavx2 -std=c++17 -pthread bench/grid_mesh_bench.cpp grid_mesh_builder.cpp
+ *
+ * Usage: grid_mesh_bench [size] [repeats]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <random>
+#include <thread>
+#include <vector>
+
+#ifdef CG_BENCH_TRIMESH
+#include <trimesh2/TriMesh.h>
+#endif
+
+#include "../grid_mesh_builder.h"
+
+using namespace cg;
+
+namespace
+{
+
+// smooth random terrain, so normals look like a real heightmap
+std::vector<unsigned char> MakeHeightmap(int size)
+{
+	std::mt19937 rng(42);
+	std::uniform_real_distribution<float> phase(0.0f, 6.2831853f);
+	const float p0 = phase(rng), p1 = phase(rng), p2 = phase(rng);
+
+	std::vector<unsigned char> map(size_t(size) * size);
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			const float u = float(j) / size, v = float(i) / size;
+			const float h = 0.5f
+				+ 0.25f * std::sin(6.0f * u + p0) * std::cos(5.0f * v + p1)
+				+ 0.15f * std::sin(23.0f * (u + v) + p2);
+			map[size_t(i) * size + j] = (unsigned char)std::clamp(int(h * 255), 0, 255);
+		}
+	}
+	return map;
+}
+
+double MaxError(const GridVertex* a, const GridVertex* b, size_t n, bool normals)
+{
+	double worst = 0.0;
+	for (size_t k = 0; k < n; k++) {
+		const float* va = normals ? a[k].normal : a[k].position;
+		const float* vb = normals ? b[k].normal : b[k].position;
+		for (int c = 0; c < 3; c++) {
+			worst = std::max(worst, std::abs(double(va[c]) - vb[c]));
+		}
+	}
+	return worst;
+}
+
+#ifdef CG_BENCH_TRIMESH
+// the loader GridMeshBuilder replaced
+void BuildTrimesh(const unsigned char* heights, int size, GridVertex* out)
+{
+	trimesh::TriMesh mesh;
+	for (int i = 0; i < size; i++) {
+		for (int j = 0; j < size; j++) {
+			mesh.vertices.emplace_back(float(j) / size, float(heights[i * size + j]) / 256, float(i) / size);
+			mesh.grid.push_back(i * size + j);
+		}
+	}
+	mesh.grid_width = size;
+	mesh.grid_height = size;
+	mesh.triangulate_grid(false);
+	mesh.need_normals();
+	for (size_t k = 0; k < mesh.vertices.size(); k++) {
+		for (int c = 0; c < 3; c++) {
+			out[k].position[c] = mesh.vertices[k][c];
+			out[k].normal[c] = mesh.normals[k][c];
+		}
+	}
+}
+#endif
+
+} /* anonymous namespace */
+
+int main(int argc, char* argv[])
+{
+	const int size = argc > 1 ? std::atoi(argv[1]) : 4096;
+	const int repeats = argc > 2 ? std::max(1, std::atoi(argv[2])) : 3;
+	const unsigned maxThreads = std::max(1u, std::thread::hardware_concurrency());
+
+	const auto heights = MakeHeightmap(size);
+	const size_t count = size_t(size) * size;
+	std::unique_ptr<GridVertex[]> reference(new GridVertex[count]);
+	std::unique_ptr<GridVertex[]> result(new GridVertex[count]);
+
+	std::cout << "Heightmap " << size << "x" << size << ", SIMD path "
+		<< GridMeshBuilder::PathName(GridMeshBuilder::CompiledPath()) << std::endl;
+
+	GridMeshBuilder(1, false).Build(heights.data(), size, size, reference.get());
+	GridMeshBuilder(0, true).Build(heights.data(), size, size, result.get());
+	std::cout << "SIMD vs scalar: max position error " << MaxError(reference.get(), result.get(), count, false)
+		<< ", max normal error " << MaxError(reference.get(), result.get(), count, true) << std::endl;
+
+#ifdef CG_BENCH_TRIMESH
+	std::unique_ptr<GridVertex[]> old(new GridVertex[count]);
+	auto start = std::chrono::steady_clock::now();
+	BuildTrimesh(heights.data(), size, old.get());
+	const double trimeshSec = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "trimesh vs builder: max position error " << MaxError(old.get(), result.get(), count, false)
+		<< ", max normal error " << MaxError(old.get(), result.get(), count, true) << ", trimesh "
+		<< size / trimeshSec << " rows/s" << std::endl;
+#endif
+
+	std::vector<unsigned> threadCounts;
+	for (unsigned threads = 1; threads < maxThreads; threads *= 2) {
+		threadCounts.push_back(threads);
+	}
+	threadCounts.push_back(maxThreads);
+
+	std::cout << "threads\tscalar rows/s\tSIMD rows/s" << std::endl;
+	for (unsigned threads : threadCounts) {
+		double rowsPerSec[2];
+		for (int simd = 0; simd < 2; simd++) {
+			GridMeshBuilder builder(threads, simd != 0);
+			double best = 1e30;
+			for (int r = 0; r < repeats; r++) {
+				auto t0 = std::chrono::steady_clock::now();
+				builder.Build(heights.data(), size, size, result.get());
+				best = std::min(best, std::chrono::duration<double>(std::chrono::steady_clock::now() - t0).count());
+			}
+			rowsPerSec[simd] = size / best;
+		}
+		std::cout << threads << "\t" << rowsPerSec[0] << "\t" << rowsPerSec[1] << std::endl;
+	}
+	return 0;
+}
@@ -0,0 +1,321 @@
+#include "cdlod_terrain.h"
+
+#include <algorithm>
+#include <cfloat>
+#include <cmath>
+
+#include <glm/gtc/type_ptr.hpp>
+
+#include "grid_mesh.hpp"
+
+namespace cg
+{
+
+CdlodTerrain::CdlodTerrain() :
+    width_(0), height_(0), pixelError_(2.0f), model_(1.0f), viewPos_(0.0f), ranges_{0},
+    quadrantIndexCount_(0)
+{
+}
+
+bool CdlodTerrain::Build(const unsigned char* heights, int width, int height)
+{
+    if (heights == nullptr || width < 2 || height < 2) {
+        return false;
+    }
+    width_ = width;
+    height_ = height;
+    levels_.clear();
+
+    // quadtree levels, leaves first
+    for (int level = 0; level < kMaxLevels; level++) {
+        Level lv;
+        lv.nodeSize = kPatchSize << level;
+        lv.nodesX = (width - 1 + lv.nodeSize - 1) / lv.nodeSize;
+        lv.nodesZ = (height - 1 + lv.nodeSize - 1) / lv.nodeSize;
+        const size_t count = size_t(lv.nodesX) * lv.nodesZ;
+        lv.minY.assign(count, FLT_MAX);
+        lv.maxY.assign(count, -FLT_MAX);
+        lv.error.assign(count, 0.0f);
+        levels_.push_back(std::move(lv));
+        if (levels_.back().nodesX == 1 && levels_.back().nodesZ == 1) {
+            break;
+        }
+    }
+    UpdateHeights(heights, 0, 0, width, height);
+
+    // patch mesh: integer grid coordinates, indices grouped by quadrant so
+    // a quarter of a node is one contiguous range
+    std::vector<GLfloat> patchVerts;
+    patchVerts.reserve(size_t(kPatchSize + 1) * (kPatchSize + 1) * 2);
+    for (int z = 0; z <= kPatchSize; z++) {
+        for (int x = 0; x <= kPatchSize; x++) {
+            patchVerts.push_back(GLfloat(x));
+            patchVerts.push_back(GLfloat(z));
+        }
+    }
+
+    const int half = kPatchSize / 2;
+    std::vector<GLuint> patchIndices;
+    for (int q = 0; q < 4; q++) {
+        const int col0 = (q & 1) * half;
+        const int row0 = (q >> 1) * half;
+        grid_mesh::AppendGridIndices(patchIndices, kPatchSize + 1, row0, row0 + half, col0, col0 + half);
+    }
+    quadrantIndexCount_ = GLsizei(patchIndices.size() / 4);
+
+    // a rebuild replaces the objects
+    patchVBO_ = CreateBuffer(patchVerts);
+    patchEBO_ = CreateBuffer(patchIndices);
+    patchVAO_ = CreateVertexArray();
+    glVertexArrayElementBuffer(patchVAO_, patchEBO_);
+
+    // grid coordinate attribute
+    glVertexArrayVertexBuffer(patchVAO_, 0, patchVBO_, 0, 2 * sizeof(GLfloat));
+    glVertexArrayAttribFormat(patchVAO_, 0, 2, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(patchVAO_, 0, 0);
+    glEnableVertexArrayAttrib(patchVAO_, 0);
+
+    stats_ = Stats();
+    stats_.levels = int(levels_.size());
+    for (const auto& lv : levels_) {
+        stats_.nodes += lv.nodesX * lv.nodesZ;
+    }
+    return true;
+}
+
+void CdlodTerrain::UpdateHeights(const unsigned char* heights, int x0, int z0, int x1, int z1)
+{
+    // level by level, leaves first: a node covers the samples of its quads, the
+    // ones on its border included, so [x0, x1) reaches nodes ending at x0 too
+    for (size_t level = 0; level < levels_.size(); level++) {
+        const Level& lv = levels_[level];
+        const int nx0 = std::max(x0 - 1, 0) / lv.nodeSize;
+        const int nz0 = std::max(z0 - 1, 0) / lv.nodeSize;
+        const int nx1 = std::min((x1 - 1) / lv.nodeSize, lv.nodesX - 1);
+        const int nz1 = std::min((z1 - 1) / lv.nodeSize, lv.nodesZ - 1);
+        for (int nz = nz0; nz <= nz1; nz++) {
+            for (int nx = nx0; nx <= nx1; nx++) {
+                FitNode(heights, int(level), nx, nz);
+            }
+        }
+    }
+}
+
+float CdlodTerrain::Sample(const unsigned char* heights, int x, int z) const
+{
+    x = std::min(std::max(x, 0), width_ - 1);
+    z = std::min(std::max(z, 0), height_ - 1);
+    return float(heights[size_t(z) * width_ + x]) / 256;
+}
+
+void CdlodTerrain::FitNode(const unsigned char* heights, int level, int nx, int nz)
+{
+    Level& lv = levels_[level];
+    const size_t n = size_t(nz) * lv.nodesX + nx;
+    const int x0 = nx * lv.nodeSize;
+    const int z0 = nz * lv.nodeSize;
+    const int x1 = std::min(x0 + lv.nodeSize, width_ - 1);
+    const int z1 = std::min(z0 + lv.nodeSize, height_ - 1);
+    lv.minY[n] = FLT_MAX;
+    lv.maxY[n] = -FLT_MAX;
+    lv.error[n] = 0.0f;
+
+    // leaves: height range from the samples, border ones included
+    if (level == 0) {
+        for (int z = z0; z <= z1; z++) {
+            for (int x = x0; x <= x1; x++) {
+                const float y = Sample(heights, x, z);
+                lv.minY[n] = std::min(lv.minY[n], y);
+                lv.maxY[n] = std::max(lv.maxY[n], y);
+            }
+        }
+        return;
+    }
+
+    // parents: combined height range, and an error bound made of the children's
+    // bound plus the error of dropping every other vertex of the children's grid
+    const Level& child = levels_[level - 1];
+    for (int c = 0; c < 4; c++) {
+        const int cx = nx * 2 + (c & 1);
+        const int cz = nz * 2 + (c >> 1);
+        if (cx >= child.nodesX || cz >= child.nodesZ) {
+            continue;
+        }
+        const size_t cn = size_t(cz) * child.nodesX + cx;
+        lv.minY[n] = std::min(lv.minY[n], child.minY[cn]);
+        lv.maxY[n] = std::max(lv.maxY[n], child.maxY[cn]);
+        lv.error[n] = std::max(lv.error[n], child.error[cn]);
+    }
+
+    const int step = 1 << level;
+    const int half = step / 2;
+    auto sample = [&](int x, int z) { return Sample(heights, x, z); };
+    float own = 0.0f;
+    for (int z = z0; z < z1; z += step) {
+        for (int x = x0; x < x1; x += step) {
+            const float a = sample(x, z);
+            const float b = sample(x + step, z);
+            const float c = sample(x, z + step);
+            const float d = sample(x + step, z + step);
+            own = std::max(own, std::abs(sample(x + half, z) - (a + b) / 2));
+            own = std::max(own, std::abs(sample(x, z + half) - (a + c) / 2));
+            own = std::max(own, std::abs(sample(x + step, z + half) - (b + d) / 2));
+            own = std::max(own, std::abs(sample(x + half, z + step) - (c + d) / 2));
+            own = std::max(own, std::abs(sample(x + half, z + half) - (a + b + c + d) / 4));
+        }
+    }
+    lv.error[n] += own;
+}
+
+void CdlodTerrain::ComputeRanges(GLfloat pixelsPerRadian)
+{
+    // terrain space -> world scale of the model (scale + translation only)
+    const GLfloat scaleX = glm::length(glm::vec3(model_[0])) / width_;
+    const GLfloat scaleY = glm::length(glm::vec3(model_[1]));
+    const GLfloat scaleZ = glm::length(glm::vec3(model_[2])) / height_;
+
+    // level L is used up to ranges_[L]: the distance beyond which level L + 1
+    // projects to at most pixelError_ pixels
+    const int top = int(levels_.size()) - 1;
+    for (int level = 0; level < top; level++) {
+        const auto& next = levels_[level + 1];
+        const GLfloat maxError = *std::max_element(next.error.begin(), next.error.end());
+        GLfloat range = maxError * scaleY * pixelsPerRadian / pixelError_;
+
+        // keep levels wide enough for neighbours to differ by at most one level
+        const GLfloat nodeDiag = levels_[level].nodeSize * std::sqrt(scaleX * scaleX + scaleZ * scaleZ);
+        const GLfloat prev = level > 0 ? ranges_[level - 1] : 0.0f;
+        range = std::max({range, 2.0f * prev, prev + 2.0f * nodeDiag});
+        ranges_[level] = range;
+    }
+    ranges_[top] = FLT_MAX;
+}
+
+void CdlodTerrain::NodeBounds(int level, int nx, int nz, glm::vec3& boxMin, glm::vec3& boxMax) const
+{
+    const Level& lv = levels_[level];
+    const size_t n = size_t(nz) * lv.nodesX + nx;
+    const GLfloat x0 = GLfloat(nx * lv.nodeSize) / width_;
+    const GLfloat z0 = GLfloat(nz * lv.nodeSize) / height_;
+    const GLfloat x1 = GLfloat(std::min((nx + 1) * lv.nodeSize, width_ - 1)) / width_;
+    const GLfloat z1 = GLfloat(std::min((nz + 1) * lv.nodeSize, height_ - 1)) / height_;
+
+    // world space AABB of the node
+    const glm::vec3 a(model_ * glm::vec4(x0, lv.minY[n], z0, 1.0f));
+    const glm::vec3 b(model_ * glm::vec4(x1, lv.maxY[n], z1, 1.0f));
+    boxMin = glm::min(a, b);
+    boxMax = glm::max(a, b);
+}
+
+bool CdlodTerrain::InRange(int level, int nx, int nz, GLfloat range) const
+{
+    if (range == FLT_MAX) {
+        return true;
+    }
+
+    glm::vec3 boxMin, boxMax;
+    NodeBounds(level, nx, nz, boxMin, boxMax);
+
+    const glm::vec3 closest = glm::clamp(viewPos_, boxMin, boxMax);
+    const glm::vec3 d = closest - viewPos_;
+    return glm::dot(d, d) <= range * range;
+}
+
+void CdlodTerrain::Select(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& viewPos, GLfloat pixelsPerRadian)
+{
+    selection_.clear();
+    stats_.culledNodes = 0;
+    if (levels_.empty()) {
+        return;
+    }
+
+    model_ = model;
+    viewPos_ = viewPos;
+    frustum_ = Frustum::FromMatrix(viewProjection);
+    ComputeRanges(pixelsPerRadian);
+
+    const int top = int(levels_.size()) - 1;
+    for (int nz = 0; nz < levels_[top].nodesZ; nz++) {
+        for (int nx = 0; nx < levels_[top].nodesX; nx++) {
+            SelectNode(top, nx, nz);
+        }
+    }
+}
+
+bool CdlodTerrain::SelectNode(int level, int nx, int nz)
+{
+    if (!InRange(level, nx, nz, ranges_[level])) {
+        // too far for this level, the parent covers it
+        return false;
+    }
+
+    // outside the view: handled, nothing to draw
+    glm::vec3 boxMin, boxMax;
+    NodeBounds(level, nx, nz, boxMin, boxMax);
+    if (!frustum_.IntersectsBox(boxMin, boxMax)) {
+        stats_.culledNodes++;
+        return true;
+    }
+
+    const Level& lv = levels_[level];
+    const int x = nx * lv.nodeSize;
+    const int z = nz * lv.nodeSize;
+
+    if (level == 0 || !InRange(level, nx, nz, ranges_[level - 1])) {
+        selection_.push_back({level, x, z, -1});
+        return true;
+    }
+
+    const Level& child = levels_[level - 1];
+    for (int q = 0; q < 4; q++) {
+        const int cx = nx * 2 + (q & 1);
+        const int cz = nz * 2 + (q >> 1);
+        if (cx >= child.nodesX || cz >= child.nodesZ) {
+            continue;
+        }
+        if (!SelectNode(level - 1, cx, cz)) {
+            // the child is out of its own range: draw that quarter at this level
+            selection_.push_back({level, x, z, q});
+        }
+    }
+    return true;
+}
+
+void CdlodTerrain::Draw(const Shader& shader, GlState& state)
+{
+    stats_.selectedNodes = 0;
+    stats_.triangles = 0;
+    if (selection_.empty()) {
+        return;
+    }
+
+    const GLint nodeLoc = shader.Uniform("nodeParams");
+    const GLint morphLoc = shader.Uniform("morphRange");
+    shader.Set("mapSize", glm::vec2(GLfloat(width_), GLfloat(height_)));
+    shader.Set("patchSize", GLfloat(kPatchSize));
+
+    state.BindVertexArray(patchVAO_);
+    for (const auto& sel : selection_) {
+        const GLfloat end = ranges_[sel.level];
+        const GLfloat begin = sel.level > 0 ? ranges_[sel.level - 1] : 0.0f;
+        if (end == FLT_MAX) {
+            // coarsest level never morphs
+            shader.Set(morphLoc, glm::vec2(0.0f, 0.0f));
+        } else {
+            shader.Set(morphLoc, glm::vec2(begin + (end - begin) * kMorphStart, end));
+        }
+        shader.Set(nodeLoc, glm::vec4(GLfloat(sel.x), GLfloat(sel.z), GLfloat(1 << sel.level), 0.0f));
+
+        if (sel.quadrant < 0) {
+            glDrawElements(GL_TRIANGLES, 4 * quadrantIndexCount_, GL_UNSIGNED_INT, (GLvoid*)0);
+            stats_.triangles += 4 * quadrantIndexCount_ / 3;
+        } else {
+            glDrawElements(GL_TRIANGLES, quadrantIndexCount_, GL_UNSIGNED_INT,
+                (GLvoid*)(size_t(sel.quadrant) * quadrantIndexCount_ * sizeof(GLuint)));
+            stats_.triangles += quadrantIndexCount_ / 3;
+        }
+        stats_.selectedNodes++;
+    }
+}
+
+} /* namespace cg */
@@ -0,0 +1,123 @@
+#ifndef CG_CDLOD_TERRAIN_H_
+#define CG_CDLOD_TERRAIN_H_
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "frustum.hpp"
+#include "gl_handle.hpp"
+#include "gl_state.hpp"
+
+namespace cg
+{
+
+/* Chunked quadtree LOD terrain (CDLOD).
+ *
+ * The heightmap is covered by a quadtree whose leaves are kPatchSize x kPatchSize
+ * quads; a node at level L covers kPatchSize << L quads and is drawn with the
+ * same patch mesh, scaled by 2^L. Each node keeps its height range and the
+ * maximum vertical error of its level of detail against the full resolution
+ * data. Those errors and a screen-space error threshold give every level a
+ * view distance range; nodes are selected against these ranges each frame and
+ * vertices morph to the next coarser level towards the end of their range
+ * (see shaders/terrain_cdlod.vert), so there is no popping and no cracks.
+ * Heights are fetched from a heightmap texture in the vertex shader.
+ */
+class CdlodTerrain
+{
+public:
+	static constexpr int kPatchSize = 32;
+	static constexpr int kMaxLevels = 16;
+
+	// start morphing at this fraction of a level's range
+	static constexpr float kMorphStart = 0.7f;
+
+	struct Stats
+	{
+		int levels = 0;
+		int nodes = 0;            // nodes in the quadtree
+		int culledNodes = 0;      // nodes rejected by the frustum in the last Select()
+		int selectedNodes = 0;    // draws issued by the last Draw()
+		size_t triangles = 0;     // triangles submitted by the last Draw()
+	};
+
+	CdlodTerrain();
+
+	CdlodTerrain(const CdlodTerrain&) = delete;
+	CdlodTerrain& operator=(const CdlodTerrain&) = delete;
+
+	virtual ~CdlodTerrain() = default;
+
+	/* Build the quadtree and the patch mesh. Heights are h / 256 in terrain space */
+	bool Build(const unsigned char* heights, int width, int height);
+	/* Refit the height ranges and errors of the nodes over samples [x0, x1) x [z0, z1)
+	 * after they changed in `heights` (same size as built)
+	 */
+	void UpdateHeights(const unsigned char* heights, int x0, int z0, int x1, int z1);
+
+	bool Empty() const { return levels_.empty(); }
+	const Stats& LastStats() const { return stats_; }
+
+	GLfloat PixelError() const { return pixelError_; }
+	void SetPixelError(GLfloat pixels) { pixelError_ = pixels; }
+
+	/* Pick the nodes to draw for a camera at viewPos, skipping those outside the view.
+	 * viewProjection: projection * view, the frustum is tested in world space
+	 * pixelsPerRadian: viewport height / (2 tan(fovy / 2)), i.e. projection[1][1] * viewport height / 2
+	 */
+	void Select(const glm::mat4& model, const glm::mat4& viewProjection, const glm::vec3& viewPos, GLfloat pixelsPerRadian);
+
+	/* Draw the selected nodes with `shader` (already in use, heightmap texture bound) */
+	void Draw(const Shader& shader, GlState& state);
+
+private:
+	struct Level
+	{
+		int nodesX = 0;
+		int nodesZ = 0;
+		int nodeSize = 0;             // quads covered by one node, along each axis
+		std::vector<float> minY;
+		std::vector<float> maxY;
+		std::vector<float> error;     // max vertical error of this node's LOD (terrain space)
+	};
+
+	struct Selection
+	{
+		int level;
+		int x;                        // node origin, in heightmap samples
+		int z;
+		int quadrant;                 // 0-3, or -1 for the whole node
+	};
+
+	int width_;
+	int height_;
+	std::vector<Level> levels_;
+
+	GLfloat pixelError_;
+	glm::mat4 model_;
+	glm::vec3 viewPos_;
+	Frustum frustum_;
+	GLfloat ranges_[kMaxLevels];
+	std::vector<Selection> selection_;
+	Stats stats_;
+
+	GlVertexArray patchVAO_;
+	GlBuffer patchVBO_;
+	GlBuffer patchEBO_;
+	GLsizei quadrantIndexCount_;
+
+	float Sample(const unsigned char* heights, int x, int z) const;
+	// height range & error of a node, from the samples or from its children
+	void FitNode(const unsigned char* heights, int level, int nx, int nz);
+	void ComputeRanges(GLfloat pixelsPerRadian);
+	bool SelectNode(int level, int nx, int nz);
+	void NodeBounds(int level, int nx, int nz, glm::vec3& boxMin, glm::vec3& boxMax) const;
+	bool InRange(int level, int nx, int nz, GLfloat range) const;
+};
+
+} /* namespace cg */
+
+#endif /* CG_CDLOD_TERRAIN_H_ */
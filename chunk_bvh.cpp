@@ -0,0 +1,279 @@
+#include "chunk_bvh.h"
+
+#include <algorithm>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#define CG_BVH_SSE 1
+#include <xmmintrin.h>
+#endif
+
+namespace cg
+{
+
+namespace
+{
+
+// bounds of an empty slot: every plane sees it on the outside
+constexpr float kEmptyMin = 1e30f;
+constexpr float kEmptyMax = -1e30f;
+
+} /* anonymous namespace */
+
+glm::ivec2 ComputeChunkBounds(const unsigned char* heights, int width, int height, int chunkSize,
+    std::vector<glm::vec3>& boxMin, std::vector<glm::vec3>& boxMax)
+{
+    const int quadsX = width - 1;
+    const int quadsZ = height - 1;
+    const int chunksX = (quadsX + chunkSize - 1) / chunkSize;
+    const int chunksZ = (quadsZ + chunkSize - 1) / chunkSize;
+    boxMin.assign(size_t(std::max(chunksX, 0)) * size_t(std::max(chunksZ, 0)), glm::vec3(0.0f));
+    boxMax.assign(boxMin.size(), glm::vec3(0.0f));
+    for (int cz = 0; cz < chunksZ; cz++) {
+        for (int cx = 0; cx < chunksX; cx++) {
+            const size_t id = size_t(cz) * chunksX + cx;
+            ChunkBounds(heights, width, height, chunkSize, cx, cz, boxMin[id], boxMax[id]);
+        }
+    }
+    return glm::ivec2(std::max(chunksX, 0), std::max(chunksZ, 0));
+}
+
+void ChunkBounds(const unsigned char* heights, int width, int height, int chunkSize, int cx, int cz,
+    glm::vec3& boxMin, glm::vec3& boxMax)
+{
+    const int col0 = cx * chunkSize;
+    const int row0 = cz * chunkSize;
+    const int col1 = std::min(col0 + chunkSize, width - 1);
+    const int row1 = std::min(row0 + chunkSize, height - 1);
+    unsigned char lo = 255;
+    unsigned char hi = 0;
+    for (int i = row0; i <= row1; i++) {
+        const unsigned char* row = heights + size_t(i) * width;
+        lo = std::min(lo, *std::min_element(row + col0, row + col1 + 1));
+        hi = std::max(hi, *std::max_element(row + col0, row + col1 + 1));
+    }
+    boxMin = glm::vec3(float(col0) / width, float(lo) / 256, float(row0) / height);
+    boxMax = glm::vec3(float(col1) / width, float(hi) / 256, float(row1) / height);
+}
+
+bool ChunkBvh::UsesSimd()
+{
+#ifdef CG_BVH_SSE
+    return true;
+#else
+    return false;
+#endif
+}
+
+int ChunkBvh::AddGroup()
+{
+    const int group = int(child_.size());
+    for (int q = 0; q < 4; q++) {
+        minX_.push_back(kEmptyMin);
+        minY_.push_back(kEmptyMin);
+        minZ_.push_back(kEmptyMin);
+        maxX_.push_back(kEmptyMax);
+        maxY_.push_back(kEmptyMax);
+        maxZ_.push_back(kEmptyMax);
+        child_.push_back(-1);
+        leaf_.push_back(-1);
+        parent_.push_back(-1);
+    }
+    return group;
+}
+
+void ChunkBvh::FitNode(int node)
+{
+    minX_[node] = minY_[node] = minZ_[node] = kEmptyMin;
+    maxX_[node] = maxY_[node] = maxZ_[node] = kEmptyMax;
+    for (int c = child_[node]; c < child_[node] + 4; c++) {
+        if (minX_[c] > maxX_[c]) {
+            continue;
+        }
+        minX_[node] = std::min(minX_[node], minX_[c]);
+        minY_[node] = std::min(minY_[node], minY_[c]);
+        minZ_[node] = std::min(minZ_[node], minZ_[c]);
+        maxX_[node] = std::max(maxX_[node], maxX_[c]);
+        maxY_[node] = std::max(maxY_[node], maxY_[c]);
+        maxZ_[node] = std::max(maxZ_[node], maxZ_[c]);
+    }
+}
+
+std::vector<int> ChunkBvh::Build(const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax, int countX, int countZ)
+{
+    minX_.clear();
+    minY_.clear();
+    minZ_.clear();
+    maxX_.clear();
+    maxY_.clear();
+    maxZ_.clear();
+    child_.clear();
+    leaf_.clear();
+    parent_.clear();
+    chunkNode_.clear();
+
+    std::vector<int> order;
+    if (countX <= 0 || countZ <= 0) {
+        return order;
+    }
+    order.reserve(size_t(countX) * countZ);
+    chunkNode_.assign(size_t(countX) * countZ, -1);
+
+    int size = 1;
+    while (size < countX || size < countZ) {
+        size *= 2;
+    }
+
+    // the root is alone in group 0, next to three empty slots
+    AddGroup();
+    BuildNode(0, 0, 0, size, countX, countZ, boxMin, boxMax, order);
+    return order;
+}
+
+void ChunkBvh::BuildNode(int node, int x0, int z0, int size, int countX, int countZ,
+    const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax, std::vector<int>& order)
+{
+    if (x0 >= countX || z0 >= countZ) {
+        return;
+    }
+
+    if (size == 1) {
+        const int id = z0 * countX + x0;
+        minX_[node] = boxMin[id].x;
+        minY_[node] = boxMin[id].y;
+        minZ_[node] = boxMin[id].z;
+        maxX_[node] = boxMax[id].x;
+        maxY_[node] = boxMax[id].y;
+        maxZ_[node] = boxMax[id].z;
+        leaf_[node] = int(order.size());
+        chunkNode_[id] = node;
+        order.push_back(id);
+        return;
+    }
+
+    const int group = AddGroup();
+    const int half = size / 2;
+    child_[node] = group;
+    for (int q = 0; q < 4; q++) {
+        parent_[group + q] = node;
+        BuildNode(group + q, x0 + (q & 1) * half, z0 + (q >> 1) * half, half, countX, countZ, boxMin, boxMax, order);
+    }
+    FitNode(node);
+}
+
+int ChunkBvh::Refit(int id, const glm::vec3& boxMin, const glm::vec3& boxMax)
+{
+    const int node = chunkNode_[id];
+    minX_[node] = boxMin.x;
+    minY_[node] = boxMin.y;
+    minZ_[node] = boxMin.z;
+    maxX_[node] = boxMax.x;
+    maxY_[node] = boxMax.y;
+    maxZ_[node] = boxMax.z;
+    for (int n = parent_[node]; n >= 0; n = parent_[n]) {
+        FitNode(n);
+    }
+    return leaf_[node];
+}
+
+void ChunkBvh::TestGroup(const Frustum& frustum, int group, int* intersect, int* inside) const
+{
+#ifdef CG_BVH_SSE
+    const __m128 bMinX = _mm_loadu_ps(&minX_[group]);
+    const __m128 bMinY = _mm_loadu_ps(&minY_[group]);
+    const __m128 bMinZ = _mm_loadu_ps(&minZ_[group]);
+    const __m128 bMaxX = _mm_loadu_ps(&maxX_[group]);
+    const __m128 bMaxY = _mm_loadu_ps(&maxY_[group]);
+    const __m128 bMaxZ = _mm_loadu_ps(&maxZ_[group]);
+    const __m128 zero = _mm_setzero_ps();
+
+    __m128 out = _mm_setzero_ps();
+    __m128 partial = _mm_setzero_ps();
+    for (const auto& p : frustum.planes) {
+        const __m128 nx = _mm_set1_ps(p.x);
+        const __m128 ny = _mm_set1_ps(p.y);
+        const __m128 nz = _mm_set1_ps(p.z);
+
+        // n . v over the box corners furthest along (far) and against (near) the normal
+        const __m128 ax = _mm_mul_ps(nx, bMinX), bx = _mm_mul_ps(nx, bMaxX);
+        const __m128 ay = _mm_mul_ps(ny, bMinY), by = _mm_mul_ps(ny, bMaxY);
+        const __m128 az = _mm_mul_ps(nz, bMinZ), bz = _mm_mul_ps(nz, bMaxZ);
+        const __m128 d = _mm_set1_ps(p.w);
+        const __m128 far = _mm_add_ps(_mm_add_ps(_mm_max_ps(ax, bx), _mm_max_ps(ay, by)), _mm_add_ps(_mm_max_ps(az, bz), d));
+        const __m128 near = _mm_add_ps(_mm_add_ps(_mm_min_ps(ax, bx), _mm_min_ps(ay, by)), _mm_add_ps(_mm_min_ps(az, bz), d));
+
+        out = _mm_or_ps(out, _mm_cmplt_ps(far, zero));
+        partial = _mm_or_ps(partial, _mm_cmplt_ps(near, zero));
+    }
+    *intersect = ~_mm_movemask_ps(out) & 0xF;
+    *inside = ~_mm_movemask_ps(partial) & *intersect;
+#else
+    *intersect = 0;
+    *inside = 0;
+    for (int q = 0; q < 4; q++) {
+        const int n = group + q;
+        bool outside = false;
+        bool straddles = false;
+        for (const auto& p : frustum.planes) {
+            const float ax = p.x * minX_[n], bx = p.x * maxX_[n];
+            const float ay = p.y * minY_[n], by = p.y * maxY_[n];
+            const float az = p.z * minZ_[n], bz = p.z * maxZ_[n];
+            const float far = std::max(ax, bx) + std::max(ay, by) + std::max(az, bz) + p.w;
+            const float near = std::min(ax, bx) + std::min(ay, by) + std::min(az, bz) + p.w;
+            outside = outside || far < 0;
+            straddles = straddles || near < 0;
+        }
+        if (!outside) {
+            *intersect |= 1 << q;
+            if (!straddles) {
+                *inside |= 1 << q;
+            }
+        }
+    }
+#endif
+}
+
+void ChunkBvh::Cull(const Frustum& frustum, std::vector<int>& visible, CullStats& stats) const
+{
+    if (Empty()) {
+        return;
+    }
+
+    struct Entry
+    {
+        int group;
+        bool inside;
+    };
+    Entry stack[64];
+    int top = 0;
+    stack[top++] = {0, false};
+
+    while (top > 0) {
+        const Entry e = stack[--top];
+
+        int intersect = 0xF;
+        int inside = 0xF;
+        if (!e.inside) {
+            TestGroup(frustum, e.group, &intersect, &inside);
+            stats.nodesTested += 4;
+        }
+
+        // siblings are all leaves or all inner nodes; push inner ones in
+        // reverse so leaves come out in ascending order
+        for (int q = 3; q >= 0; q--) {
+            const int node = e.group + q;
+            if ((intersect & (1 << q)) && child_[node] >= 0) {
+                stack[top++] = {child_[node], (inside & (1 << q)) != 0};
+            }
+        }
+        const size_t first = visible.size();
+        for (int q = 0; q < 4; q++) {
+            const int node = e.group + q;
+            if ((intersect & (1 << q)) && leaf_[node] >= 0) {
+                visible.push_back(leaf_[node]);
+            }
+        }
+        stats.chunksVisible += visible.size() - first;
+    }
+}
+
+} /* namespace cg */
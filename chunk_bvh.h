@@ -0,0 +1,81 @@
+#ifndef CG_CHUNK_BVH_H_
+#define CG_CHUNK_BVH_H_
+
+#include <cstddef>
+#include <vector>
+
+#include <glm/glm.hpp>
+
+#include "frustum.hpp"
+
+namespace cg
+{
+
+/* Bounds in terrain space (x = col / width, y = h / 256, z = row / height) of the
+ * chunks of chunkSize x chunkSize quads covering a heightmap, in grid order.
+ * Returns the chunk counts along x and z.
+ */
+glm::ivec2 ComputeChunkBounds(const unsigned char* heights, int width, int height, int chunkSize,
+	std::vector<glm::vec3>& boxMin, std::vector<glm::vec3>& boxMax);
+
+/* The bounds of the chunk at (cx, cz) alone, as ComputeChunkBounds() computes them */
+void ChunkBounds(const unsigned char* heights, int width, int height, int chunkSize, int cx, int cz,
+	glm::vec3& boxMin, glm::vec3& boxMax);
+
+/* Quadtree bounding volume hierarchy over a countX x countZ grid of chunks.
+ *
+ * Nodes are stored flat, structure-of-arrays, in groups of four siblings, so
+ * one SSE test covers all children of a node. A node found entirely inside
+ * the frustum accepts its whole subtree without further tests.
+ */
+class ChunkBvh
+{
+public:
+	struct CullStats
+	{
+		size_t nodesTested = 0;
+		size_t chunksVisible = 0;
+	};
+
+	ChunkBvh() = default;
+
+	/* boxMin/boxMax: chunk bounds in grid order (z * countX + x).
+	 * Returns the chunks' grid ids in leaf order, the order Cull() reports them in.
+	 */
+	std::vector<int> Build(const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax, int countX, int countZ);
+
+	/* New bounds for chunk `id` (grid order), e.g. after its heights changed: its leaf and
+	 * the leaf's ancestors are refit, the tree keeps its shape. Returns the leaf-order index.
+	 */
+	int Refit(int id, const glm::vec3& boxMin, const glm::vec3& boxMax);
+
+	bool Empty() const { return child_.empty(); }
+	size_t NodeCount() const { return child_.size(); }
+
+	/* Append the leaf-order indices of the chunks intersecting the frustum, ascending */
+	void Cull(const Frustum& frustum, std::vector<int>& visible, CullStats& stats) const;
+
+	static bool UsesSimd();
+
+private:
+	// SoA bounds, one entry per node; empty slots get an inverted box that never passes
+	std::vector<float> minX_, minY_, minZ_;
+	std::vector<float> maxX_, maxY_, maxZ_;
+	std::vector<int> child_;     // first node of the child group, -1 for leaves and empty slots
+	std::vector<int> leaf_;      // leaf-order chunk index, -1 for inner nodes and empty slots
+	std::vector<int> parent_;    // -1 for the root and empty slots
+	std::vector<int> chunkNode_; // leaf node of each chunk, in grid order
+
+	int AddGroup();
+	// the union of the node's children bounds
+	void FitNode(int node);
+	void BuildNode(int node, int x0, int z0, int size, int countX, int countZ,
+		const std::vector<glm::vec3>& boxMin, const std::vector<glm::vec3>& boxMax, std::vector<int>& order);
+
+	/* Bit q of *intersect / *inside is set when node group + q intersects / is inside the frustum */
+	void TestGroup(const Frustum& frustum, int group, int* intersect, int* inside) const;
+};
+
+} /* namespace cg */
+
+#endif /* CG_CHUNK_BVH_H_ */
@@ -0,0 +1,214 @@
+#include "clipmap_terrain.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdlib>
+
+#include "grid_mesh.hpp"
+
+namespace cg
+{
+
+namespace
+{
+
+// texels kept on each side of the grid, for normals and filtering
+constexpr int kBorder = (ClipmapTerrain::kTextureSize - ClipmapTerrain::kGridSize) / 2;
+
+// smallest offset of a level's hole in the next coarser level, see Update()
+constexpr int kHoleBase = ClipmapTerrain::kGridSize / 4;
+
+inline int WrapTexel(int i)
+{
+    const int n = ClipmapTerrain::kTextureSize;
+    return ((i % n) + n) % n;
+}
+
+} /* anonymous namespace */
+
+ClipmapTerrain::ClipmapTerrain() :
+    heights_(nullptr), width_(0), height_(0), valid_{false},
+    fullCount_(0), ringCount_(0), ringOffset_(0)
+{
+}
+
+bool ClipmapTerrain::Build(const unsigned char* heights, int width, int height)
+{
+    if (heights == nullptr || width < 2 || height < 2) {
+        return false;
+    }
+    heights_ = heights;
+    width_ = width;
+    height_ = height;
+    std::fill(std::begin(valid_), std::end(valid_), false);
+
+    // one float layer per level, wrapped addressing; a rebuild replaces the objects
+    heightTexture_ = CreateTexture(GL_TEXTURE_2D_ARRAY, 1, GL_R32F, kTextureSize, kTextureSize, kLevels);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_WRAP_S, GL_REPEAT);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_WRAP_T, GL_REPEAT);
+
+    // grid vertices: integer coordinates 0 .. kGridSize
+    std::vector<GLfloat> gridVerts;
+    gridVerts.reserve(size_t(kGridSize + 1) * (kGridSize + 1) * 2);
+    for (int z = 0; z <= kGridSize; z++) {
+        for (int x = 0; x <= kGridSize; x++) {
+            gridVerts.push_back(GLfloat(x));
+            gridVerts.push_back(GLfloat(z));
+        }
+    }
+
+    // the full grid for the finest level, then the four possible rings:
+    // the finer level's hole sits at kHoleBase or kHoleBase + 1 on each axis
+    const int n = kGridSize + 1;
+    std::vector<GLuint> indices;
+    grid_mesh::AppendGridIndices(indices, n, 0, kGridSize, 0, kGridSize);
+    fullCount_ = GLsizei(indices.size());
+    ringOffset_ = GLsizeiptr(indices.size() * sizeof(GLuint));
+
+    for (int variant = 0; variant < 4; variant++) {
+        const int hx = kHoleBase + (variant & 1);
+        const int hz = kHoleBase + (variant >> 1);
+        const size_t start = indices.size();
+        grid_mesh::AppendGridIndices(indices, n, 0, hz, 0, kGridSize);
+        grid_mesh::AppendGridIndices(indices, n, hz, hz + kHoleSize, 0, hx);
+        grid_mesh::AppendGridIndices(indices, n, hz, hz + kHoleSize, hx + kHoleSize, kGridSize);
+        grid_mesh::AppendGridIndices(indices, n, hz + kHoleSize, kGridSize, 0, kGridSize);
+        ringCount_ = GLsizei(indices.size() - start);
+    }
+
+    gridVBO_ = CreateBuffer(gridVerts);
+    gridEBO_ = CreateBuffer(indices);
+    gridVAO_ = CreateVertexArray();
+    glVertexArrayElementBuffer(gridVAO_, gridEBO_);
+
+    // grid coordinate attribute
+    glVertexArrayVertexBuffer(gridVAO_, 0, gridVBO_, 0, 2 * sizeof(GLfloat));
+    glVertexArrayAttribFormat(gridVAO_, 0, 2, GL_FLOAT, GL_FALSE, 0);
+    glVertexArrayAttribBinding(gridVAO_, 0, 0);
+    glEnableVertexArrayAttrib(gridVAO_, 0);
+
+    stats_ = Stats();
+    stats_.textureBytes = size_t(kTextureSize) * kTextureSize * kLevels * sizeof(GLfloat);
+    stats_.indexBytes = indices.size() * sizeof(GLuint);
+    return true;
+}
+
+GLfloat ClipmapTerrain::Sample(int x, int z) const
+{
+    // sea floor around the map
+    if (x < 0 || z < 0 || x >= width_ || z >= height_) {
+        return 0.0f;
+    }
+    return GLfloat(heights_[size_t(z) * width_ + x]) / 256;
+}
+
+void ClipmapTerrain::UploadRegion(int level, int u0, int v0, int w, int h)
+{
+    // split at the texture's wrap-around so every piece is one contiguous rectangle
+    for (int v = v0; v < v0 + h; ) {
+        const int tv = WrapTexel(v);
+        const int ph = std::min(v0 + h - v, kTextureSize - tv);
+        for (int u = u0; u < u0 + w; ) {
+            const int tu = WrapTexel(u);
+            const int pw = std::min(u0 + w - u, kTextureSize - tu);
+
+            scratch_.resize(size_t(pw) * ph);
+            for (int j = 0; j < ph; j++) {
+                for (int i = 0; i < pw; i++) {
+                    scratch_[size_t(j) * pw + i] = Sample((u + i) * (1 << level), (v + j) * (1 << level));
+                }
+            }
+            glTextureSubImage3D(heightTexture_, 0, tu, tv, level, pw, ph, 1, GL_RED, GL_FLOAT, scratch_.data());
+            stats_.updatedTexels += size_t(pw) * ph;
+            u += pw;
+        }
+        v += ph;
+    }
+}
+
+void ClipmapTerrain::Update(const glm::mat4& model, const glm::vec3& viewPos)
+{
+    stats_.updatedTexels = 0;
+    if (Empty()) {
+        return;
+    }
+
+    // camera in heightmap sample coordinates
+    const glm::vec4 local = glm::inverse(model) * glm::vec4(viewPos, 1.0f);
+    const GLfloat camX = local.x * width_;
+    const GLfloat camZ = local.z * height_;
+
+    for (int level = 0; level < kLevels; level++) {
+        // snap to even coordinates so the grid lines up with the coarser level
+        const GLfloat scale = GLfloat(1 << level);
+        const glm::ivec2 origin(
+            2 * int(std::floor((camX / scale - kGridSize / 2) / 2)),
+            2 * int(std::floor((camZ / scale - kGridSize / 2) / 2)));
+
+        const glm::ivec2 old = origins_[level];
+        const int dx = origin.x - old.x;
+        const int dz = origin.y - old.y;
+        const int u0 = origin.x - kBorder;
+        const int v0 = origin.y - kBorder;
+
+        if (!valid_[level] || std::abs(dx) >= kTextureSize || std::abs(dz) >= kTextureSize) {
+            UploadRegion(level, u0, v0, kTextureSize, kTextureSize);
+        } else {
+            // toroidal update: only the columns and rows that scrolled in
+            if (dx > 0) {
+                UploadRegion(level, old.x - kBorder + kTextureSize, v0, dx, kTextureSize);
+            } else if (dx < 0) {
+                UploadRegion(level, u0, v0, -dx, kTextureSize);
+            }
+            if (dz > 0) {
+                UploadRegion(level, u0, old.y - kBorder + kTextureSize, kTextureSize, dz);
+            } else if (dz < 0) {
+                UploadRegion(level, u0, v0, kTextureSize, -dz);
+            }
+        }
+        origins_[level] = origin;
+        valid_[level] = true;
+    }
+}
+
+void ClipmapTerrain::Draw(const Shader& shader, GlState& state, GLint unit)
+{
+    stats_.triangles = 0;
+    if (Empty() || !valid_[0]) {
+        return;
+    }
+
+    state.BindTexture(GLuint(unit), heightTexture_);
+    shader.Set("heightLevels", unit);
+    shader.Set("levelCount", GLint(kLevels));
+    shader.Set("gridSize", GLfloat(kGridSize));
+    shader.Set("textureSize", GLfloat(kTextureSize));
+    shader.Set("mapSize", glm::vec2(GLfloat(width_), GLfloat(height_)));
+
+    const GLint levelLoc = shader.Uniform("level");
+    const GLint originLoc = shader.Uniform("levelOrigin");
+
+    state.BindVertexArray(gridVAO_);
+    for (int level = 0; level < kLevels; level++) {
+        shader.Set(levelLoc, GLint(level));
+        shader.Set(originLoc, glm::vec2(GLfloat(origins_[level].x), GLfloat(origins_[level].y)));
+
+        if (level == 0) {
+            glDrawElements(GL_TRIANGLES, fullCount_, GL_UNSIGNED_INT, (GLvoid*)0);
+            stats_.triangles += fullCount_ / 3;
+            continue;
+        }
+
+        // where the finer level sits in this one, in this level's units
+        const int hx = origins_[level - 1].x / 2 - origins_[level].x - kHoleBase;
+        const int hz = origins_[level - 1].y / 2 - origins_[level].y - kHoleBase;
+        const int variant = std::min(std::max(hx, 0), 1) + 2 * std::min(std::max(hz, 0), 1);
+        glDrawElements(GL_TRIANGLES, ringCount_, GL_UNSIGNED_INT,
+            (GLvoid*)(ringOffset_ + GLsizeiptr(variant) * ringCount_ * sizeof(GLuint)));
+        stats_.triangles += ringCount_ / 3;
+    }
+}
+
+} /* namespace cg */
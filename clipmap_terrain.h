@@ -0,0 +1,97 @@
+#ifndef CG_CLIPMAP_TERRAIN_H_
+#define CG_CLIPMAP_TERRAIN_H_
+
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "gl_handle.hpp"
+#include "gl_state.hpp"
+
+namespace cg
+{
+
+/* Geometry clipmap terrain.
+ *
+ * kLevels nested grids of kGridSize x kGridSize quads centered on the camera,
+ * level L with a vertex spacing of 2^L heightmap samples. Each level only
+ * draws the ring around the next finer one. Heights live in one layer per
+ * level of a small texture array, addressed toroidally: when the camera
+ * moves, only the newly exposed rows and columns of a level are uploaded.
+ * GPU memory and vertex work are therefore constant, whatever the terrain
+ * size. Near the outer border of a level, heights blend towards the coarser
+ * level (see shaders/terrain_clipmap.vert) so levels join without cracks.
+ */
+class ClipmapTerrain
+{
+public:
+	static constexpr int kLevels = 6;
+	static constexpr int kGridSize = 56;       // quads per level side, multiple of 8
+	static constexpr int kTextureSize = 64;    // texels per level side, > kGridSize
+	static constexpr int kHoleSize = kGridSize / 2;
+
+	struct Stats
+	{
+		size_t textureBytes = 0;      // height texture array
+		size_t indexBytes = 0;        // ring index buffer
+		size_t updatedTexels = 0;     // texels uploaded by the last Update()
+		size_t triangles = 0;         // triangles submitted by the last Draw()
+	};
+
+	ClipmapTerrain();
+
+	ClipmapTerrain(const ClipmapTerrain&) = delete;
+	ClipmapTerrain& operator=(const ClipmapTerrain&) = delete;
+
+	virtual ~ClipmapTerrain() = default;
+
+	/* heights must outlive the clipmap; heights outside the map are 0 */
+	bool Build(const unsigned char* heights, int width, int height);
+
+	bool Empty() const { return heights_ == nullptr; }
+	const Stats& LastStats() const { return stats_; }
+
+	/* The heights changed, or moved to `heights`: every level is uploaded again by the next Update() */
+	void Reload(const unsigned char* heights)
+	{
+		heights_ = heights;
+		for (bool& valid : valid_) {
+			valid = false;
+		}
+	}
+
+	/* Recenter the levels on viewPos (in world space) and upload what changed */
+	void Update(const glm::mat4& model, const glm::vec3& viewPos);
+
+	/* Draw all levels with `shader` (already in use); binds the height texture to `unit` */
+	void Draw(const Shader& shader, GlState& state, GLint unit);
+
+private:
+	const unsigned char* heights_;
+	int width_;
+	int height_;
+
+	// level origin in units of the level's own spacing, i.e. sample coordinate / 2^L
+	glm::ivec2 origins_[kLevels];
+	bool valid_[kLevels];
+
+	std::vector<GLfloat> scratch_;
+	Stats stats_;
+
+	GlTexture heightTexture_;
+	GlVertexArray gridVAO_;
+	GlBuffer gridVBO_;
+	GlBuffer gridEBO_;
+	GLsizei fullCount_;          // indices of the full grid (finest level)
+	GLsizei ringCount_;          // indices of one ring variant
+	GLsizeiptr ringOffset_;      // byte offset of the first ring variant
+
+	GLfloat Sample(int x, int z) const;
+	void UploadRegion(int level, int u0, int v0, int w, int h);
+};
+
+} /* namespace cg */
+
+#endif /* CG_CLIPMAP_TERRAIN_H_ */
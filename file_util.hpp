@@ -0,0 +1,56 @@
+#ifndef CG_FILE_UTIL_H_
+#define CG_FILE_UTIL_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <string>
+#include <system_error>
+
+namespace cg
+{
+
+// 64-bit FNV-1a: start from kFnv1aBasis, continue with each piece of the key
+constexpr uint64_t kFnv1aBasis = 14695981039346656037ull;
+
+inline uint64_t Fnv1a(uint64_t hash, const void* data, size_t bytes)
+{
+	const unsigned char* p = static_cast<const unsigned char*>(data);
+	for (size_t k = 0; k < bytes; k++) {
+		hash = (hash ^ p[k]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Write `filename` through write(std::ofstream&), which returns false on failure.
+ * The contents go to filename.tmp first, renamed over `filename` once complete,
+ * so a crash never leaves a truncated file behind. On failure `error` tells why.
+ */
+template <typename Write>
+bool WriteFileAtomically(const std::string& filename, Write write, std::string& error)
+{
+	const std::string temp = filename + ".tmp";
+	std::error_code code;
+	bool written;
+	{
+		std::ofstream file(temp, std::ios::out | std::ios::binary | std::ios::trunc);
+		written = bool(file) && write(file) && bool(file.flush());
+	}
+	if (!written) {
+		error = "cannot write '" + temp + "'";
+		std::filesystem::remove(temp, code);
+		return false;
+	}
+	std::filesystem::rename(temp, filename, code);
+	if (code) {
+		error = code.message();
+		std::filesystem::remove(temp, code);
+		return false;
+	}
+	return true;
+}
+
+} /* namespace cg */
+
+#endif /* CG_FILE_UTIL_H_ */
@@ -0,0 +1,56 @@
+#ifndef CG_FRUSTUM_H_
+#define CG_FRUSTUM_H_
+
+#include <glm/glm.hpp>
+
+namespace cg
+{
+
+/* The six planes of a view frustum, as (normal, distance) with the normal
+ * pointing inside. Extracted from a clip matrix, so the planes live in the
+ * space that matrix maps from: pass projection * view for world space, or
+ * projection * view * model to cull boxes given in model space.
+ */
+struct Frustum
+{
+	enum { LEFT_PLANE, RIGHT_PLANE, BOTTOM_PLANE, TOP_PLANE, NEAR_PLANE, FAR_PLANE, PLANE_NUM };
+
+	glm::vec4 planes[PLANE_NUM];
+
+	static Frustum FromMatrix(const glm::mat4& m)
+	{
+		// rows of the (column major) matrix
+		const glm::vec4 r0(m[0][0], m[1][0], m[2][0], m[3][0]);
+		const glm::vec4 r1(m[0][1], m[1][1], m[2][1], m[3][1]);
+		const glm::vec4 r2(m[0][2], m[1][2], m[2][2], m[3][2]);
+		const glm::vec4 r3(m[0][3], m[1][3], m[2][3], m[3][3]);
+
+		Frustum f;
+		f.planes[LEFT_PLANE] = r3 + r0;
+		f.planes[RIGHT_PLANE] = r3 - r0;
+		f.planes[BOTTOM_PLANE] = r3 + r1;
+		f.planes[TOP_PLANE] = r3 - r1;
+		f.planes[NEAR_PLANE] = r3 + r2;
+		f.planes[FAR_PLANE] = r3 - r2;
+		return f;
+	}
+
+	/* false only if the box is entirely outside one of the planes */
+	bool IntersectsBox(const glm::vec3& boxMin, const glm::vec3& boxMax) const
+	{
+		for (const auto& p : planes) {
+			// the box corner furthest along the plane normal
+			const glm::vec3 v(p.x >= 0 ? boxMax.x : boxMin.x,
+				p.y >= 0 ? boxMax.y : boxMin.y,
+				p.z >= 0 ? boxMax.z : boxMin.z);
+			if (p.x * v.x + p.y * v.y + p.z * v.z + p.w < 0) {
+				return false;
+			}
+		}
+		return true;
+	}
+};
+
+} /* namespace cg */
+
+#endif /* CG_FRUSTUM_H_ */
@@ -0,0 +1,129 @@
+#ifndef CG_GL_HANDLE_H_
+#define CG_GL_HANDLE_H_
+
+#include <vector>
+
+#include <glad/glad.h>
+
+namespace cg
+{
+
+/* Owner of the name of a GL object, which is deleted with the handle. Handles
+ * move but never copy; a handle converts to its name for the GL calls.
+ * Traits::Delete(name) deletes a non-zero name.
+ */
+template <typename Traits>
+class GlHandle
+{
+public:
+	GlHandle() : name_(0) {}
+	explicit GlHandle(GLuint name) : name_(name) {}
+
+	GlHandle(GlHandle&& other) noexcept : name_(other.Release()) {}
+	GlHandle& operator=(GlHandle&& other) noexcept
+	{
+		Reset(other.Release());
+		return *this;
+	}
+
+	GlHandle(const GlHandle&) = delete;
+	GlHandle& operator=(const GlHandle&) = delete;
+
+	~GlHandle() { Reset(); }
+
+	GLuint Get() const { return name_; }
+	operator GLuint() const { return name_; }
+
+	/* Delete the object and own `name` instead */
+	void Reset(GLuint name = 0)
+	{
+		if (name_ != 0 && name_ != name) {
+			Traits::Delete(name_);
+		}
+		name_ = name;
+	}
+
+	/* Give up the name without deleting the object */
+	GLuint Release()
+	{
+		const GLuint name = name_;
+		name_ = 0;
+		return name;
+	}
+
+private:
+	GLuint name_;
+};
+
+struct GlBufferTraits { static void Delete(GLuint name) { glDeleteBuffers(1, &name); } };
+struct GlVertexArrayTraits { static void Delete(GLuint name) { glDeleteVertexArrays(1, &name); } };
+struct GlTextureTraits { static void Delete(GLuint name) { glDeleteTextures(1, &name); } };
+struct GlFramebufferTraits { static void Delete(GLuint name) { glDeleteFramebuffers(1, &name); } };
+struct GlRenderbufferTraits { static void Delete(GLuint name) { glDeleteRenderbuffers(1, &name); } };
+
+using GlBuffer = GlHandle<GlBufferTraits>;
+using GlVertexArray = GlHandle<GlVertexArrayTraits>;
+using GlTexture = GlHandle<GlTextureTraits>;
+using GlFramebuffer = GlHandle<GlFramebufferTraits>;
+using GlRenderbuffer = GlHandle<GlRenderbufferTraits>;
+
+/* Objects are created with direct state access: nothing gets bound, so they can
+ * be made between draws without disturbing the bindings (see GlState).
+ */
+
+/* Immutable storage of `size` bytes, initialized from `data` unless it is null;
+ * flags: GL_DYNAMIC_STORAGE_BIT for glNamedBufferSubData, GL_MAP_*_BIT for mapping.
+ * An empty buffer gets one byte, storage cannot be empty.
+ */
+inline GlBuffer CreateBuffer(GLsizeiptr size, const void* data, GLbitfield flags = 0)
+{
+	GLuint name = 0;
+	glCreateBuffers(1, &name);
+	glNamedBufferStorage(name, size > 0 ? size : 1, size > 0 ? data : nullptr, flags);
+	return GlBuffer(name);
+}
+
+template <typename T>
+inline GlBuffer CreateBuffer(const std::vector<T>& data, GLbitfield flags = 0)
+{
+	return CreateBuffer(GLsizeiptr(data.size() * sizeof(T)), data.data(), flags);
+}
+
+inline GlVertexArray CreateVertexArray()
+{
+	GLuint name = 0;
+	glCreateVertexArrays(1, &name);
+	return GlVertexArray(name);
+}
+
+/* Immutable storage of `levels` mip levels; depth is the layer count of array targets */
+inline GlTexture CreateTexture(GLenum target, GLsizei levels, GLenum internalFormat, GLsizei width, GLsizei height, GLsizei depth = 1)
+{
+	GLuint name = 0;
+	glCreateTextures(target, 1, &name);
+	if (target == GL_TEXTURE_2D_ARRAY || target == GL_TEXTURE_3D || target == GL_TEXTURE_CUBE_MAP_ARRAY) {
+		glTextureStorage3D(name, levels, internalFormat, width, height, depth);
+	} else {
+		glTextureStorage2D(name, levels, internalFormat, width, height);
+	}
+	return GlTexture(name);
+}
+
+inline GlFramebuffer CreateFramebuffer()
+{
+	GLuint name = 0;
+	glCreateFramebuffers(1, &name);
+	return GlFramebuffer(name);
+}
+
+inline GlRenderbuffer CreateRenderbuffer(GLenum internalFormat, GLsizei width, GLsizei height)
+{
+	GLuint name = 0;
+	glCreateRenderbuffers(1, &name);
+	glNamedRenderbufferStorage(name, internalFormat, width, height);
+	return GlRenderbuffer(name);
+}
+
+} /* namespace cg */
+
+#endif /* CG_GL_HANDLE_H_ */
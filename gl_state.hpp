@@ -0,0 +1,201 @@
+#ifndef CG_GL_STATE_H_
+#define CG_GL_STATE_H_
+
+#include <cstddef>
+
+#include <glad/glad.h>
+
+namespace cg
+{
+
+/* Shadow of the GL state the draw code sets: the program, the vertex array, the
+ * texture of each unit, the draw indirect, parameter and storage buffer bindings, the
+ * capabilities, depth and blend functions, the depth mask and the patch size. A
+ * call setting what is already set is skipped, so each draw sets the state it
+ * needs and leaves it there rather than restoring defaults.
+ *
+ * Only calls made through the cache are known to it: after code that binds
+ * objects directly or deletes objects that may be bound, Invalidate() forgets
+ * the shadow and the next call of each kind is issued. Objects created with
+ * direct state access (see gl_handle.hpp) bind nothing. Textures are bound with
+ * glBindTextureUnit, the active texture unit stays 0.
+ */
+class GlState
+{
+public:
+	static constexpr int kTextureUnits = 8;
+	static constexpr int kStorageBindings = 4;
+
+	struct Stats
+	{
+		size_t issued = 0;     // GL calls made
+		size_t skipped = 0;    // calls that would have set the current state again
+	};
+
+	GlState() : enabled_(true), stats_() { Invalidate(); }
+
+	/* Off: every call is issued, for comparing the two */
+	void SetEnabled(bool enabled) { enabled_ = enabled; Invalidate(); }
+	bool Enabled() const { return enabled_; }
+
+	const Stats& GetStats() const { return stats_; }
+	void ResetStats() { stats_ = Stats(); }
+
+	/* Forget the shadowed state, it was changed behind the cache's back */
+	void Invalidate()
+	{
+		program_.known = false;
+		vertexArray_.known = false;
+		drawIndirectBuffer_.known = false;
+		parameterBuffer_.known = false;
+		for (auto& texture : textures_) {
+			texture.known = false;
+		}
+		for (auto& buffer : storageBuffers_) {
+			buffer.known = false;
+		}
+		for (auto& capability : capabilities_) {
+			capability.known = false;
+		}
+		depthFunc_.known = false;
+		depthMask_.known = false;
+		blendFunc_.known = false;
+		patchVertices_.known = false;
+	}
+
+	void UseProgram(GLuint program)
+	{
+		if (Changed(program_, program)) {
+			glUseProgram(program);
+		}
+	}
+
+	void BindVertexArray(GLuint vertexArray)
+	{
+		if (Changed(vertexArray_, vertexArray)) {
+			glBindVertexArray(vertexArray);
+		}
+	}
+
+	void BindDrawIndirectBuffer(GLuint buffer)
+	{
+		if (Changed(drawIndirectBuffer_, buffer)) {
+			glBindBuffer(GL_DRAW_INDIRECT_BUFFER, buffer);
+		}
+	}
+
+	/* Source of the draw count of glMultiDrawElementsIndirectCount */
+	void BindParameterBuffer(GLuint buffer)
+	{
+		if (Changed(parameterBuffer_, buffer)) {
+			glBindBuffer(GL_PARAMETER_BUFFER, buffer);
+		}
+	}
+
+	void BindTexture(GLuint unit, GLuint texture)
+	{
+		if (unit >= GLuint(kTextureUnits) ? Untracked() : Changed(textures_[unit], texture)) {
+			glBindTextureUnit(unit, texture);
+		}
+	}
+
+	void BindStorageBuffer(GLuint index, GLuint buffer)
+	{
+		if (index >= GLuint(kStorageBindings) ? Untracked() : Changed(storageBuffers_[index], buffer)) {
+			glBindBufferBase(GL_SHADER_STORAGE_BUFFER, index, buffer);
+		}
+	}
+
+	/* glEnable / glDisable; capabilities other than those listed in kCapabilities are always set */
+	void Enable(GLenum capability, bool enable)
+	{
+		int slot = 0;
+		while (slot < kCapabilityNum && kCapabilities[slot] != capability) {
+			slot++;
+		}
+		if (slot == kCapabilityNum ? Untracked() : Changed(capabilities_[slot], enable)) {
+			if (enable) {
+				glEnable(capability);
+			} else {
+				glDisable(capability);
+			}
+		}
+	}
+
+	void DepthFunc(GLenum func)
+	{
+		if (Changed(depthFunc_, func)) {
+			glDepthFunc(func);
+		}
+	}
+
+	void DepthMask(GLboolean mask)
+	{
+		if (Changed(depthMask_, mask)) {
+			glDepthMask(mask);
+		}
+	}
+
+	void BlendFunc(GLenum source, GLenum destination)
+	{
+		if (Changed(blendFunc_, (GLuint64(source) << 32) | destination)) {
+			glBlendFunc(source, destination);
+		}
+	}
+
+	void PatchVertices(GLint vertices)
+	{
+		if (Changed(patchVertices_, vertices)) {
+			glPatchParameteri(GL_PATCH_VERTICES, vertices);
+		}
+	}
+
+private:
+	static constexpr int kCapabilityNum = 4;
+	static constexpr GLenum kCapabilities[kCapabilityNum] = { GL_DEPTH_TEST, GL_BLEND, GL_CULL_FACE, GL_CLIP_DISTANCE0 };
+
+	template <typename T>
+	struct Shadow
+	{
+		T value{};
+		bool known = false;
+	};
+
+	bool enabled_;
+	Stats stats_;
+	Shadow<GLuint> program_;
+	Shadow<GLuint> vertexArray_;
+	Shadow<GLuint> drawIndirectBuffer_;
+	Shadow<GLuint> parameterBuffer_;
+	Shadow<GLuint> textures_[kTextureUnits];
+	Shadow<GLuint> storageBuffers_[kStorageBindings];
+	Shadow<bool> capabilities_[kCapabilityNum];
+	Shadow<GLenum> depthFunc_;
+	Shadow<GLboolean> depthMask_;
+	Shadow<GLuint64> blendFunc_;
+	Shadow<GLint> patchVertices_;
+
+	// true, counting an issued call, if the call must be made
+	template <typename T, typename U>
+	bool Changed(Shadow<T>& shadow, U value)
+	{
+		if (enabled_ && shadow.known && shadow.value == T(value)) {
+			stats_.skipped++;
+			return false;
+		}
+		shadow.value = T(value);
+		shadow.known = true;
+		stats_.issued++;
+		return true;
+	}
+
+	bool Untracked()
+	{
+		stats_.issued++;
+		return true;
+	}
+};
+
+} /* namespace cg */
+
+#endif /* CG_GL_STATE_H_ */
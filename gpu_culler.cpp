@@ -0,0 +1,214 @@
+#include "gpu_culler.h"
+
+#include <algorithm>
+
+#include "frustum.hpp"
+
+namespace cg
+{
+
+namespace
+{
+
+// local sizes of the compute shaders
+constexpr GLuint kCullGroupSize = 64;
+constexpr GLuint kPyramidGroupSize = 8;
+
+// layout of a glMultiDrawElementsIndirect command
+struct DrawCommand
+{
+    GLuint count;
+    GLuint instanceCount;
+    GLuint firstIndex;
+    GLint baseVertex;
+    GLuint baseInstance;
+};
+
+inline GLuint Groups(GLsizei n, GLuint groupSize)
+{
+    return (GLuint(n) + groupSize - 1) / groupSize;
+}
+
+} /* anonymous namespace */
+
+GpuChunkCuller::GpuChunkCuller() :
+    chunkCount_(0), pyramidWidth_(0), pyramidHeight_(0), pyramidLevels_(0),
+    pyramidViewProjection_(1.0f), nextReadback_(0), stats_()
+{
+}
+
+GpuChunkCuller::~GpuChunkCuller()
+{
+    for (auto& readback : readbacks_) {
+        if (readback.fence != nullptr) {
+            glDeleteSync(readback.fence);
+        }
+    }
+}
+
+bool GpuChunkCuller::InstallShaders(const char* cullShader, const char* pyramidShader)
+{
+    cullShader_ = Shader::CreateCompute(cullShader);
+    pyramidShader_ = Shader::CreateCompute(pyramidShader);
+    return cullShader_ != nullptr && pyramidShader_ != nullptr;
+}
+
+void GpuChunkCuller::Build(const std::vector<Chunk>& chunks)
+{
+    chunkCount_ = GLsizei(chunks.size());
+    chunkSSBO_ = CreateBuffer(chunks, GL_DYNAMIC_STORAGE_BIT);
+    commandBuffer_ = CreateBuffer(GLsizeiptr(kPasses * chunks.size() * sizeof(DrawCommand)), nullptr);
+    counterBuffer_ = CreateBuffer(GLsizeiptr(kPasses * sizeof(PassCounters)), nullptr);
+
+    // the depth and the counters of earlier frames were those of the old terrain
+    pyramidWidth_ = 0;
+    pyramidHeight_ = 0;
+    pyramidLevels_ = 0;
+    for (auto& readback : readbacks_) {
+        if (readback.fence != nullptr) {
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+        }
+        if (readback.buffer == 0) {
+            const GLbitfield flags = GL_MAP_READ_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+            readback.buffer = CreateBuffer(GLsizeiptr(kPasses * sizeof(PassCounters)), nullptr, flags);
+            readback.data = static_cast<const PassCounters*>(
+                glMapNamedBufferRange(readback.buffer, 0, GLsizeiptr(kPasses * sizeof(PassCounters)), flags));
+        }
+    }
+    stats_ = Stats();
+}
+
+void GpuChunkCuller::UpdateChunks(GLsizei first, const std::vector<Chunk>& chunks)
+{
+    if (chunks.empty() || first < 0 || first + GLsizei(chunks.size()) > chunkCount_) {
+        return;
+    }
+    glNamedBufferSubData(chunkSSBO_, GLintptr(first) * GLintptr(sizeof(Chunk)), GLsizeiptr(chunks.size() * sizeof(Chunk)), chunks.data());
+}
+
+void GpuChunkCuller::Cull(GlState& state, int pass, const glm::mat4& frustumMatrix, const glm::mat4& model,
+    bool cull, bool occlusion, GLsizei patchIndexCount)
+{
+    const Shader& shader = *cullShader_;
+    state.UseProgram(shader.Program());
+    state.BindStorageBuffer(1, chunkSSBO_);
+    state.BindStorageBuffer(2, commandBuffer_);
+    state.BindStorageBuffer(3, counterBuffer_);
+
+    // the counters of this pass start from zero; the clear is ordered before the dispatch
+    const GLintptr counterOffset = GLintptr(pass) * GLintptr(sizeof(PassCounters));
+    glClearNamedBufferSubData(counterBuffer_, GL_R32UI, counterOffset, sizeof(PassCounters), GL_RED_INTEGER, GL_UNSIGNED_INT, nullptr);
+
+    const Frustum frustum = Frustum::FromMatrix(frustumMatrix);
+    occlusion = occlusion && PyramidValid();
+    shader.Set("chunkCount", GLint(chunkCount_));
+    shader.Set("commandBase", GLint(pass * chunkCount_));
+    shader.Set("counterBase", GLint(pass * sizeof(PassCounters) / sizeof(GLuint)));
+    shader.Set("patchIndexCount", GLint(patchIndexCount));
+    shader.Set("cull", cull ? 1 : 0);
+    shader.Set(shader.Uniform("frustumPlanes"), frustum.planes, Frustum::PLANE_NUM);
+    shader.Set("occlusion", occlusion ? 1 : 0);
+    if (occlusion) {
+        state.BindTexture(kPyramidUnit, pyramid_);
+        shader.Set("occlusionMatrix", pyramidViewProjection_ * model);
+        shader.Set("pyramidLevels", pyramidLevels_);
+    }
+    glDispatchCompute(Groups(chunkCount_, kCullGroupSize), 1, 1);
+
+    // the draw reads the commands and their count
+    glMemoryBarrier(GL_COMMAND_BARRIER_BIT);
+}
+
+void GpuChunkCuller::Draw(GlState& state, int pass)
+{
+    state.BindDrawIndirectBuffer(commandBuffer_);
+    state.BindParameterBuffer(counterBuffer_);
+    const GLintptr commands = GLintptr(pass) * GLintptr(chunkCount_) * GLintptr(sizeof(DrawCommand));
+    const GLintptr count = GLintptr(pass) * GLintptr(sizeof(PassCounters));
+    glMultiDrawElementsIndirectCount(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid*)commands, count, chunkCount_, 0);
+}
+
+void GpuChunkCuller::ResizePyramid(GLsizei width, GLsizei height)
+{
+    pyramidWidth_ = width;
+    pyramidHeight_ = height;
+    pyramidLevels_ = 1;
+    while ((std::max(width, height) >> pyramidLevels_) > 0) {
+        pyramidLevels_++;
+    }
+    depthCopy_ = CreateTexture(GL_TEXTURE_2D, 1, GL_DEPTH_COMPONENT32F, width, height);
+    pyramid_ = CreateTexture(GL_TEXTURE_2D, pyramidLevels_, GL_R32F, width, height);
+    for (GLuint texture : { depthCopy_.Get(), pyramid_.Get() }) {
+        glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST_MIPMAP_NEAREST);
+        glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+        glTextureParameteri(texture, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    }
+}
+
+void GpuChunkCuller::UpdatePyramid(GlState& state, const glm::mat4& viewProjection, GLsizei width, GLsizei height)
+{
+    if (!Ready() || width <= 0 || height <= 0) {
+        return;
+    }
+    if (width != pyramidWidth_ || height != pyramidHeight_) {
+        // the old textures may still be shadowed as bound
+        ResizePyramid(width, height);
+        state.Invalidate();
+    }
+    glCopyTextureSubImage2D(depthCopy_, 0, 0, 0, 0, 0, width, height);
+
+    const Shader& shader = *pyramidShader_;
+    state.UseProgram(shader.Program());
+    const GLint sourceLevel = shader.Uniform("sourceLevel");
+    const GLint reduce = shader.Uniform("reduce");
+    for (GLint level = 0; level < pyramidLevels_; level++) {
+        // level 0 copies the depth, every other one reduces the level below it
+        state.BindTexture(kPyramidUnit, level == 0 ? depthCopy_.Get() : pyramid_.Get());
+        shader.Set(sourceLevel, std::max(level - 1, 0));
+        shader.Set(reduce, level == 0 ? 0 : 1);
+        glBindImageTexture(0, pyramid_, level, GL_FALSE, 0, GL_WRITE_ONLY, GL_R32F);
+        const GLsizei w = std::max(width >> level, 1);
+        const GLsizei h = std::max(height >> level, 1);
+        glDispatchCompute(Groups(w, kPyramidGroupSize), Groups(h, kPyramidGroupSize), 1);
+        // the next level and the culling fetch what this one wrote
+        glMemoryBarrier(GL_TEXTURE_FETCH_BARRIER_BIT);
+    }
+    pyramidViewProjection_ = viewProjection;
+}
+
+void GpuChunkCuller::EndFrame()
+{
+    if (!Ready()) {
+        return;
+    }
+
+    // counters whose copy has completed, oldest first so the newest stay; never waits
+    for (int i = 0; i < kReadbacks; i++) {
+        Readback& readback = readbacks_[(nextReadback_ + i) % kReadbacks];
+        if (readback.fence == nullptr) {
+            continue;
+        }
+        const GLenum status = glClientWaitSync(readback.fence, 0, 0);
+        if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED) {
+            std::copy(readback.data, readback.data + kPasses, stats_.passes);
+            stats_.frames++;
+            glDeleteSync(readback.fence);
+            readback.fence = nullptr;
+        }
+    }
+
+    // this frame's counters, unless the GPU is kReadbacks frames behind
+    Readback& readback = readbacks_[nextReadback_];
+    if (readback.fence != nullptr || readback.data == nullptr) {
+        stats_.dropped++;
+        return;
+    }
+    glMemoryBarrier(GL_BUFFER_UPDATE_BARRIER_BIT);
+    glCopyNamedBufferSubData(counterBuffer_, readback.buffer, 0, 0, GLsizeiptr(kPasses * sizeof(PassCounters)));
+    readback.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    nextReadback_ = (nextReadback_ + 1) % kReadbacks;
+}
+
+} /* namespace cg */
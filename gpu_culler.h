@@ -0,0 +1,135 @@
+#ifndef CG_GPU_CULLER_H_
+#define CG_GPU_CULLER_H_
+
+#include <memory>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "shader.hpp"
+#include "gl_handle.hpp"
+#include "gl_state.hpp"
+
+namespace cg
+{
+
+/* Frustum and occlusion culling of the terrain chunks in compute shaders.
+ *
+ * The chunk bounds live in a storage buffer. Per pass, one invocation per
+ * chunk tests its box against the frustum and then against a depth pyramid
+ * (Hi-Z) built from the previous frame's depth buffer, and appends a draw
+ * command for each surviving chunk. The pass is drawn with
+ * glMultiDrawElementsIndirectCount, taking the command count from the GPU, so
+ * the CPU neither walks the chunks nor waits for the result. The counters
+ * (drawn, outside the frustum, occluded) are copied to a small ring of mapped
+ * buffers and read once their fence has passed: the statistics lag a few
+ * frames behind, and reading them never stalls.
+ *
+ * The pyramid is last frame's: a chunk uncovered this frame is drawn one frame
+ * late, which the camera speeds of a viewer make invisible.
+ */
+class GpuChunkCuller
+{
+public:
+	static constexpr int kPasses = 2;         // main & mirrored
+	static constexpr int kReadbacks = 4;      // frames of counters in flight
+	static constexpr GLuint kPyramidUnit = 4; // texture unit of the depth pyramid
+
+	// std430 layout of a chunk in shaders/terrain_cull.comp
+	struct Chunk
+	{
+		glm::vec4 boxMin;    // terrain space, w unused
+		glm::vec4 boxMax;
+		GLuint firstIndex;   // index range in the terrain mesh
+		GLuint indexCount;
+		GLuint pad[2];
+	};
+
+	// counters of one pass, as the shader writes them
+	struct PassCounters
+	{
+		GLuint drawn = 0;
+		GLuint frustumCulled = 0;
+		GLuint occluded = 0;
+		GLuint indices = 0;   // indices of the drawn commands
+	};
+
+	struct Stats
+	{
+		PassCounters passes[kPasses];
+		size_t frames = 0;        // readbacks completed
+		size_t dropped = 0;       // frames not read back, the ring was full
+	};
+
+	GpuChunkCuller();
+
+	GpuChunkCuller(const GpuChunkCuller&) = delete;
+	GpuChunkCuller& operator=(const GpuChunkCuller&) = delete;
+
+	virtual ~GpuChunkCuller();
+
+	bool InstallShaders(const char* cullShader, const char* pyramidShader);
+
+	/* Upload the chunks, in the order their draw commands refer to them */
+	void Build(const std::vector<Chunk>& chunks);
+	/* New bounds for chunks [first, first + chunks.size()), e.g. after the heights were edited */
+	void UpdateChunks(GLsizei first, const std::vector<Chunk>& chunks);
+
+	bool Ready() const { return cullShader_ != nullptr && pyramidShader_ != nullptr && chunkCount_ > 0; }
+
+	/* Write the commands of `pass`: chunks are tested against the frustum of
+	 * `frustumMatrix` (terrain to clip space) unless !cull, and when `occlusion`
+	 * against the pyramid, seen through pyramidViewProjection * model. With
+	 * patchIndexCount > 0 each command is one instance of the patch with the
+	 * chunk as base instance, else the chunk's index range. Uses `state`'s program.
+	 */
+	void Cull(GlState& state, int pass, const glm::mat4& frustumMatrix, const glm::mat4& model,
+		bool cull, bool occlusion, GLsizei patchIndexCount);
+
+	/* Draw the commands of `pass` with the vertex array and program in use */
+	void Draw(GlState& state, int pass);
+
+	/* After the main pass: build the pyramid from the depth buffer of the read framebuffer
+	 * (width x height, single sampled), seen through viewProjection, for the next frame
+	 */
+	void UpdatePyramid(GlState& state, const glm::mat4& viewProjection, GLsizei width, GLsizei height);
+	bool PyramidValid() const { return pyramidLevels_ > 0; }
+
+	/* Once per frame, after the passes: read the counters that arrived, queue this frame's */
+	void EndFrame();
+
+	const Stats& LastStats() const { return stats_; }
+
+private:
+	std::unique_ptr<Shader> cullShader_;
+	std::unique_ptr<Shader> pyramidShader_;
+
+	GLsizei chunkCount_;
+	GlBuffer chunkSSBO_;
+	GlBuffer commandBuffer_;    // kPasses regions of chunkCount_ commands
+	GlBuffer counterBuffer_;    // kPasses PassCounters, also the parameter buffer of the draws
+
+	GlTexture depthCopy_;
+	GlTexture pyramid_;
+	GLsizei pyramidWidth_;
+	GLsizei pyramidHeight_;
+	GLint pyramidLevels_;
+	glm::mat4 pyramidViewProjection_;
+
+	struct Readback
+	{
+		GlBuffer buffer;          // persistently mapped
+		const PassCounters* data = nullptr;
+		GLsync fence = nullptr;
+	};
+	Readback readbacks_[kReadbacks];
+	int nextReadback_;
+	Stats stats_;
+
+	void ResizePyramid(GLsizei width, GLsizei height);
+};
+
+} /* namespace cg */
+
+#endif /* CG_GPU_CULLER_H_ */
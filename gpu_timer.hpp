@@ -0,0 +1,105 @@
+#ifndef CG_GPU_TIMER_H_
+#define CG_GPU_TIMER_H_
+
+#include <glad/glad.h>
+
+namespace cg
+{
+
+/* Result of a span of commands for one query target (GL_TIME_ELAPSED,
+ * GL_SAMPLES_PASSED, ...). A small ring of queries is used and results are
+ * only read once available, so measuring never stalls the pipeline; results
+ * lag a few frames behind.
+ */
+class GpuQuery
+{
+public:
+	static constexpr int kQueries = 4;
+
+	explicit GpuQuery(GLenum target) :
+		target_(target), queries_{0}, pending_{false}, next_(0), last_(0), total_(0), samples_(0) {}
+
+	GpuQuery(const GpuQuery&) = delete;
+	GpuQuery& operator=(const GpuQuery&) = delete;
+
+	virtual ~GpuQuery()
+	{
+		if (queries_[0] != 0) {
+			glDeleteQueries(kQueries, queries_);
+		}
+	}
+
+	void Begin()
+	{
+		if (queries_[0] == 0) {
+			glGenQueries(kQueries, queries_);
+		}
+		Collect();
+		// drop the oldest measurement if it is still in flight
+		pending_[next_] = false;
+		glBeginQuery(target_, queries_[next_]);
+	}
+
+	void End()
+	{
+		glEndQuery(target_);
+		pending_[next_] = true;
+		next_ = (next_ + 1) % kQueries;
+	}
+
+	/* Most recent available result */
+	GLuint64 LastResult() const { return last_; }
+
+	/* Average over the results since the last Reset() */
+	double AverageResult() const { return samples_ > 0 ? double(total_) / samples_ : 0.0; }
+	unsigned Samples() const { return samples_; }
+
+	void Reset()
+	{
+		total_ = 0;
+		samples_ = 0;
+	}
+
+private:
+	GLenum target_;
+	GLuint queries_[kQueries];
+	bool pending_[kQueries];
+	int next_;
+	GLuint64 last_;
+	GLuint64 total_;
+	unsigned samples_;
+
+	void Collect()
+	{
+		for (int i = 0; i < kQueries; i++) {
+			if (!pending_[i]) {
+				continue;
+			}
+			GLint available = 0;
+			glGetQueryObjectiv(queries_[i], GL_QUERY_RESULT_AVAILABLE, &available);
+			if (available) {
+				glGetQueryObjectui64v(queries_[i], GL_QUERY_RESULT, &last_);
+				total_ += last_;
+				samples_++;
+				pending_[i] = false;
+			}
+		}
+	}
+};
+
+/* GPU time of a span of commands */
+class GpuTimer : public GpuQuery
+{
+public:
+	GpuTimer() : GpuQuery(GL_TIME_ELAPSED) {}
+
+	/* Most recent available measurement, in milliseconds */
+	double LastMilliseconds() const { return double(LastResult()) * 1e-6; }
+
+	/* Average over the measurements since the last Reset(), in milliseconds */
+	double AverageMilliseconds() const { return AverageResult() * 1e-6; }
+};
+
+} /* namespace cg */
+
+#endif /* CG_GPU_TIMER_H_ */
@@ -0,0 +1,113 @@
+#ifndef CG_GRID_MESH_H_
+#define CG_GRID_MESH_H_
+
+#include <algorithm>
+#include <deque>
+#include <vector>
+
+#include <glad/glad.h>
+
+namespace cg
+{
+
+/* Index buffer helpers for a regular width x height vertex grid
+ * (vertex (row, col) lives at row * width + col).
+ */
+namespace grid_mesh
+{
+
+// number of entries of the post-transform cache we optimize for,
+// conservative for current desktop GPUs
+constexpr int kVertexCacheSize = 32;
+
+// Quads per stripe: while walking a stripe row by row, the previous row
+// (stripe + 1 vertices) must still be cached when the next row is emitted.
+constexpr int kStripeWidth = kVertexCacheSize / 2 - 1;
+
+/* Append the indexed triangle list for the quads in [row0, row1) x [col0, col1)
+ * to `out`. Quads are visited in vertical stripes of kStripeWidth columns so
+ * every shared vertex is reused while it is still in the vertex cache.
+ */
+inline void AppendGridIndices(std::vector<GLuint>& out, int width,
+	int row0, int row1, int col0, int col1)
+{
+	for (int stripe = col0; stripe < col1; stripe += kStripeWidth) {
+		const int stripeEnd = std::min(stripe + kStripeWidth, col1);
+		for (int i = row0; i < row1; i++) {
+			for (int j = stripe; j < stripeEnd; j++) {
+				const GLuint v00 = GLuint(i * width + j);
+				const GLuint v01 = v00 + 1;
+				const GLuint v10 = v00 + GLuint(width);
+				const GLuint v11 = v10 + 1;
+
+				out.push_back(v00);
+				out.push_back(v10);
+				out.push_back(v01);
+
+				out.push_back(v01);
+				out.push_back(v10);
+				out.push_back(v11);
+			}
+		}
+	}
+}
+
+/* Cache-optimized triangle list covering the whole grid */
+inline std::vector<GLuint> BuildGridIndices(int width, int height)
+{
+	std::vector<GLuint> indices;
+	if (width < 2 || height < 2) {
+		return indices;
+	}
+	indices.reserve(size_t(width - 1) * size_t(height - 1) * 6);
+	AppendGridIndices(indices, width, 0, height - 1, 0, width - 1);
+	return indices;
+}
+
+struct CacheEstimate
+{
+	double acmr;     // average cache miss ratio: transformed vertices per triangle
+	double hitRate;  // fraction of indices served from the post-transform cache
+};
+
+/* Simulate a FIFO post-transform cache of `cacheSize` entries over the first
+ * `maxIndices` entries of `indices` (the ordering is periodic, so a prefix is
+ * representative and keeps this cheap on huge grids).
+ */
+inline CacheEstimate EstimateVertexCache(const GLuint* indices, size_t indexCount,
+	int cacheSize = kVertexCacheSize, size_t maxIndices = size_t(1) << 20)
+{
+	const size_t count = std::min(indexCount, maxIndices - maxIndices % 3);
+	if (count == 0) {
+		return {0.0, 0.0};
+	}
+
+	std::deque<GLuint> fifo;
+	size_t misses = 0;
+	for (size_t k = 0; k < count; k++) {
+		const GLuint idx = indices[k];
+		if (std::find(fifo.begin(), fifo.end(), idx) != fifo.end()) {
+			continue;
+		}
+		misses++;
+		fifo.push_back(idx);
+		if (int(fifo.size()) > cacheSize) {
+			fifo.pop_front();
+		}
+	}
+
+	const double triangles = double(count) / 3;
+	return {double(misses) / triangles, 1.0 - double(misses) / double(count)};
+}
+
+inline CacheEstimate EstimateVertexCache(const std::vector<GLuint>& indices,
+	int cacheSize = kVertexCacheSize, size_t maxIndices = size_t(1) << 20)
+{
+	return EstimateVertexCache(indices.data(), indices.size(), cacheSize, maxIndices);
+}
+
+} /* namespace grid_mesh */
+
+} /* namespace cg */
+
+#endif /* CG_GRID_MESH_H_ */
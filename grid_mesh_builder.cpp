@@ -0,0 +1,319 @@
+#include "grid_mesh_builder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+#if defined(__AVX2__)
+#define CG_GRID_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_GRID_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace cg
+{
+
+namespace
+{
+
+// Per-row constants shared by all the column kernels
+struct RowParams
+{
+	const unsigned char* up;    // row i - 1 (clamped)
+	const unsigned char* mid;   // row i
+	const unsigned char* down;  // row i + 1 (clamped)
+	float z;                    // i / height
+	float scaleX;               // interior d(y)/d(x) per height step difference
+	float scaleZ;               // d(y)/d(z) per height step difference for this row
+	float width;
+};
+
+inline void StoreVertex(GridVertex* v, float x, float y, float z, float nx, float nz)
+{
+	const float len = std::sqrt(nx * nx + 1.0f + nz * nz);
+	v->position[0] = x;
+	v->position[1] = y;
+	v->position[2] = z;
+	v->normal[0] = nx / len;
+	v->normal[1] = 1.0f / len;
+	v->normal[2] = nz / len;
+}
+
+void BuildColumnsScalar(const RowParams& row, int width, int col0, int col1, GridVertex* out)
+{
+	for (int j = col0; j < col1; j++) {
+		const int jl = std::max(j - 1, 0);
+		const int jr = std::min(j + 1, width - 1);
+		// one-sided difference at the left/right border
+		const float scaleX = (jr - jl == 2) ? row.scaleX : (jr > jl ? 2.0f * row.scaleX : 0.0f);
+
+		const float nx = -float(int(row.mid[jr]) - int(row.mid[jl])) * scaleX;
+		const float nz = -float(int(row.down[j]) - int(row.up[j])) * row.scaleZ;
+		StoreVertex(out + j, float(j) / row.width, float(row.mid[j]) / 256, row.z, nx, nz);
+	}
+}
+
+#ifdef CG_GRID_SSE2
+
+inline __m128 LoadHeights4(const unsigned char* p)
+{
+	int packed;
+	std::memcpy(&packed, p, sizeof(packed));
+	const __m128i zero = _mm_setzero_si128();
+	__m128i v = _mm_cvtsi32_si128(packed);
+	v = _mm_unpacklo_epi8(v, zero);
+	v = _mm_unpacklo_epi16(v, zero);
+	return _mm_cvtepi32_ps(v);
+}
+
+/* Write 4 vertices given SoA components; z is constant for the row */
+inline void StoreVertices4(GridVertex* out, __m128 px, __m128 py, __m128 pz, __m128 nx, __m128 ny, __m128 nz)
+{
+	float* dst = out->position;
+	_MM_TRANSPOSE4_PS(px, py, pz, nx);
+	const __m128 lo = _mm_unpacklo_ps(ny, nz);
+	const __m128 hi = _mm_unpackhi_ps(ny, nz);
+
+	_mm_storeu_ps(dst + 0, px);
+	_mm_storel_pi(reinterpret_cast<__m64*>(dst + 4), lo);
+	_mm_storeu_ps(dst + 6, py);
+	_mm_storeh_pi(reinterpret_cast<__m64*>(dst + 10), lo);
+	_mm_storeu_ps(dst + 12, pz);
+	_mm_storel_pi(reinterpret_cast<__m64*>(dst + 16), hi);
+	_mm_storeu_ps(dst + 18, nx);
+	_mm_storeh_pi(reinterpret_cast<__m64*>(dst + 22), hi);
+}
+
+/* Interior columns only: requires 1 <= col0 and col1 <= width - 1 */
+int BuildColumnsSse2(const RowParams& row, int col0, int col1, GridVertex* out)
+{
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 inv256 = _mm_set1_ps(1.0f / 256);
+	const __m128 negScaleX = _mm_set1_ps(-row.scaleX);
+	const __m128 negScaleZ = _mm_set1_ps(-row.scaleZ);
+	const __m128 widthV = _mm_set1_ps(row.width);
+	const __m128 zV = _mm_set1_ps(row.z);
+	const __m128i lane = _mm_setr_epi32(0, 1, 2, 3);
+
+	int j = col0;
+	for (; j + 4 <= col1; j += 4) {
+		const __m128 h = LoadHeights4(row.mid + j);
+		const __m128 nx = _mm_mul_ps(_mm_sub_ps(LoadHeights4(row.mid + j + 1), LoadHeights4(row.mid + j - 1)), negScaleX);
+		const __m128 nz = _mm_mul_ps(_mm_sub_ps(LoadHeights4(row.down + j), LoadHeights4(row.up + j)), negScaleZ);
+
+		const __m128 len = _mm_sqrt_ps(_mm_add_ps(_mm_add_ps(_mm_mul_ps(nx, nx), one), _mm_mul_ps(nz, nz)));
+		const __m128 x = _mm_div_ps(_mm_cvtepi32_ps(_mm_add_epi32(_mm_set1_epi32(j), lane)), widthV);
+
+		StoreVertices4(out + j, x, _mm_mul_ps(h, inv256), zV,
+			_mm_div_ps(nx, len), _mm_div_ps(one, len), _mm_div_ps(nz, len));
+	}
+	return j;
+}
+
+#endif /* CG_GRID_SSE2 */
+
+#ifdef CG_GRID_AVX2
+
+inline __m256 LoadHeights8(const unsigned char* p)
+{
+	return _mm256_cvtepi32_ps(_mm256_cvtepu8_epi32(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p))));
+}
+
+/* Interior columns only: requires 1 <= col0 and col1 <= width - 1 */
+int BuildColumnsAvx2(const RowParams& row, int col0, int col1, GridVertex* out)
+{
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 inv256 = _mm256_set1_ps(1.0f / 256);
+	const __m256 negScaleX = _mm256_set1_ps(-row.scaleX);
+	const __m256 negScaleZ = _mm256_set1_ps(-row.scaleZ);
+	const __m256 widthV = _mm256_set1_ps(row.width);
+	const __m128 zV = _mm_set1_ps(row.z);
+	const __m256i lane = _mm256_setr_epi32(0, 1, 2, 3, 4, 5, 6, 7);
+
+	int j = col0;
+	for (; j + 8 <= col1; j += 8) {
+		const __m256 h = LoadHeights8(row.mid + j);
+		const __m256 nx = _mm256_mul_ps(_mm256_sub_ps(LoadHeights8(row.mid + j + 1), LoadHeights8(row.mid + j - 1)), negScaleX);
+		const __m256 nz = _mm256_mul_ps(_mm256_sub_ps(LoadHeights8(row.down + j), LoadHeights8(row.up + j)), negScaleZ);
+
+		const __m256 len = _mm256_sqrt_ps(_mm256_add_ps(_mm256_add_ps(_mm256_mul_ps(nx, nx), one), _mm256_mul_ps(nz, nz)));
+		const __m256 x = _mm256_div_ps(_mm256_cvtepi32_ps(_mm256_add_epi32(_mm256_set1_epi32(j), lane)), widthV);
+		const __m256 y = _mm256_mul_ps(h, inv256);
+		const __m256 unx = _mm256_div_ps(nx, len);
+		const __m256 uny = _mm256_div_ps(one, len);
+		const __m256 unz = _mm256_div_ps(nz, len);
+
+		// AoS interleaving is done per 128-bit half
+		StoreVertices4(out + j, _mm256_castps256_ps128(x), _mm256_castps256_ps128(y), zV,
+			_mm256_castps256_ps128(unx), _mm256_castps256_ps128(uny), _mm256_castps256_ps128(unz));
+		StoreVertices4(out + j + 4, _mm256_extractf128_ps(x, 1), _mm256_extractf128_ps(y, 1), zV,
+			_mm256_extractf128_ps(unx, 1), _mm256_extractf128_ps(uny, 1), _mm256_extractf128_ps(unz, 1));
+	}
+	return j;
+}
+
+#endif /* CG_GRID_AVX2 */
+
+inline int16_t ToSnorm16(float v)
+{
+	return int16_t(std::lround(std::min(std::max(v, -1.0f), 1.0f) * 32767.0f));
+}
+
+} /* anonymous namespace */
+
+void EncodeOctahedral(const float normal[3], int16_t out[2])
+{
+	// project onto the octahedron |x| + |y| + |z| = 1, then fold the lower half over the upper
+	const float l1 = std::fabs(normal[0]) + std::fabs(normal[1]) + std::fabs(normal[2]);
+	float u = l1 > 0 ? normal[0] / l1 : 0.0f;
+	float v = l1 > 0 ? normal[2] / l1 : 0.0f;
+	if (normal[1] < 0) {
+		const float fu = (1.0f - std::fabs(v)) * (u >= 0 ? 1.0f : -1.0f);
+		const float fv = (1.0f - std::fabs(u)) * (v >= 0 ? 1.0f : -1.0f);
+		u = fu;
+		v = fv;
+	}
+	out[0] = ToSnorm16(u);
+	out[1] = ToSnorm16(v);
+}
+
+GridMeshBuilder::GridMeshBuilder(unsigned threads, bool useSimd) :
+	threads_(1), useSimd_(useSimd)
+{
+	SetThreads(threads);
+}
+
+void GridMeshBuilder::SetThreads(unsigned threads)
+{
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	threads_ = std::max(threads, 1u);
+}
+
+GridMeshBuilder::SimdPath GridMeshBuilder::CompiledPath()
+{
+#if defined(CG_GRID_AVX2)
+	return SimdPath::AVX2;
+#elif defined(CG_GRID_SSE2)
+	return SimdPath::SSE2;
+#else
+	return SimdPath::SCALAR;
+#endif
+}
+
+const char* GridMeshBuilder::PathName(SimdPath path)
+{
+	switch (path) {
+	case SimdPath::AVX2:
+		return "AVX2";
+	case SimdPath::SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
+
+void GridMeshBuilder::Build(const unsigned char* heights, int width, int height, GridVertex* out) const
+{
+	BuildBands(heights, width, height, out, &GridMeshBuilder::BuildRows);
+}
+
+void GridMeshBuilder::Build(const unsigned char* heights, int width, int height, PackedGridVertex* out) const
+{
+	BuildBands(heights, width, height, out, &GridMeshBuilder::BuildPackedRows);
+}
+
+template <typename Vertex>
+void GridMeshBuilder::BuildBands(const unsigned char* heights, int width, int height, Vertex* out,
+	void (GridMeshBuilder::*rows)(const unsigned char*, int, int, int, int, Vertex*) const) const
+{
+	if (width <= 0 || height <= 0) {
+		return;
+	}
+
+	const int bands = int(std::min<unsigned>(threads_, unsigned(height)));
+	if (bands <= 1) {
+		(this->*rows)(heights, width, height, 0, height, out);
+		return;
+	}
+
+	// contiguous row bands keep each worker on its own cache lines
+	std::vector<std::thread> workers;
+	workers.reserve(bands - 1);
+	const int rowsPerBand = (height + bands - 1) / bands;
+	for (int b = 1; b < bands; b++) {
+		const int row0 = b * rowsPerBand;
+		const int row1 = std::min(row0 + rowsPerBand, height);
+		if (row0 >= row1) {
+			break;
+		}
+		workers.emplace_back(rows, this, heights, width, height, row0, row1, out);
+	}
+	(this->*rows)(heights, width, height, 0, std::min(rowsPerBand, height), out);
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void GridMeshBuilder::BuildRows(const unsigned char* heights, int width, int height, int row0, int row1, GridVertex* out) const
+{
+	for (int i = row0; i < row1; i++) {
+		BuildRow(heights, width, height, i, out + size_t(i) * width);
+	}
+}
+
+void GridMeshBuilder::BuildPackedRows(const unsigned char* heights, int width, int height, int row0, int row1, PackedGridVertex* out) const
+{
+	std::vector<GridVertex> scratch(width);
+	for (int i = row0; i < row1; i++) {
+		BuildRow(heights, width, height, i, scratch.data());
+
+		const unsigned char* row = heights + size_t(i) * width;
+		PackedGridVertex* rowOut = out + size_t(i) * width;
+		for (int j = 0; j < width; j++) {
+			rowOut[j].height = uint16_t(row[j] << 8);
+			rowOut[j].reserved = 0;
+			EncodeOctahedral(scratch[j].normal, rowOut[j].normal);
+		}
+	}
+}
+
+void GridMeshBuilder::BuildRow(const unsigned char* heights, int width, int height, int i, GridVertex* rowOut) const
+{
+	const int il = std::max(i - 1, 0);
+	const int ir = std::min(i + 1, height - 1);
+
+	RowParams row;
+	row.up = heights + size_t(il) * width;
+	row.mid = heights + size_t(i) * width;
+	row.down = heights + size_t(ir) * width;
+	row.z = float(i) / height;
+	row.width = float(width);
+	// y is h / 256 and grid spacing is 1 / width, so central differences
+	// span 2 / width: dy/dx = dh * width / 512
+	row.scaleX = float(width) / 512;
+	row.scaleZ = ir > il ? float(height) / (256.0f * float(ir - il)) : 0.0f;
+
+	// border columns (and everything when SIMD is off) take the scalar path
+	int j = std::min(1, width);
+	BuildColumnsScalar(row, width, 0, j, rowOut);
+	if (useSimd_ && width > 2) {
+#if defined(CG_GRID_AVX2)
+		j = BuildColumnsAvx2(row, j, width - 1, rowOut);
+#endif
+#if defined(CG_GRID_SSE2)
+		j = BuildColumnsSse2(row, j, width - 1, rowOut);
+#endif
+	}
+	BuildColumnsScalar(row, width, j, width, rowOut);
+}
+
+} /* namespace cg */
@@ -0,0 +1,86 @@
+#ifndef CG_GRID_MESH_BUILDER_H_
+#define CG_GRID_MESH_BUILDER_H_
+
+#include <cstdint>
+
+namespace cg
+{
+
+/* Interleaved terrain vertex with float position and normal */
+struct GridVertex
+{
+	float position[3];
+	float normal[3];
+};
+
+/* Compact terrain vertex, the layout of the terrain VBO (8 bytes instead of 24).
+ *
+ * x and z are implicit: the vertex shader derives the grid column and row from
+ * gl_VertexID. The height is h * 256 for an 8-bit sample h, so y = height / 65536
+ * exactly, and the unit normal is octahedral encoded around +y, in snorm16.
+ */
+struct PackedGridVertex
+{
+	uint16_t height;
+	uint16_t reserved;
+	int16_t normal[2];
+};
+
+static_assert(sizeof(PackedGridVertex) == 8, "PackedGridVertex must stay 8 bytes");
+
+/* Octahedral encoding of a unit normal, x and z on the octahedron's y = 0 plane */
+void EncodeOctahedral(const float normal[3], int16_t out[2]);
+
+/* Converts an 8-bit heightmap straight into grid vertices.
+ *
+ * Vertex (i, j) is placed at (j / width, h / 256, i / height), the same unit
+ * cube layout the trimesh based loader produced, and its normal is taken from
+ * central differences of the neighbouring heights (one-sided at the border).
+ * Rows are split into bands processed by worker threads, each band using the
+ * widest SIMD path compiled in (AVX2, SSE2, or scalar).
+ */
+class GridMeshBuilder
+{
+public:
+	enum class SimdPath
+	{
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	// threads == 0 means one per hardware thread
+	explicit GridMeshBuilder(unsigned threads = 0, bool useSimd = true);
+
+	unsigned Threads() const { return threads_; }
+	bool UseSimd() const { return useSimd_; }
+	SimdPath Path() const { return useSimd_ ? CompiledPath() : SimdPath::SCALAR; }
+
+	void SetThreads(unsigned threads);
+	void SetUseSimd(bool useSimd) { useSimd_ = useSimd; }
+
+	/* Fill out[0 .. width * height) from heights[0 .. width * height) */
+	void Build(const unsigned char* heights, int width, int height, GridVertex* out) const;
+	void Build(const unsigned char* heights, int width, int height, PackedGridVertex* out) const;
+
+	static SimdPath CompiledPath();
+	static const char* PathName(SimdPath path);
+
+private:
+	unsigned threads_;
+	bool useSimd_;
+
+	void BuildRow(const unsigned char* heights, int width, int height, int i, GridVertex* rowOut) const;
+	void BuildRows(const unsigned char* heights, int width, int height, int row0, int row1, GridVertex* out) const;
+	// rows go through a float scratch row, packed while still in cache
+	void BuildPackedRows(const unsigned char* heights, int width, int height, int row0, int row1, PackedGridVertex* out) const;
+
+	// splits the rows into bands, one per thread
+	template <typename Vertex>
+	void BuildBands(const unsigned char* heights, int width, int height, Vertex* out,
+		void (GridMeshBuilder::*rows)(const unsigned char*, int, int, int, int, Vertex*) const) const;
+};
+
+} /* namespace cg */
+
+#endif /* CG_GRID_MESH_BUILDER_H_ */
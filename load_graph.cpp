@@ -0,0 +1,240 @@
+#include "load_graph.h"
+
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <mutex>
+#include <thread>
+
+#include <glad/glad.h>
+
+namespace cg
+{
+
+namespace
+{
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+std::string JsonString(const std::string& text)
+{
+    std::string quoted = "\"";
+    for (const char c : text) {
+        if (c == '"' || c == '\\') {
+            quoted += '\\';
+        }
+        quoted += c;
+    }
+    return quoted + "\"";
+}
+
+} /* anonymous namespace */
+
+LoadGraph::LoadGraph(unsigned threads) :
+    threads_(threads), wallMilliseconds_(0.0)
+{
+    if (threads_ == 0) {
+        threads_ = std::min(std::max(std::thread::hardware_concurrency(), 1u), 4u);
+    }
+}
+
+LoadGraph::Task LoadGraph::Add(const std::string& name, Lane lane, std::function<bool()> run, const std::vector<Task>& after)
+{
+    // a task only depends on tasks added before it, so the graph has no cycles
+    const Task task = Task(nodes_.size());
+    Node node{ name, lane, std::move(run), {}, {} };
+    for (Task dependency : after) {
+        if (dependency >= 0 && dependency < task) {
+            node.after.push_back(dependency);
+            nodes_[dependency].next.push_back(task);
+        }
+    }
+    nodes_.push_back(std::move(node));
+    done_.push_back(0);
+    ok_.push_back(0);
+    return task;
+}
+
+void LoadGraph::SetSharedContext(std::function<void()> makeCurrent, std::function<void()> release)
+{
+    makeCurrent_ = std::move(makeCurrent);
+    release_ = std::move(release);
+}
+
+bool LoadGraph::Run()
+{
+    const auto start = std::chrono::steady_clock::now();
+    const bool shared = makeCurrent_ != nullptr;
+    auto laneOf = [&](Task task) {
+        return nodes_[task].lane == Lane::SHARED_GL && !shared ? Lane::GL : nodes_[task].lane;
+    };
+
+    std::mutex mutex;
+    std::condition_variable changed;
+    std::deque<Task> ready[3];
+    std::vector<size_t> waiting(nodes_.size());
+    size_t remaining = nodes_.size();
+    timeline_.clear();
+    std::fill(done_.begin(), done_.end(), 0);
+    std::fill(ok_.begin(), ok_.end(), 0);
+    for (Task task = 0; task < Task(nodes_.size()); task++) {
+        waiting[task] = nodes_[task].after.size();
+        if (waiting[task] == 0) {
+            ready[int(laneOf(task))].push_back(task);
+        }
+    }
+
+    // under the lock: a failed task skips everything downstream of it
+    std::function<void(Task, bool)> finish = [&](Task task, bool ok) {
+        done_[task] = 1;
+        ok_[task] = ok ? 1 : 0;
+        remaining--;
+        for (Task next : nodes_[task].next) {
+            if (done_[next]) {
+                continue;
+            }
+            if (!ok) {
+                std::cerr << "Load task '" << nodes_[next].name << "' skipped, '" << nodes_[task].name << "' failed" << std::endl;
+                finish(next, false);
+            } else if (--waiting[next] == 0) {
+                ready[int(laneOf(next))].push_back(next);
+            }
+        }
+    };
+
+    // runs the tasks of a lane until none is left in the graph
+    auto serve = [&](Lane lane, unsigned thread) {
+        std::unique_lock<std::mutex> lock(mutex);
+        while (true) {
+            changed.wait(lock, [&] { return remaining == 0 || !ready[int(lane)].empty(); });
+            if (ready[int(lane)].empty()) {
+                return;
+            }
+            const Task task = ready[int(lane)].front();
+            ready[int(lane)].pop_front();
+            lock.unlock();
+
+            const double begin = MillisecondsSince(start);
+            const bool ok = nodes_[task].run();
+            if (lane == Lane::SHARED_GL) {
+                glFinish();
+            }
+            const double end = MillisecondsSince(start);
+            if (!ok) {
+                std::cerr << "Load task '" << nodes_[task].name << "' failed" << std::endl;
+            }
+
+            lock.lock();
+            timeline_.push_back({ nodes_[task].name, nodes_[task].lane, thread, begin, end, ok });
+            finish(task, ok);
+            changed.notify_all();
+        }
+    };
+
+    std::vector<std::thread> threads;
+    if (shared) {
+        threads.emplace_back([&] {
+            makeCurrent_();
+            serve(Lane::SHARED_GL, 1);
+            release_();
+        });
+    }
+    for (unsigned t = 0; t < threads_; t++) {
+        threads.emplace_back(serve, Lane::WORKER, t + 2);
+    }
+    serve(Lane::GL, 0);
+    for (auto& thread : threads) {
+        thread.join();
+    }
+
+    wallMilliseconds_ = MillisecondsSince(start);
+    std::sort(timeline_.begin(), timeline_.end(), [](const Span& a, const Span& b) { return a.start < b.start; });
+    return std::all_of(ok_.begin(), ok_.end(), [](char ok) { return ok != 0; });
+}
+
+double LoadGraph::SerialMilliseconds() const
+{
+    double sum = 0.0;
+    for (const auto& span : timeline_) {
+        sum += span.end - span.start;
+    }
+    return sum;
+}
+
+void LoadGraph::PrintTimeline(std::ostream& out, int columns) const
+{
+    const double serial = SerialMilliseconds();
+    out << std::fixed << std::setprecision(1) << "Load timeline: " << wallMilliseconds_ << " ms, "
+        << serial << " ms one after another (" << std::max(serial - wallMilliseconds_, 0.0) << " ms saved)" << std::endl;
+
+    size_t nameWidth = 0;
+    for (const auto& span : timeline_) {
+        nameWidth = std::max(nameWidth, span.name.size());
+    }
+    const double scale = columns / std::max(wallMilliseconds_, 1e-3);
+    for (const auto& span : timeline_) {
+        // every span gets one column at least
+        const int from = std::min(int(span.start * scale), columns - 1);
+        const int to = std::max(std::min(int(span.end * scale), columns), from + 1);
+        const std::string bar = std::string(size_t(from), ' ') + std::string(size_t(to - from), span.ok ? '#' : 'x')
+            + std::string(size_t(columns - to), ' ');
+        out << "  " << std::left << std::setw(int(nameWidth)) << span.name << std::right << " " << std::setw(9)
+            << LaneName(span.lane) << " " << std::setw(2) << span.thread << " |" << bar << "| "
+            << std::setw(7) << span.start << " .. " << std::setw(7) << span.end << " ms" << std::endl;
+    }
+    out.unsetf(std::ios::floatfield);
+    out << std::setprecision(6);
+}
+
+bool LoadGraph::WriteTrace(const std::string& file) const
+{
+    std::ofstream out(file, std::ios::out | std::ios::trunc);
+    if (!out) {
+        std::cerr << "Load graph: cannot write trace '" << file << "'" << std::endl;
+        return false;
+    }
+
+    // complete events in microseconds, one track per thread
+    out << "{\"traceEvents\":[" << std::endl;
+    std::vector<unsigned> threads;
+    for (const auto& span : timeline_) {
+        if (std::find(threads.begin(), threads.end(), span.thread) == threads.end()) {
+            threads.push_back(span.thread);
+        }
+    }
+    bool first = true;
+    for (unsigned thread : threads) {
+        const std::string name = thread == 0 ? "GL thread" : thread == 1 ? "shared context" : "worker " + std::to_string(thread - 1);
+        out << (first ? "" : ",\n") << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":" << thread
+            << ",\"args\":{\"name\":" << JsonString(name) << "}}";
+        first = false;
+    }
+    for (const auto& span : timeline_) {
+        out << ",\n{\"name\":" << JsonString(span.name) << ",\"cat\":\"" << LaneName(span.lane) << "\",\"ph\":\"X\",\"pid\":1,\"tid\":"
+            << span.thread << ",\"ts\":" << int64_t(span.start * 1000.0) << ",\"dur\":" << int64_t((span.end - span.start) * 1000.0)
+            << ",\"args\":{\"ok\":" << (span.ok ? "true" : "false") << "}}";
+    }
+    out << std::endl << "]}" << std::endl;
+    return bool(out);
+}
+
+const char* LoadGraph::LaneName(Lane lane)
+{
+    switch (lane) {
+    case Lane::WORKER:
+        return "worker";
+    case Lane::GL:
+        return "GL";
+    default:
+        return "shared GL";
+    }
+}
+
+} /* namespace cg */
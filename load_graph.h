@@ -0,0 +1,101 @@
+#ifndef CG_LOAD_GRAPH_H_
+#define CG_LOAD_GRAPH_H_
+
+#include <chrono>
+#include <functional>
+#include <ostream>
+#include <string>
+#include <vector>
+
+namespace cg
+{
+
+/* Runs load tasks as soon as the tasks they depend on have succeeded.
+ *
+ * Each task runs on a lane: WORKER tasks (file I/O, decoding, CPU builds, no GL
+ * calls) on a pool of worker threads; GL tasks on the thread calling Run(),
+ * which owns the GL context; SHARED_GL tasks, one after another, on a thread
+ * of their own with a context sharing objects with that one (see
+ * SetSharedContext()), so that e.g. shader compilation overlaps the uploads.
+ * Without a shared context they run as GL tasks.
+ *
+ * A task returns false on failure; the tasks depending on it are skipped. The
+ * span of every task is recorded for a timeline of the run.
+ */
+class LoadGraph
+{
+public:
+	enum class Lane
+	{
+		WORKER,
+		GL,
+		SHARED_GL
+	};
+
+	using Task = int;
+
+	struct Span
+	{
+		std::string name;
+		Lane lane;
+		unsigned thread;        // 0: the GL thread, 1: the shared context, then the workers
+		double start;           // milliseconds since Run() started
+		double end;
+		bool ok;
+	};
+
+	// threads == 0 means one per hardware thread, at most 4
+	explicit LoadGraph(unsigned threads = 0);
+
+	LoadGraph(const LoadGraph&) = delete;
+	LoadGraph& operator=(const LoadGraph&) = delete;
+
+	/* Task `run` on `lane`, started once every task of `after` has succeeded */
+	Task Add(const std::string& name, Lane lane, std::function<bool()> run, const std::vector<Task>& after = {});
+
+	/* Run SHARED_GL tasks on a thread that calls makeCurrent() first and release() last;
+	 * each task is followed by glFinish() so the objects it made are complete for the GL thread
+	 */
+	void SetSharedContext(std::function<void()> makeCurrent, std::function<void()> release);
+
+	/* Run all tasks, returns once they have all finished or been skipped; false if any failed */
+	bool Run();
+
+	bool Succeeded(Task task) const { return done_[task] && ok_[task]; }
+
+	/* Spans in start order */
+	const std::vector<Span>& Timeline() const { return timeline_; }
+	double WallMilliseconds() const { return wallMilliseconds_; }
+	/* Sum of the task spans: the wall time if they had run one after another */
+	double SerialMilliseconds() const;
+
+	/* One bar per task on a common time axis, `columns` characters wide */
+	void PrintTimeline(std::ostream& out, int columns = 60) const;
+	/* The timeline in Chrome's trace event format (chrome://tracing, Perfetto) */
+	bool WriteTrace(const std::string& file) const;
+
+	static const char* LaneName(Lane lane);
+
+private:
+	struct Node
+	{
+		std::string name;
+		Lane lane;
+		std::function<bool()> run;
+		std::vector<Task> after;
+		std::vector<Task> next;
+	};
+
+	unsigned threads_;
+	std::vector<Node> nodes_;
+	std::vector<char> done_;
+	std::vector<char> ok_;
+	std::function<void()> makeCurrent_;
+	std::function<void()> release_;
+	std::vector<Span> timeline_;
+	double wallMilliseconds_;
+};
+
+} /* namespace cg */
+
+#endif /* CG_LOAD_GRAPH_H_ */
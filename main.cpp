@@ -1,9 +1,12 @@
 /*
  * OpenGL version 4.6 project.
  */
+#include <cmath>
+#include <cstring>
 #include <ctime>
 #include <iostream>
 #include <filesystem>
+#include <vector>
 
 #include <glad/glad.h>
 #include <GLFW/glfw3.h>
@@ -17,12 +20,16 @@
 #include "shader.hpp"
 #include "camera.hpp"
 #include "terrain_engine.h"
+#include "gpu_timer.hpp"
+#include "load_graph.h"
 
 namespace fs = std::filesystem;
 using namespace cg;
 
 // input image files
 constexpr auto HEIGHTMAP_FILE = "assets/heightmap.bmp";
+// binary terrain converted from HEIGHTMAP_FILE by tools/terrain_convert, mapped instead when present
+constexpr auto TERRAIN_FILE = "assets/heightmap.cgt";
 constexpr auto TEXTURE_FILE = "assets/terrain-texture3.bmp";
 constexpr auto DETAIL_FILE = "assets/detail.bmp";
 constexpr const char* SKYBOX_FILES[5] = {
@@ -40,9 +47,33 @@ constexpr auto WATER_VERT_SHADER = "shaders/water.vert";
 constexpr auto WATER_FRAG_SHADER = "shaders/water.frag";
 constexpr auto TERRAIN_VERT_SHADER = "shaders/terrain.vert";
 constexpr auto TERRAIN_FRAG_SHADER = "shaders/terrain.frag";
+constexpr auto TERRAIN_LOD_VERT_SHADER = "shaders/terrain_cdlod.vert";
+constexpr auto TERRAIN_CLIPMAP_VERT_SHADER = "shaders/terrain_clipmap.vert";
+constexpr auto TERRAIN_PATCH_VERT_SHADER = "shaders/terrain_patch.vert";
+constexpr auto TERRAIN_TESS_VERT_SHADER = "shaders/terrain_tess.vert";
+constexpr auto TERRAIN_TESS_CONTROL_SHADER = "shaders/terrain_tess.tesc";
+constexpr auto TERRAIN_TESS_EVALUATION_SHADER = "shaders/terrain_tess.tese";
+constexpr auto TERRAIN_CULL_SHADER = "shaders/terrain_cull.comp";
+constexpr auto DEPTH_PYRAMID_SHADER = "shaders/depth_pyramid.comp";
+constexpr auto TERRAIN_MESH_SHADER = "shaders/terrain_mesh.comp";
 constexpr auto LAMP_VERT_SHADER = "shaders/lamp.vert";
 constexpr auto LAMP_FRAG_SHADER = "shaders/lamp.frag";
 
+// linked program binaries, reused while the sources and the driver stay the same
+constexpr auto SHADER_CACHE_DIR = "cache/shaders";
+constexpr auto TEXTURE_CACHE_DIR = "cache/textures";
+// startup timeline, for chrome://tracing or Perfetto
+constexpr auto STARTUP_TRACE_FILE = "cache/startup_trace.json";
+
+// world streamed in the "tiles" mode: the tiles in this directory (see DirectoryTileSource),
+// or else those of the mapped terrain file (see MappedTileSource),
+// or else the heightmap mirrored over STREAM_WORLD_TILES^2 tiles (64k x 64k samples)
+constexpr auto TILE_DIR = "assets/tiles";
+constexpr int STREAM_TILE_SIZE = 256;
+constexpr int STREAM_WORLD_TILES = 256;
+constexpr size_t STREAM_BUDGET = size_t(32) << 20;   // bytes of heights kept in memory
+constexpr int STREAM_RADIUS = 4;                     // tiles around the camera
+
 // --------------------------------------
 
 // window settings
@@ -50,6 +81,35 @@ int screenWidth = 1902;
 int screenHeight = 1080;
 bool keys[1024]{false};
 
+// TAB cycles through the terrain renderers
+constexpr int TERRAIN_MODE_NUM = 6;
+constexpr const char* TERRAIN_MODE_NAMES[TERRAIN_MODE_NUM] = {"mesh", "CDLOD", "clipmap", "patches", "tessellation", "tiles"};
+TerrainRenderMode terrainMode = TerrainRenderMode::MESH;
+
+// water reflection resolution, relative to the window
+constexpr GLfloat REFLECTION_SCALE = 0.5f;
+
+// redraw the reflection every few frames, or sooner when the camera moves or turns this much
+constexpr int REFLECTION_INTERVAL = 4;
+constexpr GLfloat REFLECTION_MAX_MOVE = 0.2f;
+constexpr GLfloat REFLECTION_MAX_TURN = 2.0f;    // degrees
+
+// --bench: draw every terrain renderer for this many frames from the start camera, report each, quit
+constexpr int BENCH_FRAMES = 600;
+
+// C toggles frustum culling of the terrain mesh
+bool frustumCulling = true;
+// G toggles the GL state cache, to compare the submission time with and without it
+bool stateCache = true;
+// I toggles multi-draw indirect submission of the terrain chunks
+bool multiDrawIndirect = true;
+// O toggles culling the terrain chunks on the GPU, against the frustum and the last frame's depth
+bool gpuCulling = false;
+// B raises a hill on the terrain below the camera; only that region of the mesh is regenerated
+bool raiseTerrain = false;
+constexpr int HILL_RADIUS = 24;    // heightmap samples
+constexpr int HILL_HEIGHT = 24;    // height steps at the top
+
 Camera camera(glm::vec3(0.0f, 1.5f, 15.0f), glm::vec3(0.0f, 0.0f, -1.0f), 2.0f);
 
 // -----------------------------------------------------------
@@ -59,11 +119,24 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 void framebufferSizeCallback(GLFWwindow* window, int width, int height);
 void mouseCallback(GLFWwindow* window, double xpos, double ypos);
 void scrollCallback(GLFWwindow* window, double xoffset, double yoffset);
-void moveCamera(GLfloat deltaTime);
+glm::vec3 moveCamera(GLfloat deltaTime);
 void saveScreenshot();
+void raiseHill(TerrainEngine& engine);
 
-int main()
+int main(int argc, char* argv[])
 {
+	auto hasOption = [&](const char* option) {
+		for (int i = 1; i < argc; i++) {
+			if (std::strcmp(argv[i], option) == 0) {
+				return true;
+			}
+		}
+		return false;
+	};
+	const bool benchmark = hasOption("--bench");
+	// generate the terrain vertices with a compute shader from the uploaded heightmap
+	const bool gpuMesh = hasOption("--gpu-mesh");
+
 	// Setup a GLFW window
 
 	// init GLFW, set GL version & pipeline info
@@ -86,8 +159,11 @@ int main()
 	// register callbacks
 	glfwSetFramebufferSizeCallback(window, framebufferSizeCallback);
 	glfwSetKeyCallback(window, keyCallback);
-	glfwSetCursorPosCallback(window, mouseCallback);
-	glfwSetScrollCallback(window, scrollCallback);
+	if (!benchmark) {
+		// the benchmark keeps the start camera
+		glfwSetCursorPosCallback(window, mouseCallback);
+		glfwSetScrollCallback(window, scrollCallback);
+	}
 
 	// ---------------------------------------------------------------
 
@@ -106,64 +182,147 @@ int main()
 
 	// ---------------------------------------------------------------
 
+	// startup: the loads below run as a task graph, file reads and CPU builds on worker threads,
+	// GL uploads on this thread and the shader programs on a hidden window sharing its objects
+	const double startupBegin = glfwGetTime();
+
 	// Load terrain engine resources
 	TerrainEngine engine;
+	engine.SetGpuMeshBuild(gpuMesh);
+	Shader::EnableBinaryCache(SHADER_CACHE_DIR);
 
-	/* load an image as a heightmap, forcing greyscale (so channels should be 1) */
-	if (!engine.LoadHeightmap(HEIGHTMAP_FILE)) {
-		std::cerr << "Error loading heightmap '" << HEIGHTMAP_FILE << "'" << std::endl;
-		glfwTerminate();
-		return -3;
-	}
+	glfwWindowHint(GLFW_VISIBLE, GLFW_FALSE);
+	GLFWwindow* loaderWindow = glfwCreateWindow(1, 1, "", nullptr, window);
+	glfwWindowHint(GLFW_VISIBLE, GLFW_TRUE);
 
-	if (!engine.LoadTerrainTexture(TEXTURE_FILE, DETAIL_FILE)) {
-		std::cerr << "Error loading land texture '" << TEXTURE_FILE << "'" << std::endl;
-		glfwTerminate();
-		return -3;
+	using Lane = LoadGraph::Lane;
+	LoadGraph startup;
+	if (loaderWindow != nullptr) {
+		startup.SetSharedContext([=] { glfwMakeContextCurrent(loaderWindow); }, [] { glfwMakeContextCurrent(nullptr); });
+	} else {
+		std::cerr << "Error creating a shared context, shader programs are built on the main thread" << std::endl;
 	}
 
-	if (!engine.LoadWaterTexture(WATER_FILE)) {
-		std::cerr << "Error loading water texture '" << WATER_FILE << "'" << std::endl;
-		glfwTerminate();
-		return -3;
+	// the images decode on the texture loader's threads while the terrain loads, drawing starts
+	// with placeholders; after the first run they come compressed and mipmapped from the cache
+	startup.Add("request textures", Lane::GL, [&] {
+		engine.EnableTextureCache(TEXTURE_CACHE_DIR);
+		engine.LoadTerrainTextureAsync(TEXTURE_FILE, DETAIL_FILE);
+		engine.LoadWaterTextureAsync(WATER_FILE);
+		engine.LoadSkyboxAsync(SKYBOX_FILES);
+		return true;
+	});
+
+	/* map the binary terrain if converted, else load an image as a heightmap, forcing greyscale (so channels should be 1) */
+	bool terrainMapped = false;
+	const auto readTerrain = startup.Add("read terrain", Lane::WORKER, [&] {
+		terrainMapped = fs::exists(TERRAIN_FILE) && engine.MapTerrainFile(TERRAIN_FILE);
+		if (!terrainMapped && !engine.ReadHeightmap(HEIGHTMAP_FILE)) {
+			std::cerr << "Error loading heightmap '" << HEIGHTMAP_FILE << "'" << std::endl;
+			return false;
+		}
+		return true;
+	});
+	const auto buildTerrain = startup.Add("build terrain", Lane::WORKER, [&] { return engine.PrepareTerrain(); }, { readTerrain });
+	// the upload runs the mesh shader when the vertices are generated on the GPU
+	const auto meshShader = startup.Add("terrain mesh shader", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainMeshShader(TERRAIN_MESH_SHADER);
+	});
+	std::vector<LoadGraph::Task> uploadAfter{ buildTerrain };
+	if (gpuMesh) {
+		uploadAfter.push_back(meshShader);
 	}
-
-	if (!engine.LoadSkybox(SKYBOX_FILES)) {
-		std::cerr << "Error loading skybox images" << std::endl;
-		glfwTerminate();
-		return -3;
+	const auto uploadTerrain = startup.Add("upload terrain", Lane::GL, [&] { return engine.UploadTerrain(); }, uploadAfter);
+
+	std::unique_ptr<TileSource> tileSource;
+	const auto openTiles = startup.Add("open tiles", Lane::WORKER, [&] {
+		if (fs::exists(fs::path(TILE_DIR) / "tiles.txt")) {
+			tileSource = DirectoryTileSource::Open(TILE_DIR);
+		} else if (terrainMapped) {
+			tileSource.reset(new MappedTileSource(engine.MappedTerrainFile()));
+		} else {
+			tileSource.reset(new MirroredTileSource(engine.Heightmap(), engine.HeightmapWidth(), engine.HeightmapHeight(),
+				STREAM_TILE_SIZE, STREAM_WORLD_TILES, STREAM_WORLD_TILES));
+		}
+		return true;
+	}, { readTerrain });
+	startup.Add("stream tiles", Lane::GL, [&] {
+		if (!engine.EnableTileStreaming(std::move(tileSource), STREAM_BUDGET, STREAM_RADIUS)) {
+			std::cerr << "Error setting up terrain tile streaming, \"tiles\" draws the mesh" << std::endl;
+		}
+		return true;
+	}, { openTiles });
+
+	// Install GLSL Shader programs, on the shared context while the terrain builds and uploads
+	startup.Add("skybox shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallSkyboxShaders(SKYBOX_VERT_SHADER, SKYBOX_FRAG_SHADER);
+	});
+	startup.Add("water shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallWaterShaders(WATER_VERT_SHADER, WATER_FRAG_SHADER);
+	});
+	startup.Add("terrain shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainShaders(TERRAIN_VERT_SHADER, TERRAIN_FRAG_SHADER);
+	});
+	startup.Add("LOD terrain shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainLodShaders(TERRAIN_LOD_VERT_SHADER, TERRAIN_FRAG_SHADER);
+	});
+	startup.Add("clipmap terrain shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainClipmapShaders(TERRAIN_CLIPMAP_VERT_SHADER, TERRAIN_FRAG_SHADER);
+	});
+	startup.Add("patch terrain shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainPatchShaders(TERRAIN_PATCH_VERT_SHADER, TERRAIN_FRAG_SHADER);
+	});
+	startup.Add("tessellated terrain shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainTessShaders(TERRAIN_TESS_VERT_SHADER, TERRAIN_TESS_CONTROL_SHADER,
+			TERRAIN_TESS_EVALUATION_SHADER, TERRAIN_FRAG_SHADER);
+	});
+	startup.Add("terrain culling shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallTerrainCullShaders(TERRAIN_CULL_SHADER, DEPTH_PYRAMID_SHADER);
+	});
+	startup.Add("lamp shaders", Lane::SHARED_GL, [&] {
+		return engine.InstallLampShaders(LAMP_VERT_SHADER, LAMP_FRAG_SHADER);
+	});
+
+	const bool loaded = startup.Run();
+	if (loaderWindow != nullptr) {
+		glfwDestroyWindow(loaderWindow);
 	}
-
-	// -----------------------------------------
-
-	// Install GLSL Shader programs
-
-	if (!engine.InstallSkyboxShaders(SKYBOX_VERT_SHADER, SKYBOX_FRAG_SHADER)) {
-		std::cerr << "Error creating Shader Program for skybox" << std::endl;
+	if (!startup.Succeeded(uploadTerrain)) {
 		glfwTerminate();
-		return -4;
+		return -3;
 	}
-
-	if (!engine.InstallWaterShaders(WATER_VERT_SHADER, WATER_FRAG_SHADER)) {
-		std::cerr << "Error creating Shader Program for water" << std::endl;
+	if (!loaded) {
+		std::cerr << "Error creating Shader Programs" << std::endl;
 		glfwTerminate();
 		return -4;
 	}
 
-	if (!engine.InstallTerrainShaders(TERRAIN_VERT_SHADER, TERRAIN_FRAG_SHADER)) {
-		std::cerr << "Error creating Shader Program for terrain" << std::endl;
-		glfwTerminate();
-		return -4;
-	}
-
-	if (!engine.InstallLampShaders(LAMP_VERT_SHADER, LAMP_FRAG_SHADER)) {
-		std::cerr << "Error creating Shader Program for lamp" << std::endl;
-		glfwTerminate();
-		return -4;
-	}
+	const auto& meshStats = engine.MeshStats();
+	std::cout << "Terrain mesh: " << meshStats.vertexCount << " vertices (VBO " << meshStats.vertexBytes / 1024 << " KiB, "
+		<< (meshStats.vertexCount > 0 ? meshStats.vertexBytes / meshStats.vertexCount : 0) << " bytes/vertex), "
+		<< meshStats.indexCount << " indices (IBO " << meshStats.indexBytes / 1024 << " KiB), "
+		<< meshStats.chunkCount << " culling chunks, ACMR " << meshStats.acmr << ", vertex cache hit rate " << meshStats.cacheHitRate * 100 << "%" << std::endl;
+	std::cout << "Terrain load: " << (terrainMapped ? TERRAIN_FILE : HEIGHTMAP_FILE) << (terrainMapped ? " mapped in " : " decoded in ")
+		<< meshStats.loadMilliseconds << " ms" << (meshStats.prebuilt ? " (prebuilt geometry)" : "") << ", vertices " << meshStats.buildMilliseconds
+		<< (meshStats.gpuBuilt ? " ms (compute shader submission)" : " ms") << ", then mesh "
+		<< meshStats.meshMilliseconds << " ms (geometry " << (meshStats.vertexBytes + meshStats.indexBytes) / 1024 << " KiB) vs. patches "
+		<< meshStats.patchMilliseconds << " ms (geometry " << meshStats.patchBytes / 1024 << " KiB, textures "
+		<< (meshStats.heightTextureBytes + meshStats.normalTextureBytes) / 1024 << " KiB)" << std::endl;
+
+	glFinish();
+	const double startupEnd = glfwGetTime();
+	const auto& cacheStats = Shader::BinaryCacheStats();
+	std::cout << "Startup: " << 1000.0 * (startupEnd - startupBegin) << " ms, shaders " << cacheStats.milliseconds << " ms ("
+		<< cacheStats.hits << " from cache, " << cacheStats.misses << " compiled, "
+		<< cacheStats.rejected << " binaries rejected, " << cacheStats.stored << " stored)" << std::endl;
+	startup.PrintTimeline(std::cout);
+	startup.WriteTrace(STARTUP_TRACE_FILE);
 
 	// -----------------------------------------
 
+	engine.SetReflectionScale(REFLECTION_SCALE);
+	engine.SetReflectionUpdate(REFLECTION_INTERVAL, REFLECTION_MAX_MOVE, REFLECTION_MAX_TURN);
+
 	// Define the viewport dimensions
 	glViewport(0, 0, screenWidth, screenHeight);
 
@@ -171,6 +330,20 @@ int main()
 	GLfloat deltaTime = 0.0f;    // Time between current frame and last frame
 	GLfloat lastFrame = 0.0f;    // Time of last frame
 
+	// frame time of the current terrain renderer, reported every few seconds
+	GpuTimer frameTimer;
+	GLfloat modeFrameTime = 0.0f;
+	int modeFrames = 0;
+	int reusedReflections = 0;
+	size_t uniformCalls = 0;
+	size_t uniformBlockUpdates = 0;
+	size_t glCallsIssued = 0;
+	size_t glCallsSkipped = 0;
+	double submitSeconds = 0.0;
+	GLfloat lastReport = 0.0f;
+	bool firstFrame = true;
+	bool texturesReported = false;
+
 	while (glfwWindowShouldClose(window) == 0) {
 		// Calculate deltatime of current frame
 		GLfloat currentFrame = GLfloat(glfwGetTime());
@@ -181,8 +354,108 @@ int main()
 		glfwPollEvents();
 
 		/* your update code here */
-		moveCamera(deltaTime);
-	
+		glm::vec3 movement(0.0f);
+		if (!benchmark) {
+			movement = moveCamera(deltaTime);
+		}
+		// tiles ahead of the camera are prefetched from its velocity
+		engine.SetCameraMotion(deltaTime > 0.0f ? movement / deltaTime : glm::vec3(0.0f), camera.Front());
+
+		modeFrameTime += deltaTime;
+		modeFrames++;
+		bool benchDone = false;
+		if (benchmark && modeFrames >= BENCH_FRAMES) {
+			terrainMode = TerrainRenderMode((int(terrainMode) + 1) % TERRAIN_MODE_NUM);
+			benchDone = terrainMode == TerrainRenderMode::MESH;
+		}
+		if (terrainMode != engine.RenderMode() || (!benchmark && currentFrame - lastReport > 3.0f)) {
+			std::cout << "[" << TERRAIN_MODE_NAMES[int(engine.RenderMode())] << "] "
+				<< 1000.0f * modeFrameTime / modeFrames << " ms/frame CPU, "
+				<< frameTimer.AverageMilliseconds() << " ms/frame GPU" << std::endl;
+			const auto& frameStats = engine.FrameStats();
+			std::cout << "    terrain: " << frameStats.chunksTested << " nodes tested, "
+				<< frameStats.chunksDrawn << " chunks drawn, " << frameStats.drawCalls << " draw calls, "
+				<< frameStats.trianglesSubmitted << " triangles (" << frameStats.reflectionTriangles << " reflected)"
+				<< (engine.FrustumCulling() ? "" : ", culling off") << std::endl;
+			if (frameStats.drawCommands > 0) {
+				std::cout << "    chunks: " << frameStats.drawCommands << " draw commands/frame"
+					<< (engine.MultiDrawIndirect() ? ", one multi-draw indirect per pass" : ", one draw call each") << std::endl;
+			}
+			if (frameStats.gpuCulled) {
+				const auto& cullStats = engine.GpuCullStats();
+				const auto& mainPass = cullStats.passes[0];
+				const auto& mirrored = cullStats.passes[1];
+				std::cout << "    GPU culling: " << mainPass.drawn << " chunks drawn, " << mainPass.frustumCulled << " outside the frustum, "
+					<< mainPass.occluded << " occluded (reflection: " << mirrored.drawn << " drawn, " << mirrored.frustumCulled
+					<< " outside), " << cullStats.frames << " frames read back, " << cullStats.dropped << " dropped" << std::endl;
+			}
+			if (engine.RenderMode() == TerrainRenderMode::TESSELLATION) {
+				std::cout << "    tessellation: " << frameStats.tessPatches << " patches submitted, "
+					<< engine.TessPrimitives() << " primitives generated/frame" << std::endl;
+			}
+			engine.ResetTessPrimitives();
+			if (engine.RenderMode() == TerrainRenderMode::STREAMED && engine.Streamer() != nullptr) {
+				const auto& streamStats = engine.Streamer()->GetStats();
+				std::cout << "    tiles: " << streamStats.hits << " hits, " << streamStats.misses << " misses, "
+					<< streamStats.evictions << " evictions, " << streamStats.residentTiles << " resident ("
+					<< streamStats.residentBytes / (1024 * 1024) << " of " << engine.Streamer()->BudgetBytes() / (1024 * 1024) << " MiB), "
+					<< streamStats.pendingTiles << " pending, " << engine.StreamedTileCount() << " on the GPU ("
+					<< engine.StreamedTileBytes() / (1024 * 1024) << " MiB)" << std::endl;
+				std::cout << "    prefetch: " << streamStats.prefetchLoaded << " tiles early, accuracy "
+					<< streamStats.PrefetchAccuracy() * 100 << "% (" << streamStats.prefetchUsed << " used, "
+					<< streamStats.prefetchWasted << " wasted), " << streamStats.lateTiles << " late, "
+					<< streamStats.missingTiles << " missing now, I/O queue " << streamStats.queueDepth
+					<< " (max " << streamStats.maxQueueDepth << ")" << std::endl;
+			}
+			std::cout << "    water: reflection reused in " << reusedReflections << " of " << modeFrames << " frames" << std::endl;
+			std::cout << "    sky: " << frameStats.skyboxDrawCalls << " draw calls, "
+				<< engine.SkyboxSamples() << " pixels shaded/frame" << std::endl;
+			std::cout << "    uniforms: " << GLfloat(uniformCalls) / modeFrames << " calls/frame, "
+				<< GLfloat(uniformBlockUpdates) / modeFrames << " block updates/frame" << std::endl;
+			std::cout << "    GL state: " << GLfloat(glCallsIssued) / modeFrames << " issued, "
+				<< GLfloat(glCallsSkipped) / modeFrames << " skipped calls/frame, submission "
+				<< 1000.0 * submitSeconds / modeFrames << " ms/frame CPU (cache " << (engine.StateCache() ? "on" : "off") << ")" << std::endl;
+			engine.ResetSkyboxSamples();
+			modeFrameTime = 0.0f;
+			modeFrames = 0;
+			reusedReflections = 0;
+			uniformCalls = 0;
+			uniformBlockUpdates = 0;
+			glCallsIssued = 0;
+			glCallsSkipped = 0;
+			submitSeconds = 0.0;
+			lastReport = currentFrame;
+			frameTimer.Reset();
+		}
+		if (benchDone) {
+			break;
+		}
+
+		if (terrainMode != engine.RenderMode()) {
+			engine.SetRenderMode(terrainMode);
+			std::cout << "Terrain renderer: " << TERRAIN_MODE_NAMES[int(terrainMode)] << std::endl;
+		}
+		if (frustumCulling != engine.FrustumCulling()) {
+			engine.SetFrustumCulling(frustumCulling);
+			std::cout << "Terrain frustum culling: " << (frustumCulling ? "on" : "off") << std::endl;
+		}
+		if (multiDrawIndirect != engine.MultiDrawIndirect()) {
+			engine.SetMultiDrawIndirect(multiDrawIndirect);
+			std::cout << "Terrain multi-draw indirect: " << (multiDrawIndirect ? "on" : "off") << std::endl;
+		}
+		if (gpuCulling != engine.GpuCulling()) {
+			engine.SetGpuCulling(gpuCulling);
+			std::cout << "Terrain GPU culling: " << (gpuCulling ? "on" : "off") << std::endl;
+		}
+		if (raiseTerrain) {
+			raiseTerrain = false;
+			raiseHill(engine);
+		}
+		if (stateCache != engine.StateCache()) {
+			engine.SetStateCache(stateCache);
+			std::cout << "GL state cache: " << (stateCache ? "on" : "off") << std::endl;
+		}
+
 		// draw background
 		GLfloat red = 0.2f;
 		GLfloat green = 0.3f;
@@ -196,14 +469,49 @@ int main()
 		// Projection
 		glm::mat4 projection = glm::perspective(glm::radians(camera.Zoom()), (GLfloat)screenWidth / (GLfloat)screenHeight, 0.1f, 10000.0f);
 
-		// draw sky & water
-		engine.DrawSkybox(view, projection);
+		// draw terrain & water, then the sky in the pixels they leave uncovered
+		frameTimer.Begin();
+		const double submitBegin = glfwGetTime();
+		engine.BeginFrame(view, projection, camera.Position());
 		engine.DrawTerrain(view, projection, camera.Position());
 		engine.DrawWater(view, projection, deltaTime, camera.Position());
 		//engine.DrawLamp(view, projection);
+		engine.DrawSkybox();
+		engine.EndFrame();
+		submitSeconds += glfwGetTime() - submitBegin;
+		frameTimer.End();
+		reusedReflections += engine.FrameStats().reflectionReused ? 1 : 0;
+		uniformCalls += Shader::UniformCalls();
+		uniformBlockUpdates += engine.FrameStats().uniformBlockUpdates;
+		glCallsIssued += engine.GlCalls().issued;
+		glCallsSkipped += engine.GlCalls().skipped;
 
 		// swap buffer
 		glfwSwapBuffers(window);
+
+		if (firstFrame) {
+			firstFrame = false;
+			std::cout << "First frame: " << 1000.0 * (glfwGetTime() - startupBegin) << " ms after startup, "
+				<< engine.TextureStats().ready << " of " << engine.TextureStats().requested << " textures ready" << std::endl;
+		}
+		if (!texturesReported && !engine.TexturesPending()) {
+			texturesReported = true;
+			const auto& textureStats = engine.TextureStats();
+			std::cout << "Textures: " << textureStats.ready << " ready, " << textureStats.failed << " failed, the last "
+				<< textureStats.readyMilliseconds << " ms after the loader started (decode " << textureStats.decodeMilliseconds
+				<< " ms on " << engine.TextureThreads() << " threads, upload " << textureStats.uploadMilliseconds
+				<< " ms on the render thread), cache " << textureStats.cacheHits << " hits, " << textureStats.cacheMisses << " misses, "
+				<< textureStats.cacheRejected << " rejected" << std::endl;
+			for (const auto& timing : engine.TextureTimings()) {
+				std::cout << "    " << timing.file << ": " << (timing.cached ? "cached " : "cold ")
+					<< timing.workerMilliseconds + timing.uploadMilliseconds << " ms (worker " << timing.workerMilliseconds
+					<< " ms, upload " << timing.uploadMilliseconds << " ms, ready after " << timing.readyMilliseconds << " ms";
+				if (timing.cached) {
+					std::cout << ", cold load was " << timing.coldMilliseconds << " ms";
+				}
+				std::cout << "), " << timing.bytes / 1024 << " KiB" << std::endl;
+			}
+		}
 	}
 
 	glfwTerminate();
@@ -222,6 +530,24 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 	else if (key == GLFW_KEY_PRINT_SCREEN && action == GLFW_PRESS) {
 		saveScreenshot();
 	}
+	else if (key == GLFW_KEY_TAB && action == GLFW_PRESS) {
+		terrainMode = TerrainRenderMode((int(terrainMode) + 1) % TERRAIN_MODE_NUM);
+	}
+	else if (key == GLFW_KEY_C && action == GLFW_PRESS) {
+		frustumCulling = !frustumCulling;
+	}
+	else if (key == GLFW_KEY_G && action == GLFW_PRESS) {
+		stateCache = !stateCache;
+	}
+	else if (key == GLFW_KEY_I && action == GLFW_PRESS) {
+		multiDrawIndirect = !multiDrawIndirect;
+	}
+	else if (key == GLFW_KEY_O && action == GLFW_PRESS) {
+		gpuCulling = !gpuCulling;
+	}
+	else if (key == GLFW_KEY_B && action == GLFW_PRESS) {
+		raiseTerrain = true;
+	}
 	else if (key >= 0 && key < 1024) {
 		if (action == GLFW_PRESS) {
 			keys[key] = true;
@@ -231,8 +557,10 @@ void keyCallback(GLFWwindow* window, int key, int scancode, int action, int mode
 	}
 }
 
-void moveCamera(GLfloat deltaTime)
+// returns how far the camera moved
+glm::vec3 moveCamera(GLfloat deltaTime)
 {
+	const glm::vec3 start = camera.Position();
 	// Camera controls
 	if (keys[GLFW_KEY_W]) {
 		camera.ProcessKeyboard(Camera::Movement::FORWARD, deltaTime);
@@ -246,6 +574,7 @@ void moveCamera(GLfloat deltaTime)
 	if (keys[GLFW_KEY_D]) {
 		camera.ProcessKeyboard(Camera::Movement::RIGHT, deltaTime);
 	}
+	return camera.Position() - start;
 }
 
 void mouseCallback(GLFWwindow* window, double xpos, double ypos)
@@ -304,3 +633,36 @@ void saveScreenshot()
 		std::cout << "Screenshot saved to '" << filenameStr << "'" << std::endl;
 	}
 }
+
+// a smooth bump centered on the camera's position over the heightmap
+void raiseHill(TerrainEngine& engine)
+{
+	const unsigned char* heights = engine.Heightmap();
+	const int width = engine.HeightmapWidth();
+	const int height = engine.HeightmapHeight();
+	if (heights == nullptr) {
+		return;
+	}
+	const glm::vec4 local = glm::inverse(TerrainEngine::landModel) * glm::vec4(camera.Position(), 1.0f);
+	const int x0 = int(local.x * width) - HILL_RADIUS;
+	const int z0 = int(local.z * height) - HILL_RADIUS;
+	const int size = 2 * HILL_RADIUS + 1;
+
+	// samples outside the map are ignored by the engine
+	std::vector<unsigned char> samples(size_t(size) * size);
+	for (int z = 0; z < size; z++) {
+		for (int x = 0; x < size; x++) {
+			const int sx = std::min(std::max(x0 + x, 0), width - 1);
+			const int sz = std::min(std::max(z0 + z, 0), height - 1);
+			const float d = glm::length(glm::vec2(x - HILL_RADIUS, z - HILL_RADIUS)) / HILL_RADIUS;
+			const float bump = d < 1.0f ? 0.5f * HILL_HEIGHT * (1.0f + std::cos(glm::radians(180.0f) * d)) : 0.0f;
+			samples[size_t(z) * size + x] = (unsigned char)std::min(int(heights[size_t(sz) * width + sx] + bump + 0.5f), 255);
+		}
+	}
+
+	const double start = glfwGetTime();
+	if (engine.UpdateHeightmap(x0, z0, size, size, samples.data())) {
+		std::cout << "Terrain edit: " << size << " x " << size << " samples raised, mesh region regenerated on the GPU ("
+			<< 1000.0 * (glfwGetTime() - start) << " ms CPU)" << std::endl;
+	}
+}
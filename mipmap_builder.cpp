@@ -0,0 +1,536 @@
+#include "mipmap_builder.h"
+
+#include <algorithm>
+#include <cmath>
+#include <functional>
+#include <limits>
+#include <thread>
+
+#if defined(__AVX2__)
+#define CG_MIP_AVX2 1
+#include <immintrin.h>
+#endif
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define CG_MIP_SSE2 1
+#include <emmintrin.h>
+#endif
+
+namespace cg
+{
+
+namespace
+{
+
+// linear values are encoded through a table indexed by sqrt(value), which
+// spreads the dark end where sRGB codes are closest: < 0.1 code per step
+constexpr int kEncodeSteps = 4096;
+
+// the smallest level worth splitting over threads
+constexpr size_t kMinBandBytes = 64 * 1024;
+
+struct Tables
+{
+	float decode[2][256];                    // [alpha] 8-bit value to linear
+	unsigned char encode[2][kEncodeSteps];   // [alpha] sqrt(linear) step to 8-bit value
+	float kaiser[8];                         // 2:1 taps from source offset -3 to +4
+
+	Tables()
+	{
+		for (int i = 0; i < 256; i++) {
+			const float c = float(i) / 255.0f;
+			decode[0][i] = c <= 0.04045f ? c / 12.92f : std::pow((c + 0.055f) / 1.055f, 2.4f);
+			decode[1][i] = c;
+		}
+		for (int i = 0; i < kEncodeSteps; i++) {
+			const float s = float(i) / float(kEncodeSteps - 1);
+			const float linear = s * s;
+			const float c = linear <= 0.0031308f ? linear * 12.92f : 1.055f * std::pow(linear, 1.0f / 2.4f) - 0.055f;
+			encode[0][i] = (unsigned char)std::lround(std::min(std::max(c, 0.0f), 1.0f) * 255.0f);
+			encode[1][i] = (unsigned char)std::lround(linear * 255.0f);
+		}
+
+		// sinc windowed by a Kaiser window (alpha 4) two destination pixels wide,
+		// sampled at the source pixel centers around a destination pixel
+		auto besselI0 = [](double x) {
+			double sum = 1.0, term = 1.0;
+			for (int k = 1; k < 32; k++) {
+				term *= (x / (2 * k)) * (x / (2 * k));
+				sum += term;
+			}
+			return sum;
+		};
+		const double alpha = 4.0, width = 2.0, pi = 3.14159265358979323846;
+		double total = 0.0;
+		double weights[8];
+		for (int t = 0; t < 8; t++) {
+			const double d = (t - 3 - 0.5) / 2.0;
+			const double sinc = std::sin(pi * d) / (pi * d);
+			const double r = d / width;
+			weights[t] = sinc * besselI0(alpha * std::sqrt(1.0 - r * r)) / besselI0(alpha);
+			total += weights[t];
+		}
+		for (int t = 0; t < 8; t++) {
+			kaiser[t] = float(weights[t] / total);
+		}
+	}
+};
+
+const Tables& GetTables()
+{
+	static const Tables tables;
+	return tables;
+}
+
+inline int Address(int i, int size, bool wrap)
+{
+	if (wrap) {
+		i %= size;
+		return i < 0 ? i + size : i;
+	}
+	return std::min(std::max(i, 0), size - 1);
+}
+
+// sum of weights[t] * rows[t][e] over the taps for e in [start, n)
+void WeightRowsScalar(const float* const* rows, const float* weights, int taps, float* out, int n, int start)
+{
+	for (int e = start; e < n; e++) {
+		float sum = 0.0f;
+		for (int t = 0; t < taps; t++) {
+			sum += weights[t] * rows[t][e];
+		}
+		out[e] = sum;
+	}
+}
+
+// sqrt(clamped value) as encode table steps
+int EncodeStepsScalar(const float* values, int* steps, int n, int start)
+{
+	for (int e = start; e < n; e++) {
+		const float v = std::min(std::max(values[e], 0.0f), 1.0f);
+		steps[e] = int(std::sqrt(v) * float(kEncodeSteps - 1) + 0.5f);
+	}
+	return n;
+}
+
+// unsharp mask of one element from its 3 x 3 neighbourhood, `amount` in 1/512
+inline unsigned char SharpenScalar(int ul, int u, int ur, int l, int m, int r, int dl, int d, int dr, int amount)
+{
+	const int sum = 4 * m + 2 * (l + r + u + d) + (ul + ur + dl + dr);
+	// (16 m - sum) / 16 * amount, as the SIMD path's high half multiply rounds it
+	const int delta = ((16 * m - sum) * 8 * amount) >> 16;
+	return (unsigned char)std::min(std::max(m + delta, 0), 255);
+}
+
+#ifdef CG_MIP_SSE2
+
+int WeightRowsSse2(const float* const* rows, const float* weights, int taps, float* out, int n, int start)
+{
+	int e = start;
+	for (; e + 4 <= n; e += 4) {
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(rows[0] + e));
+		for (int t = 1; t < taps; t++) {
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(rows[t] + e)));
+		}
+		_mm_storeu_ps(out + e, sum);
+	}
+	return e;
+}
+
+/* Horizontal taps of pixels x in [x0, x1), all taps inside the row: one vector
+ * per pixel of 3 or 4 channels, so a 3 channel row must have a float to spare
+ */
+void WeightPixelsSse2(const float* column, const float* weights, int taps, int firstTap, int channels, float* out, int x0, int x1)
+{
+	for (int x = x0; x < x1; x++) {
+		const float* in = column + size_t(2 * x + firstTap) * channels;
+		__m128 sum = _mm_mul_ps(_mm_set1_ps(weights[0]), _mm_loadu_ps(in));
+		for (int t = 1; t < taps; t++) {
+			sum = _mm_add_ps(sum, _mm_mul_ps(_mm_set1_ps(weights[t]), _mm_loadu_ps(in + t * channels)));
+		}
+		_mm_storeu_ps(out + size_t(x) * channels, sum);
+	}
+}
+
+int EncodeStepsSse2(const float* values, int* steps, int n)
+{
+	const __m128 zero = _mm_setzero_ps();
+	const __m128 one = _mm_set1_ps(1.0f);
+	const __m128 scale = _mm_set1_ps(float(kEncodeSteps - 1));
+	const __m128 half = _mm_set1_ps(0.5f);
+	int e = 0;
+	for (; e + 4 <= n; e += 4) {
+		const __m128 v = _mm_min_ps(_mm_max_ps(_mm_loadu_ps(values + e), zero), one);
+		const __m128 s = _mm_add_ps(_mm_mul_ps(_mm_sqrt_ps(v), scale), half);
+		_mm_storeu_si128(reinterpret_cast<__m128i*>(steps + e), _mm_cvttps_epi32(s));
+	}
+	return e;
+}
+
+inline __m128i Load8(const unsigned char* p)
+{
+	return _mm_unpacklo_epi8(_mm_loadl_epi64(reinterpret_cast<const __m128i*>(p)), _mm_setzero_si128());
+}
+
+/* Interior elements only: requires `channels` elements on both sides of [start, end) */
+int SharpenSse2(const unsigned char* up, const unsigned char* mid, const unsigned char* down,
+	int channels, int start, int end, int amount, unsigned char* out)
+{
+	const __m128i factor = _mm_set1_epi16(short(amount));
+	int e = start;
+	for (; e + 8 <= end; e += 8) {
+		const __m128i m = Load8(mid + e);
+		const __m128i edges = _mm_add_epi16(_mm_add_epi16(Load8(mid + e - channels), Load8(mid + e + channels)),
+			_mm_add_epi16(Load8(up + e), Load8(down + e)));
+		const __m128i corners = _mm_add_epi16(_mm_add_epi16(Load8(up + e - channels), Load8(up + e + channels)),
+			_mm_add_epi16(Load8(down + e - channels), Load8(down + e + channels)));
+		const __m128i sum = _mm_add_epi16(_mm_add_epi16(_mm_slli_epi16(m, 2), _mm_slli_epi16(edges, 1)), corners);
+		const __m128i delta = _mm_mulhi_epi16(_mm_slli_epi16(_mm_sub_epi16(_mm_slli_epi16(m, 4), sum), 3), factor);
+		_mm_storel_epi64(reinterpret_cast<__m128i*>(out + e), _mm_packus_epi16(_mm_add_epi16(m, delta), _mm_setzero_si128()));
+	}
+	return e;
+}
+
+#endif /* CG_MIP_SSE2 */
+
+#ifdef CG_MIP_AVX2
+
+int WeightRowsAvx2(const float* const* rows, const float* weights, int taps, float* out, int n)
+{
+	int e = 0;
+	for (; e + 8 <= n; e += 8) {
+		__m256 sum = _mm256_mul_ps(_mm256_set1_ps(weights[0]), _mm256_loadu_ps(rows[0] + e));
+		for (int t = 1; t < taps; t++) {
+			sum = _mm256_add_ps(sum, _mm256_mul_ps(_mm256_set1_ps(weights[t]), _mm256_loadu_ps(rows[t] + e)));
+		}
+		_mm256_storeu_ps(out + e, sum);
+	}
+	return e;
+}
+
+int EncodeStepsAvx2(const float* values, int* steps, int n)
+{
+	const __m256 zero = _mm256_setzero_ps();
+	const __m256 one = _mm256_set1_ps(1.0f);
+	const __m256 scale = _mm256_set1_ps(float(kEncodeSteps - 1));
+	const __m256 half = _mm256_set1_ps(0.5f);
+	int e = 0;
+	for (; e + 8 <= n; e += 8) {
+		const __m256 v = _mm256_min_ps(_mm256_max_ps(_mm256_loadu_ps(values + e), zero), one);
+		const __m256 s = _mm256_add_ps(_mm256_mul_ps(_mm256_sqrt_ps(v), scale), half);
+		_mm256_storeu_si256(reinterpret_cast<__m256i*>(steps + e), _mm256_cvttps_epi32(s));
+	}
+	return e;
+}
+
+#endif /* CG_MIP_AVX2 */
+
+} /* anonymous namespace */
+
+// one level to build from the one above
+struct MipmapBuilder::Pass
+{
+	const unsigned char* src;
+	int srcWidth;
+	int srcHeight;
+	unsigned char* dst;
+	int dstWidth;
+	int dstHeight;
+	const unsigned char* plain;   // SharpenRows(): the level before sharpening
+	int channels;
+	int alpha;                    // channel filtered without gamma, -1 if none
+	bool wrap;
+	const float* taps;
+	int tapCount;
+	int firstTap;                 // source offset of taps[0] from 2 x
+};
+
+MipmapBuilder::MipmapBuilder(unsigned threads, bool useSimd) :
+	threads_(1), useSimd_(useSimd), filter_(Filter::KAISER), sharpen_(0.0f)
+{
+	SetThreads(threads);
+}
+
+void MipmapBuilder::SetThreads(unsigned threads)
+{
+	if (threads == 0) {
+		threads = std::thread::hardware_concurrency();
+	}
+	threads_ = std::max(threads, 1u);
+}
+
+MipmapBuilder::SimdPath MipmapBuilder::CompiledPath()
+{
+#if defined(CG_MIP_AVX2)
+	return SimdPath::AVX2;
+#elif defined(CG_MIP_SSE2)
+	return SimdPath::SSE2;
+#else
+	return SimdPath::SCALAR;
+#endif
+}
+
+const char* MipmapBuilder::PathName(SimdPath path)
+{
+	switch (path) {
+	case SimdPath::AVX2:
+		return "AVX2";
+	case SimdPath::SSE2:
+		return "SSE2";
+	default:
+		return "scalar";
+	}
+}
+
+const char* MipmapBuilder::FilterName(Filter filter)
+{
+	return filter == Filter::KAISER ? "Kaiser" : "box";
+}
+
+int MipmapBuilder::LevelCount(int width, int height)
+{
+	int count = 1;
+	for (int size = std::max(width, height); size > 1; size /= 2) {
+		count++;
+	}
+	return count;
+}
+
+size_t MipmapBuilder::LayOut(int width, int height, int levelCount, int channels, std::vector<MipLevel>& levels)
+{
+	levels.clear();
+	size_t offset = 0;
+	for (int l = 0; l < levelCount; l++) {
+		const int w = std::max(width >> l, 1);
+		const int h = std::max(height >> l, 1);
+		const size_t bytes = size_t(w) * size_t(h) * channels;
+		levels.push_back({ w, h, offset, bytes });
+		offset += bytes;
+	}
+	return offset;
+}
+
+void MipmapBuilder::Build(unsigned char* chain, const std::vector<MipLevel>& levels, int channels, bool wrap) const
+{
+	static const float box[2] = { 0.5f, 0.5f };
+	const Tables& tables = GetTables();
+
+	Pass pass;
+	pass.channels = channels;
+	pass.alpha = (channels == 2 || channels == 4) ? channels - 1 : -1;
+	pass.wrap = wrap;
+	pass.taps = filter_ == Filter::KAISER ? tables.kaiser : box;
+	pass.tapCount = filter_ == Filter::KAISER ? 8 : 2;
+	pass.firstTap = filter_ == Filter::KAISER ? -3 : 0;
+	pass.plain = nullptr;
+
+	// sharpening: each level is built unsharpened aside, the next one from there
+	std::vector<unsigned char> plain[2];
+	const unsigned char* src = chain + levels[0].offset;
+	for (size_t l = 1; l < levels.size(); l++) {
+		pass.src = src;
+		pass.srcWidth = levels[l - 1].width;
+		pass.srcHeight = levels[l - 1].height;
+		pass.dstWidth = levels[l].width;
+		pass.dstHeight = levels[l].height;
+		if (sharpen_ > 0.0f) {
+			plain[l & 1].resize(levels[l].bytes);
+			pass.dst = plain[l & 1].data();
+			BuildLevel(pass);
+			pass.plain = pass.dst;
+			pass.dst = chain + levels[l].offset;
+			RunBands(pass, &MipmapBuilder::SharpenRows);
+			src = pass.plain;
+		} else {
+			pass.dst = chain + levels[l].offset;
+			BuildLevel(pass);
+			src = pass.dst;
+		}
+	}
+}
+
+void MipmapBuilder::BuildLevel(const Pass& pass) const
+{
+	RunBands(pass, &MipmapBuilder::BuildRows);
+}
+
+void MipmapBuilder::RunBands(const Pass& pass, void (MipmapBuilder::*rows)(const Pass&, int, int) const) const
+{
+	const size_t levelBytes = size_t(pass.dstWidth) * pass.dstHeight * pass.channels;
+	const int bands = int(std::min<size_t>({ size_t(threads_), size_t(pass.dstHeight), std::max<size_t>(levelBytes / kMinBandBytes, 1) }));
+	if (bands <= 1) {
+		(this->*rows)(pass, 0, pass.dstHeight);
+		return;
+	}
+
+	std::vector<std::thread> workers;
+	workers.reserve(bands - 1);
+	const int rowsPerBand = (pass.dstHeight + bands - 1) / bands;
+	for (int b = 1; b < bands; b++) {
+		const int row0 = b * rowsPerBand;
+		const int row1 = std::min(row0 + rowsPerBand, pass.dstHeight);
+		if (row0 >= row1) {
+			break;
+		}
+		workers.emplace_back(rows, this, std::cref(pass), row0, row1);
+	}
+	(this->*rows)(pass, 0, std::min(rowsPerBand, pass.dstHeight));
+
+	for (auto& worker : workers) {
+		worker.join();
+	}
+}
+
+void MipmapBuilder::BuildRows(const Pass& pass, int row0, int row1) const
+{
+	const Tables& tables = GetTables();
+	const int c = pass.channels;
+	const int srcCount = pass.srcWidth * c;
+	const int dstCount = pass.dstWidth * c;
+	const SimdPath path = Path();
+
+	const float* decode[4];
+	const unsigned char* encode[4];
+	for (int k = 0; k < c; k++) {
+		decode[k] = tables.decode[k == pass.alpha];
+		encode[k] = tables.encode[k == pass.alpha];
+	}
+
+	// linear source rows, each converted once: the tap row u = 2 y + firstTap + t,
+	// before wrapping, stays in the slot u % tapCount while the window of taps
+	// slides down over it. The window's tapCount consecutive u take distinct slots;
+	// keyed on the wrapped row, two taps could share one near the edge.
+	std::vector<float> ring(size_t(pass.tapCount) * srcCount);
+	std::vector<int> ringRow(pass.tapCount, std::numeric_limits<int>::min());
+	std::vector<const float*> rows(pass.tapCount);
+	std::vector<float> column(srcCount + 1);
+	std::vector<float> row(dstCount + 1);
+	std::vector<int> steps(dstCount);
+
+	for (int y = row0; y < row1; y++) {
+		for (int t = 0; t < pass.tapCount; t++) {
+			const int u = 2 * y + pass.firstTap + t;
+			const int slot = (u % pass.tapCount + pass.tapCount) % pass.tapCount;
+			float* linear = ring.data() + size_t(slot) * srcCount;
+			if (ringRow[slot] != u) {
+				ringRow[slot] = u;
+				const int sy = Address(u, pass.srcHeight, pass.wrap);
+				const unsigned char* in = pass.src + size_t(sy) * srcCount;
+				for (int e = 0; e < srcCount; e += c) {
+					for (int k = 0; k < c; k++) {
+						linear[e + k] = decode[k][in[e + k]];
+					}
+				}
+			}
+			rows[t] = linear;
+		}
+
+		// vertical: the taps rows weighted into one
+		int done = 0;
+#ifdef CG_MIP_AVX2
+		if (path == SimdPath::AVX2) {
+			done = WeightRowsAvx2(rows.data(), pass.taps, pass.tapCount, column.data(), srcCount);
+		}
+#endif
+#ifdef CG_MIP_SSE2
+		if (path != SimdPath::SCALAR) {
+			done = WeightRowsSse2(rows.data(), pass.taps, pass.tapCount, column.data(), srcCount, done);
+		}
+#endif
+		WeightRowsScalar(rows.data(), pass.taps, pass.tapCount, column.data(), srcCount, done);
+
+		// horizontal: the taps columns around 2 x, addressed only near the edges
+		int x0 = 0;
+		int x1 = 0;
+#ifdef CG_MIP_SSE2
+		if (path != SimdPath::SCALAR && c >= 3) {
+			x0 = std::min((-pass.firstTap + 1) / 2, pass.dstWidth);
+			const int last = pass.srcWidth - pass.tapCount - pass.firstTap;
+			x1 = last < 0 ? x0 : std::max(std::min(last / 2 + 1, pass.dstWidth), x0);
+			WeightPixelsSse2(column.data(), pass.taps, pass.tapCount, pass.firstTap, c, row.data(), x0, x1);
+		}
+#endif
+		for (int x = 0; x < pass.dstWidth; x++) {
+			if (x == x0) {
+				x = x1;
+				if (x >= pass.dstWidth) {
+					break;
+				}
+			}
+			const int sx0 = 2 * x + pass.firstTap;
+			const bool inside = sx0 >= 0 && sx0 + pass.tapCount <= pass.srcWidth;
+			for (int k = 0; k < c; k++) {
+				float sum = 0.0f;
+				for (int t = 0; t < pass.tapCount; t++) {
+					const int sx = inside ? sx0 + t : Address(sx0 + t, pass.srcWidth, pass.wrap);
+					sum += pass.taps[t] * column[size_t(sx) * c + k];
+				}
+				row[size_t(x) * c + k] = sum;
+			}
+		}
+
+		// back to 8 bits
+		done = 0;
+#ifdef CG_MIP_AVX2
+		if (path == SimdPath::AVX2) {
+			done = EncodeStepsAvx2(row.data(), steps.data(), dstCount);
+		}
+#endif
+#ifdef CG_MIP_SSE2
+		if (path != SimdPath::SCALAR) {
+			done += EncodeStepsSse2(row.data() + done, steps.data() + done, dstCount - done);
+		}
+#endif
+		EncodeStepsScalar(row.data(), steps.data(), dstCount, done);
+		unsigned char* out = pass.dst + size_t(y) * dstCount;
+		for (int e = 0; e < dstCount; e += c) {
+			for (int k = 0; k < c; k++) {
+				out[e + k] = encode[k][steps[e + k]];
+			}
+		}
+	}
+}
+
+void MipmapBuilder::SharpenRows(const Pass& pass, int row0, int row1) const
+{
+	const int c = pass.channels;
+	const int w = pass.dstWidth;
+	const int count = w * c;
+	const int amount = int(std::lround(std::min(std::max(sharpen_, 0.0f), 1.0f) * 512.0f));
+
+	for (int y = row0; y < row1; y++) {
+		const unsigned char* up = pass.plain + size_t(Address(y - 1, pass.dstHeight, pass.wrap)) * count;
+		const unsigned char* mid = pass.plain + size_t(y) * count;
+		const unsigned char* down = pass.plain + size_t(Address(y + 1, pass.dstHeight, pass.wrap)) * count;
+		unsigned char* out = pass.dst + size_t(y) * count;
+
+		// the first and last pixel need their neighbours addressed, the others have them in the row
+		int interior = c;
+#ifdef CG_MIP_SSE2
+		if (Path() != SimdPath::SCALAR && w > 2) {
+			interior = SharpenSse2(up, mid, down, c, c, count - c, amount, out);
+		}
+#endif
+		for (int x = 0; x < w; x++) {
+			if (x > 0 && (x + 1) * c <= interior) {
+				continue;
+			}
+			const int l = Address(x - 1, w, pass.wrap) * c;
+			const int r = Address(x + 1, w, pass.wrap) * c;
+			for (int k = 0; k < c; k++) {
+				const int e = x * c + k;
+				out[e] = SharpenScalar(up[l + k], up[e], up[r + k], mid[l + k], mid[e], mid[r + k],
+					down[l + k], down[e], down[r + k], amount);
+			}
+		}
+
+		// alpha is kept as filtered
+		if (pass.alpha >= 0) {
+			for (int e = pass.alpha; e < count; e += c) {
+				out[e] = mid[e];
+			}
+		}
+	}
+}
+
+} /* namespace cg */
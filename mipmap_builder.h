@@ -0,0 +1,92 @@
+#ifndef CG_MIPMAP_BUILDER_H_
+#define CG_MIPMAP_BUILDER_H_
+
+#include <cstddef>
+#include <vector>
+
+namespace cg
+{
+
+/* Size and place of one mipmap level in a buffer holding a whole chain */
+struct MipLevel
+{
+	int width;
+	int height;
+	size_t offset;
+	size_t bytes;
+};
+
+/* Builds the mipmaps of an 8-bit image, level by level from the one above.
+ *
+ * Color channels are sRGB encoded, so they are filtered in linear light and
+ * encoded again; an alpha channel (the last of 2 or 4) is filtered as is.
+ * Each level is 2:1 in both directions (sizes rounded down, as GL does) with
+ * a box filter or a wider, sharper Kaiser windowed sinc, clamped or wrapped at
+ * the edges. Optionally every generated level is sharpened by an unsharp mask,
+ * which keeps a detail texture from washing out with distance; the next level
+ * is still built from the unsharpened one.
+ *
+ * The rows of a level are split into bands processed by worker threads; the
+ * filter sums use the widest SIMD path compiled in (AVX2, SSE2, or scalar).
+ */
+class MipmapBuilder
+{
+public:
+	enum class Filter
+	{
+		BOX,
+		KAISER
+	};
+
+	enum class SimdPath
+	{
+		SCALAR,
+		SSE2,
+		AVX2
+	};
+
+	// threads == 0 means one per hardware thread
+	explicit MipmapBuilder(unsigned threads = 0, bool useSimd = true);
+
+	unsigned Threads() const { return threads_; }
+	bool UseSimd() const { return useSimd_; }
+	SimdPath Path() const { return useSimd_ ? CompiledPath() : SimdPath::SCALAR; }
+	Filter GetFilter() const { return filter_; }
+	float Sharpen() const { return sharpen_; }
+
+	void SetThreads(unsigned threads);
+	void SetUseSimd(bool useSimd) { useSimd_ = useSimd; }
+	void SetFilter(Filter filter) { filter_ = filter; }
+	/* Unsharp mask strength for the generated levels, 0 (off) .. 1 */
+	void SetSharpen(float amount) { sharpen_ = amount; }
+
+	/* Number of levels down to 1 x 1 */
+	static int LevelCount(int width, int height);
+	/* Levels of a width x height image in one buffer; returns the bytes of the whole chain */
+	static size_t LayOut(int width, int height, int levelCount, int channels, std::vector<MipLevel>& levels);
+
+	/* Fill levels 1 .. n of `chain` from level 0; wrap: the image tiles (repeat addressing) */
+	void Build(unsigned char* chain, const std::vector<MipLevel>& levels, int channels, bool wrap) const;
+
+	static SimdPath CompiledPath();
+	static const char* PathName(SimdPath path);
+	static const char* FilterName(Filter filter);
+
+private:
+	unsigned threads_;
+	bool useSimd_;
+	Filter filter_;
+	float sharpen_;
+
+	struct Pass;
+
+	void BuildLevel(const Pass& pass) const;
+	void BuildRows(const Pass& pass, int row0, int row1) const;
+	void SharpenRows(const Pass& pass, int row0, int row1) const;
+	// splits the rows of the destination level into bands, one per thread
+	void RunBands(const Pass& pass, void (MipmapBuilder::*rows)(const Pass&, int, int) const) const;
+};
+
+} /* namespace cg */
+
+#endif /* CG_MIPMAP_BUILDER_H_ */
@@ -1,60 +1,247 @@
 #ifndef CG_SHADER_H_
 #define CG_SHADER_H_
 
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <iomanip>
 #include <iostream>
 #include <fstream>
 #include <sstream>
 #include <memory>
+#include <string>
+#include <unordered_map>
+#include <vector>
 
 #include <glad/glad.h>
+#include <glm/glm.hpp>
+#include <glm/gtc/type_ptr.hpp>
+
+#include "file_util.hpp"
 
 namespace cg
 {
 
+/* Statistics of the program binary cache, all programs */
+struct ShaderCacheStats
+{
+	unsigned hits = 0;          // programs loaded from a cached binary
+	unsigned misses = 0;        // programs compiled from source (no binary, or caching disabled)
+	unsigned rejected = 0;      // cached binaries the driver refused, compiled from source instead
+	unsigned stored = 0;        // binaries written to the cache
+	double milliseconds = 0.0;  // total time spent in Create()
+};
+
 class Shader
 {
 	const GLuint shaderProgram;
 
+	// active uniforms outside blocks, reflected once after linking
+	std::unordered_map<std::string, GLint> uniforms;
+
+	// glUniform* calls issued through Set(), all programs; the shared context's
+	// loader thread sets uniforms too, so the count is atomic
+	inline static std::atomic<size_t> uniformCalls{0};
+
+	static void CountUniformCall() { uniformCalls.fetch_add(1, std::memory_order_relaxed); }
+
+	// program binary cache, off while empty
+	inline static std::string cacheDir;
+	inline static ShaderCacheStats cacheStats;
+	static constexpr char binaryMagic[4] = { 'C', 'G', 'P', 'B' };
+
 	Shader() = delete;
 	Shader(const Shader&) = delete;
 	Shader(Shader&&) = delete;
 	Shader& operator=(const Shader&) = delete;
 	Shader& operator=(Shader&&) = delete;
 
-	explicit Shader(const GLuint& prog) : shaderProgram(prog) {}
-	explicit Shader(GLuint&& prog) : shaderProgram(prog) {}
+	explicit Shader(const GLuint& prog) : shaderProgram(prog) { ReflectUniforms(); }
+	explicit Shader(GLuint&& prog) : shaderProgram(prog) { ReflectUniforms(); }
 
 public:
 	virtual ~Shader() { glDeleteProgram(shaderProgram); }
 
+	/* Keep linked program binaries in directory dir, created if needed.
+	 * Returns false (and leaves caching off) if the driver supports no binary
+	 * format or the directory cannot be created.
+	 */
+	static bool EnableBinaryCache(const std::string& dir)
+	{
+		GLint formats = 0;
+		glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+		if (formats <= 0) {
+			std::cerr << "Shader: the driver supports no program binary format, cache disabled" << std::endl;
+			return false;
+		}
+		std::error_code error;
+		std::filesystem::create_directories(dir, error);
+		if (error) {
+			std::cerr << "Shader: cannot create cache directory '" << dir << "': " << error.message() << std::endl;
+			return false;
+		}
+		cacheDir = dir;
+		return true;
+	}
+
+	static const ShaderCacheStats& BinaryCacheStats() { return cacheStats; }
+
 	static std::unique_ptr<Shader> Create(const std::string& vertexFilename, const std::string& fragmentFilename)
 	{
-		// Build and compile our shader programs
+		return CreateTimed({ { GL_VERTEX_SHADER, vertexFilename }, { GL_FRAGMENT_SHADER, fragmentFilename } });
+	}
 
-		// Vertex shaders
-		const GLuint vertexShader = CompileShader(vertexFilename, GL_VERTEX_SHADER);
-		if (vertexShader == 0) {
-			std::cerr << "Cannot create Vertex Shader from file '" << vertexFilename << "'." << std::endl;
-			return nullptr;
+	/* Program with tessellation control & evaluation stages between the vertex and fragment ones */
+	static std::unique_ptr<Shader> Create(const std::string& vertexFilename, const std::string& tessControlFilename,
+		const std::string& tessEvaluationFilename, const std::string& fragmentFilename)
+	{
+		return CreateTimed({
+			{ GL_VERTEX_SHADER, vertexFilename },
+			{ GL_TESS_CONTROL_SHADER, tessControlFilename },
+			{ GL_TESS_EVALUATION_SHADER, tessEvaluationFilename },
+			{ GL_FRAGMENT_SHADER, fragmentFilename },
+		});
+	}
+
+	/* Compute program of a single stage, run with glDispatchCompute */
+	static std::unique_ptr<Shader> CreateCompute(const std::string& computeFilename)
+	{
+		return CreateTimed({ { GL_COMPUTE_SHADER, computeFilename } });
+	}
+
+	const GLuint Program() const { return shaderProgram; }
+
+	void Use() const { glUseProgram(shaderProgram); }
+
+	/* Location of an active uniform, -1 if the program has none by that name */
+	GLint Uniform(const std::string& name) const
+	{
+		auto it = uniforms.find(name);
+		return it != uniforms.end() ? it->second : -1;
+	}
+
+	/* Set a uniform of this program, which must be in use. Unknown names are ignored */
+	void Set(GLint location, GLint value) const { if (location >= 0) { glUniform1i(location, value); CountUniformCall(); } }
+	void Set(GLint location, GLfloat value) const { if (location >= 0) { glUniform1f(location, value); CountUniformCall(); } }
+	void Set(GLint location, const glm::ivec2& value) const { if (location >= 0) { glUniform2iv(location, 1, glm::value_ptr(value)); CountUniformCall(); } }
+	void Set(GLint location, const glm::vec2& value) const { if (location >= 0) { glUniform2fv(location, 1, glm::value_ptr(value)); CountUniformCall(); } }
+	void Set(GLint location, const glm::vec3& value) const { if (location >= 0) { glUniform3fv(location, 1, glm::value_ptr(value)); CountUniformCall(); } }
+	void Set(GLint location, const glm::vec4& value) const { if (location >= 0) { glUniform4fv(location, 1, glm::value_ptr(value)); CountUniformCall(); } }
+	void Set(GLint location, const glm::vec4* values, GLsizei count) const { if (location >= 0) { glUniform4fv(location, count, glm::value_ptr(values[0])); CountUniformCall(); } }
+	void Set(GLint location, const glm::mat4& value) const { if (location >= 0) { glUniformMatrix4fv(location, 1, GL_FALSE, glm::value_ptr(value)); CountUniformCall(); } }
+
+	template <typename T>
+	void Set(const std::string& name, const T& value) const { Set(Uniform(name), value); }
+
+	static size_t UniformCalls() { return uniformCalls.load(std::memory_order_relaxed); }
+	static void ResetUniformCalls() { uniformCalls.store(0, std::memory_order_relaxed); }
+
+private:
+
+	void ReflectUniforms()
+	{
+		GLint count = 0;
+		GLint maxLength = 0;
+		glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORMS, &count);
+		glGetProgramiv(shaderProgram, GL_ACTIVE_UNIFORM_MAX_LENGTH, &maxLength);
+
+		std::vector<GLchar> name(size_t(maxLength) + 1);
+		for (GLint i = 0; i < count; i++) {
+			GLsizei length = 0;
+			GLint size = 0;
+			GLenum type = 0;
+			glGetActiveUniform(shaderProgram, GLuint(i), GLsizei(name.size()), &length, &size, &type, name.data());
+			const GLint location = glGetUniformLocation(shaderProgram, name.data());
+			if (location < 0) {
+				// member of a uniform block
+				continue;
+			}
+			std::string key(name.data(), length);
+			uniforms[key] = location;
+			// arrays are reported as "name[0]"; also accept the plain name
+			if (key.size() > 3 && key.compare(key.size() - 3, 3, "[0]") == 0) {
+				uniforms[key.substr(0, key.size() - 3)] = location;
+			}
 		}
+	}
 
-		// Fragment shaders
-		const GLuint fragmentShader = CompileShader(fragmentFilename, GL_FRAGMENT_SHADER);
-		if (fragmentShader == 0) {
-			std::cerr << "Cannot create Fragment Shader from file '" << fragmentFilename << "'." << std::endl;
-			glDeleteShader(vertexShader);
-			return nullptr;
+	// one shader stage of a program and the file it is read from
+	struct Stage
+	{
+		GLenum type;
+		std::string filename;
+	};
+
+	static std::unique_ptr<Shader> CreateTimed(const std::vector<Stage>& stages)
+	{
+		const auto start = std::chrono::steady_clock::now();
+		auto shader = CreateProgram(stages);
+		cacheStats.milliseconds += std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+		return shader;
+	}
+
+	static std::unique_ptr<Shader> CreateProgram(const std::vector<Stage>& stages)
+	{
+		std::vector<std::string> sources(stages.size());
+		for (size_t i = 0; i < stages.size(); i++) {
+			if (!ReadSource(stages[i].filename, sources[i])) {
+				return nullptr;
+			}
+		}
+
+		// a binary is only valid for the same sources on the same driver
+		std::string cacheFile;
+		if (!cacheDir.empty()) {
+			std::vector<std::string> keyParts = sources;
+			for (const auto& stage : stages) {
+				keyParts.push_back(std::to_string(stage.type));
+			}
+			keyParts.push_back(GlString(GL_VENDOR));
+			keyParts.push_back(GlString(GL_RENDERER));
+			keyParts.push_back(GlString(GL_VERSION));
+			std::ostringstream key;
+			key << std::hex << std::setw(16) << std::setfill('0') << Fnv1a(keyParts);
+			cacheFile = (std::filesystem::path(cacheDir) / (key.str() + ".bin")).string();
+
+			const GLuint program = LoadBinary(cacheFile);
+			if (program != 0) {
+				cacheStats.hits++;
+				return std::unique_ptr<Shader>(new Shader(program));
+			}
+		}
+		cacheStats.misses++;
+
+		// Build and compile our shader programs
+		std::vector<GLuint> shaders;
+		for (size_t i = 0; i < stages.size(); i++) {
+			const GLuint shader = CompileShader(sources[i], stages[i].filename, stages[i].type);
+			if (shader == 0) {
+				std::cerr << "Cannot create " << StageName(stages[i].type) << " Shader from file '" << stages[i].filename << "'." << std::endl;
+				for (GLuint compiled : shaders) {
+					glDeleteShader(compiled);
+				}
+				return nullptr;
+			}
+			shaders.push_back(shader);
 		}
 
-		// link shaders: including vertex & fragment shaders
+		// link shaders: all the stages
 		const GLuint program = glCreateProgram();
-		glAttachShader(program, vertexShader);
-		glAttachShader(program, fragmentShader);
+		for (GLuint shader : shaders) {
+			glAttachShader(program, shader);
+		}
+		if (!cacheFile.empty()) {
+			glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
+		}
 		glLinkProgram(program);
 
 		// release input shaders
-		glDeleteShader(vertexShader);
-		glDeleteShader(fragmentShader);
+		for (GLuint shader : shaders) {
+			glDetachShader(program, shader);
+			glDeleteShader(shader);
+		}
 
 		// check for linking errors
 		GLint success;
@@ -68,16 +255,118 @@ public:
 			return nullptr;
 		}
 
+		if (!cacheFile.empty()) {
+			StoreBinary(program, cacheFile);
+		}
 		return std::unique_ptr<Shader>(new Shader(program));
 	}
 
-	const GLuint Program() const { return shaderProgram; }
+	// header of a cache file, followed by the program binary
+	struct BinaryHeader
+	{
+		char magic[4];
+		GLenum format;
+		GLuint length;
+	};
 
-	void Use() const { glUseProgram(shaderProgram); }
+	/* Program linked from a cached binary, 0 if there is none or the driver rejects it */
+	static GLuint LoadBinary(const std::string& filename)
+	{
+		std::ifstream fin(filename, std::ios::in | std::ios::binary);
+		if (!fin) {
+			return 0;
+		}
+		BinaryHeader header;
+		if (!fin.read(reinterpret_cast<char*>(&header), sizeof(header)) || std::memcmp(header.magic, binaryMagic, 4) != 0) {
+			cacheStats.rejected++;
+			return 0;
+		}
+		// the length comes from disk: it must be what the file holds before anything is allocated
+		std::error_code error;
+		const uintmax_t fileSize = std::filesystem::file_size(filename, error);
+		if (error || header.length == 0 || fileSize != sizeof(header) + uintmax_t(header.length)) {
+			cacheStats.rejected++;
+			return 0;
+		}
+		std::vector<char> binary(header.length);
+		if (!fin.read(binary.data(), binary.size())) {
+			cacheStats.rejected++;
+			return 0;
+		}
 
-private:
+		const GLuint program = glCreateProgram();
+		glProgramBinary(program, header.format, binary.data(), GLsizei(binary.size()));
+		// a driver update or a different GPU invalidates the binary: link from source instead
+		GLint success = GL_FALSE;
+		glGetProgramiv(program, GL_LINK_STATUS, &success);
+		if (!success) {
+			glDeleteProgram(program);
+			cacheStats.rejected++;
+			return 0;
+		}
+		return program;
+	}
 
-	static const GLuint CompileShader(const std::string& filename, GLenum type)
+	static void StoreBinary(GLuint program, const std::string& filename)
+	{
+		GLint length = 0;
+		glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+		if (length <= 0) {
+			return;
+		}
+		BinaryHeader header;
+		std::memcpy(header.magic, binaryMagic, 4);
+		std::vector<char> binary(static_cast<size_t>(length));
+		glGetProgramBinary(program, length, nullptr, &header.format, binary.data());
+		header.length = GLuint(length);
+
+		std::string error;
+		const bool written = WriteFileAtomically(filename, [&](std::ofstream& fout) {
+			fout.write(reinterpret_cast<const char*>(&header), sizeof(header));
+			return bool(fout.write(binary.data(), binary.size()));
+		}, error);
+		if (!written) {
+			std::cerr << "Shader: cannot store program binary '" << filename << "': " << error << std::endl;
+			return;
+		}
+		cacheStats.stored++;
+	}
+
+	static const char* StageName(GLenum type)
+	{
+		switch (type) {
+		case GL_VERTEX_SHADER:
+			return "Vertex";
+		case GL_TESS_CONTROL_SHADER:
+			return "Tessellation Control";
+		case GL_TESS_EVALUATION_SHADER:
+			return "Tessellation Evaluation";
+		case GL_GEOMETRY_SHADER:
+			return "Geometry";
+		case GL_FRAGMENT_SHADER:
+			return "Fragment";
+		default:
+			return "Compute";
+		}
+	}
+
+	static std::string GlString(GLenum name)
+	{
+		const GLubyte* str = glGetString(name);
+		return str != nullptr ? reinterpret_cast<const char*>(str) : "";
+	}
+
+	/* 64-bit FNV-1a over the strings, each followed by a 0 byte so their boundaries count */
+	static uint64_t Fnv1a(const std::vector<std::string>& parts)
+	{
+		uint64_t hash = kFnv1aBasis;
+		for (const auto& part : parts) {
+			hash = cg::Fnv1a(hash, part.c_str(), part.size() + 1);
+		}
+		return hash;
+	}
+
+	static bool ReadSource(const std::string& filename, std::string& source)
 	{
 		std::ifstream fin;
 
@@ -88,7 +377,11 @@ private:
 		}
 		catch (const std::ifstream::failure& e) {
 			std::cerr << "Shader: open file '" << filename << "' error: " << e.what() << std::endl;
-			return 0;
+			return false;
+		}
+		if (!fin.is_open()) {
+			std::cerr << "Shader: cannot open file '" << filename << "'" << std::endl;
+			return false;
 		}
 
 		// read all content from file
@@ -100,13 +393,18 @@ private:
 		catch (const std::ifstream::failure& e) {
 			std::cerr << "Shader: read file '" << filename << "' error: " << e.what() << std::endl;
 			fin.close();
-			return 0;
+			return false;
 		}
 
 		// finish reading
 		fin.close();
 
-		const std::string source = stream.str();
+		source = stream.str();
+		return true;
+	}
+
+	static const GLuint CompileShader(const std::string& source, const std::string& filename, GLenum type)
+	{
 		const GLchar* source_cstr = source.c_str();
 		const GLuint shader = glCreateShader(type);
 		glShaderSource(shader, 1, &source_cstr, NULL);
@@ -4,13 +4,13 @@
 
 #version 460 core
 
-in vec2 mapCoord;
-uniform sampler2D tex2D;
+in vec3 cubeCoord;
+layout (binding = 0) uniform samplerCube skybox;
 
 // output color
 out vec4 color;
 
 void main()
 {
-	color = texture2D(tex2D, mapCoord);
+	color = texture(skybox, cubeCoord);
 }
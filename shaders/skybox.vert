@@ -6,16 +6,23 @@
 
 // input vertex attributes
 layout (location = 0) in vec3 position;
-layout (location = 1) in vec2 texCoord;
 
-out vec2 mapCoord;
+out vec3 cubeCoord;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// camera of the frame, shared by all programs (see uniform_blocks.hpp)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 
 void main()
 {
-    gl_Position = projection * view * model * vec4(position, 1.0f);
-    mapCoord = texCoord;
-}
\ No newline at end of file
+    // z = w: the sky always lies on the far plane
+    vec4 pos = projection * view * model * vec4(position, 1.0f);
+    gl_Position = pos.xyww;
+    cubeCoord = position;
+}
@@ -25,26 +25,30 @@ in vec3 Normal;
 // output color
 out vec4 color;
 
-uniform sampler2D texColor;
-uniform sampler2D texDetail;
+layout (binding = 0) uniform sampler2D texColor;
+layout (binding = 1) uniform sampler2D texDetail;
 
 uniform float detailScale;
-uniform float upY;
 
-uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
+// camera of the frame, see uniform_blocks.hpp
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+// static lighting parameters
+layout (std140, binding = 1) uniform TerrainLighting
+{
+    Light light;
+    Material material;
+};
 
 uniform bool useLight;
 
 void main()
 {
-	// this part is under the visiable plane
-	float yPos = FragPos.y;
-	if (upY * yPos < 0) {
-		discard;
-	}
-
 	vec4 myColor = texture2D(texColor, mapCoord);
 	vec4 myDetail = texture2D(texDetail, detailScale * mapCoord);
 	// GL_ADD_SIGNED: a + b - 0.5
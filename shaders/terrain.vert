@@ -4,22 +4,51 @@
 
 #version 460 core
 
-// input vertex attributes
-layout (location = 0) in vec3 position;
-layout (location = 1) in vec3 normal;
+// input vertex attributes, see PackedGridVertex
+layout (location = 0) in float height;     // y * 65536
+layout (location = 1) in vec2 octNormal;   // octahedral encoded normal
 
 out vec2 mapCoord;
 out vec3 FragPos;
 out vec3 Normal;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// heightmap width & height: vertex (i, j) is number i * width + j
+uniform ivec2 gridSize;
+
+// camera of the frame, shared by all programs (see uniform_blocks.hpp)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+// world space plane (normal, distance), geometry on its negative side is clipped
+uniform vec4 clipPlane;
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.x, 1.0f - abs(e.x) - abs(e.y), e.y);
+    // lower hemisphere is folded over the upper one
+    if (n.y < 0.0f) {
+        vec2 s = vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.z >= 0.0f ? 1.0f : -1.0f);
+        n.xz = (1.0f - abs(n.zx)) * s;
+    }
+    return normalize(n);
+}
 
 void main()
 {
+    int i = gl_VertexID / gridSize.x;
+    int j = gl_VertexID - i * gridSize.x;
+    vec3 position = vec3(float(j) / float(gridSize.x), height / 65536.0f, float(i) / float(gridSize.y));
+    vec3 normal = DecodeOctahedral(octNormal);
+
     gl_Position = projection * view * model * vec4(position, 1.0f);
     mapCoord = vec2(position.x, 1.0f - position.z);
     FragPos = vec3(model * vec4(position, 1.0f));
+    gl_ClipDistance[0] = dot(vec4(FragPos, 1.0f), clipPlane);
     Normal = mat3(transpose(inverse(model))) * normal;
-}
\ No newline at end of file
+}
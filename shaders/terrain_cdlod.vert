@@ -0,0 +1,75 @@
+/*
+ * GLSL Vertex Shader for the CDLOD terrain: one patch mesh per quadtree node,
+ * heights fetched from the heightmap texture, morphing towards the next
+ * coarser level near the end of the node's LOD range.
+ */
+
+#version 460 core
+
+// integer grid coordinates inside the patch, 0 .. patchSize
+layout (location = 0) in vec2 gridPos;
+
+out vec2 mapCoord;
+out vec3 FragPos;
+out vec3 Normal;
+
+uniform mat4 model;
+
+// camera of the frame, shared by all programs (see uniform_blocks.hpp)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+uniform vec4 clipPlane;     // world space clip plane, as in terrain.vert
+
+layout (binding = 2) uniform sampler2D heightMap;
+uniform vec2 mapSize;       // heightmap width & height in samples
+uniform float patchSize;
+
+uniform vec4 nodeParams;    // xy: node origin in samples, z: samples per patch quad
+uniform vec2 morphRange;    // morph start & end distance of the node's level
+
+float sampleHeight(vec2 samplePos)
+{
+    // R8 texture returns h / 255, the mesh path uses h / 256
+    vec2 uv = (clamp(samplePos, vec2(0.0f), mapSize - 1.0f) + 0.5f) / mapSize;
+    return textureLod(heightMap, uv, 0).r * (255.0f / 256.0f);
+}
+
+vec3 terrainPos(vec2 samplePos)
+{
+    samplePos = clamp(samplePos, vec2(0.0f), mapSize - 1.0f);
+    return vec3(samplePos.x / mapSize.x, sampleHeight(samplePos), samplePos.y / mapSize.y);
+}
+
+void main()
+{
+    vec2 samplePos = nodeParams.xy + gridPos * nodeParams.z;
+    vec3 worldPos = vec3(model * vec4(terrainPos(samplePos), 1.0f));
+
+    // slide odd vertices onto the coarser grid as the camera moves away
+    float morphK = 0.0f;
+    if (morphRange.y > morphRange.x) {
+        morphK = clamp((distance(worldPos, viewPos) - morphRange.x) / (morphRange.y - morphRange.x), 0.0f, 1.0f);
+    }
+    vec2 morphed = gridPos - fract(gridPos * 0.5f) * 2.0f * morphK;
+    samplePos = nodeParams.xy + morphed * nodeParams.z;
+
+    vec3 position = terrainPos(samplePos);
+
+    // central differences, same as the CPU mesh builder
+    float hl = sampleHeight(samplePos - vec2(1.0f, 0.0f));
+    float hr = sampleHeight(samplePos + vec2(1.0f, 0.0f));
+    float hu = sampleHeight(samplePos - vec2(0.0f, 1.0f));
+    float hd = sampleHeight(samplePos + vec2(0.0f, 1.0f));
+    vec3 normal = normalize(vec3((hl - hr) * mapSize.x * 0.5f, 1.0f, (hu - hd) * mapSize.y * 0.5f));
+
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+    mapCoord = vec2(position.x, 1.0f - position.z);
+    FragPos = vec3(model * vec4(position, 1.0f));
+    gl_ClipDistance[0] = dot(vec4(FragPos, 1.0f), clipPlane);
+    Normal = mat3(transpose(inverse(model))) * normal;
+}
@@ -0,0 +1,78 @@
+/*
+ * GLSL Vertex Shader for the geometry clipmap terrain: one ring per level,
+ * heights fetched from the toroidally addressed level textures and blended
+ * towards the next coarser level near the outer border of the ring.
+ */
+
+#version 460 core
+
+// integer grid coordinates inside the level, 0 .. gridSize
+layout (location = 0) in vec2 gridPos;
+
+out vec2 mapCoord;
+out vec3 FragPos;
+out vec3 Normal;
+
+uniform mat4 model;
+
+// camera of the frame, shared by all programs (see uniform_blocks.hpp)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+uniform vec4 clipPlane;     // world space clip plane, as in terrain.vert
+
+uniform sampler2DArray heightLevels;
+uniform int level;
+uniform int levelCount;
+uniform vec2 levelOrigin;   // in units of this level's spacing
+uniform float gridSize;
+uniform float textureSize;
+uniform vec2 mapSize;       // heightmap width & height in samples
+
+float fetchHeight(ivec2 coord)
+{
+    int n = int(textureSize);
+    ivec2 texel = ((coord % n) + n) % n;
+    return texelFetch(heightLevels, ivec3(texel, level), 0).r;
+}
+
+void main()
+{
+    float spacing = float(1 << level);
+    ivec2 coord = ivec2(levelOrigin + gridPos);
+    float h = fetchHeight(coord);
+
+    // blend towards the coarser level over the outer tenth of the ring, fully
+    // coarse on the border so the levels meet without cracks
+    if (level + 1 < levelCount) {
+        vec4 cam = inverse(model) * vec4(viewPos, 1.0f);
+        vec2 camCoord = vec2(cam.x, cam.z) * mapSize / spacing;
+        vec2 d = abs(vec2(coord) - camCoord);
+        float blendWidth = gridSize / 10.0f;
+        float alpha = clamp((max(d.x, d.y) - (gridSize / 2.0f - 2.0f - blendWidth)) / blendWidth, 0.0f, 1.0f);
+
+        vec2 uv = (vec2(coord) * 0.5f + 0.5f) / textureSize;
+        float coarse = texture(heightLevels, vec3(uv, float(level + 1))).r;
+        h = mix(h, coarse, alpha);
+    }
+
+    // central differences at this level's spacing
+    float hl = fetchHeight(coord - ivec2(1, 0));
+    float hr = fetchHeight(coord + ivec2(1, 0));
+    float hu = fetchHeight(coord - ivec2(0, 1));
+    float hd = fetchHeight(coord + ivec2(0, 1));
+    vec3 normal = normalize(vec3((hl - hr) * mapSize.x / (2.0f * spacing), 1.0f, (hu - hd) * mapSize.y / (2.0f * spacing)));
+
+    vec2 samplePos = vec2(coord) * spacing;
+    vec3 position = vec3(samplePos.x / mapSize.x, h, samplePos.y / mapSize.y);
+
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+    mapCoord = vec2(position.x, 1.0f - position.z);
+    FragPos = vec3(model * vec4(position, 1.0f));
+    gl_ClipDistance[0] = dot(vec4(FragPos, 1.0f), clipPlane);
+    Normal = mat3(transpose(inverse(model))) * normal;
+}
@@ -0,0 +1,64 @@
+/*
+ * GLSL Vertex Shader for the vertex-buffer-free terrain: one grid patch,
+ * instanced once per visible chunk, with heights and normals fetched from
+ * textures at full resolution.
+ */
+
+#version 460 core
+
+out vec2 mapCoord;
+out vec3 FragPos;
+out vec3 Normal;
+
+uniform mat4 model;
+
+// camera of the frame, shared by all programs (see uniform_blocks.hpp)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+uniform vec4 clipPlane;     // world space clip plane, as in terrain.vert
+
+layout (binding = 2) uniform sampler2D heightMap;   // R8 heights
+layout (binding = 3) uniform sampler2D normalMap;   // RG16 snorm octahedral normals
+uniform ivec2 gridSize;     // heightmap width & height in samples
+uniform int patchSize;      // quads per patch side
+
+// first sample of every chunk, in BVH leaf order (the order instances are drawn in)
+layout (std430, binding = 0) readonly buffer ChunkOrigins
+{
+    ivec2 chunkOrigin[];
+};
+
+vec3 DecodeOctahedral(vec2 e)
+{
+    vec3 n = vec3(e.x, 1.0f - abs(e.x) - abs(e.y), e.y);
+    // lower hemisphere is folded over the upper one
+    if (n.y < 0.0f) {
+        vec2 s = vec2(n.x >= 0.0f ? 1.0f : -1.0f, n.z >= 0.0f ? 1.0f : -1.0f);
+        n.xz = (1.0f - abs(n.zx)) * s;
+    }
+    return normalize(n);
+}
+
+void main()
+{
+    // patch vertices are numbered row by row, patchSize + 1 per row
+    ivec2 local = ivec2(gl_VertexID % (patchSize + 1), gl_VertexID / (patchSize + 1));
+    // border chunks are partial: their outer vertices collapse onto the last sample
+    ivec2 texel = min(chunkOrigin[gl_BaseInstance + gl_InstanceID] + local, gridSize - 1);
+
+    // R8 texture returns h / 255, the mesh path uses h / 256
+    float height = texelFetch(heightMap, texel, 0).r * (255.0f / 256.0f);
+    vec3 position = vec3(float(texel.x) / float(gridSize.x), height, float(texel.y) / float(gridSize.y));
+    vec3 normal = DecodeOctahedral(texelFetch(normalMap, texel, 0).rg);
+
+    gl_Position = projection * view * model * vec4(position, 1.0f);
+    mapCoord = vec2(position.x, 1.0f - position.z);
+    FragPos = vec3(model * vec4(position, 1.0f));
+    gl_ClipDistance[0] = dot(vec4(FragPos, 1.0f), clipPlane);
+    Normal = mat3(transpose(inverse(model))) * normal;
+}
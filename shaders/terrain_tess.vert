@@ -0,0 +1,19 @@
+/*
+ * GLSL Vertex Shader for the tessellated terrain: passes the coarse patch
+ * corners through to the tessellation control shader.
+ */
+
+#version 460 core
+
+// input vertex attributes, see TessPatchVertex
+layout (location = 0) in vec2 samplePos;     // patch corner, in heightmap samples
+layout (location = 1) in vec2 heightRange;   // min & max terrain space height of the patch
+
+out vec2 vSamplePos;
+out vec2 vHeightRange;
+
+void main()
+{
+    vSamplePos = samplePos;
+    vHeightRange = heightRange;
+}
@@ -21,16 +21,29 @@ struct Light {
 in vec2 mapCoord;
 in vec3 FragPos;  
 in vec3 Normal;  
+in vec3 reflectCoord;
 
 // output color
 out vec4 color;
 
-uniform sampler2D tex2D;
+layout (binding = 0) uniform sampler2D tex2D;
+layout (binding = 1) uniform sampler2D reflectionMap;
 uniform float waterAlpha;
 
-uniform vec3 viewPos;
-uniform Material material;
-uniform Light light;
+// camera of the frame, see uniform_blocks.hpp
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
+
+// static lighting parameters
+layout (std140, binding = 2) uniform WaterLighting
+{
+    Light light;
+    Material material;
+};
 
 void main()
 {
@@ -54,5 +67,8 @@ void main()
         
     vec3 result = ambient + diffuse + specular;
 
-	color = vec4(sqrt(result) + texColor - 0.5, waterAlpha);
+    vec3 waterColor = sqrt(result) + texColor - 0.5;
+    vec3 reflection = textureProj(reflectionMap, reflectCoord).rgb;
+
+	color = vec4(mix(reflection, waterColor, waterAlpha), 1.0f);
 }
@@ -11,10 +11,17 @@ layout (location = 1) in vec2 texCoord;
 out vec2 mapCoord;
 out vec3 Normal;
 out vec3 FragPos;
+out vec3 reflectCoord;
 
 uniform mat4 model;
-uniform mat4 view;
-uniform mat4 projection;
+
+// camera of the frame, shared by all programs (see uniform_blocks.hpp)
+layout (std140, binding = 0) uniform Camera
+{
+    mat4 view;
+    mat4 projection;
+    vec3 viewPos;
+};
 
 uniform float xShift;
 uniform float yShift;
@@ -23,12 +30,21 @@ uniform vec3 inNormal;
 
 uniform float time;
 
+// projection * view of the frame the reflection texture was rendered in
+uniform mat4 reflectionViewProjection;
+
 void main()
 {
     //float newY = position.y + 0.5 * cos(time);
-    vec4 worldPos = projection * view * model * vec4(position, 1.0f);
-    worldPos.y += abs(0.4 * (cos(time * 1.7) + 1));
+    vec4 modelPos = model * vec4(position, 1.0f);
+    float wave = abs(0.4 * (cos(time * 1.7) + 1));
+    vec4 worldPos = projection * view * modelPos;
+    worldPos.y += wave;
     gl_Position = worldPos;
+    // projective coordinates of this vertex in the reflection texture, as its camera saw it
+    vec4 reflectClip = reflectionViewProjection * modelPos;
+    reflectClip.y += wave;
+    reflectCoord = vec3(0.5f * (reflectClip.xy + reflectClip.w), reflectClip.w);
     // texture resolution: 10.0f
     vec2 scaledCoord = 10.0f * texCoord;
     mapCoord = vec2(scaledCoord.x + xShift, scaledCoord.y + yShift);
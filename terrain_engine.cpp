@@ -1,6 +1,12 @@
 #include "terrain_engine.h"
 
+#include <algorithm>
+#include <chrono>
 #include <cmath>
+#include <cstddef>
+#include <cstring>
+#include <memory>
+#include <utility>
 #include <vector>
 
 #include <glm/gtc/matrix_transform.hpp>
@@ -8,10 +14,76 @@
 
 #include <SOIL2/SOIL2.h>
 
+#include "grid_mesh.hpp"
+#include "grid_mesh_builder.h"
+#include "vertex_layout.hpp"
+
 
 namespace cg
 {
 
+namespace
+{
+
+// uniforms that never change, set once when a terrain program is installed; without
+// binding it, so the program GlState believes in use stays the one in use
+void InitTerrainProgram(const Shader& shader)
+{
+    // scale of detail
+    glProgramUniform1f(shader.Program(), shader.Uniform("detailScale"), 30.0f);
+}
+
+// terrain VBO: height in units of 1 / 65536, octahedral normal in snorm16 (see terrain.vert)
+const VertexLayout terrainVertexLayout(sizeof(PackedGridVertex), {
+    CG_VERTEX_ATTRIBUTE(0, PackedGridVertex, height, false),
+    CG_VERTEX_ATTRIBUTE(1, PackedGridVertex, normal, true),
+});
+
+// corner of a coarse tessellation patch (see terrain_tess.vert)
+struct TessPatchVertex
+{
+    GLfloat samplePos[2];
+    GLfloat heightRange[2];
+};
+
+const VertexLayout tessVertexLayout(sizeof(TessPatchVertex), {
+    CG_VERTEX_ATTRIBUTE(0, TessPatchVertex, samplePos, false),
+    CG_VERTEX_ATTRIBUTE(1, TessPatchVertex, heightRange, false),
+});
+
+// the 4 corners of the patch over quads [col0, col1) x [row0, row1) with the height range of its samples
+void FitTessPatch(const unsigned char* heights, int width, int col0, int row0, int col1, int row1, TessPatchVertex* corners)
+{
+    unsigned char lo = 255;
+    unsigned char hi = 0;
+    for (int i = row0; i <= row1; i++) {
+        const unsigned char* row = heights + size_t(i) * width;
+        lo = std::min(lo, *std::min_element(row + col0, row + col1 + 1));
+        hi = std::max(hi, *std::max_element(row + col0, row + col1 + 1));
+    }
+    const GLfloat y0 = GLfloat(lo) / 256;
+    const GLfloat y1 = GLfloat(hi) / 256;
+    // (u, v) = (0, 0), (1, 0), (1, 1), (0, 1); u along x, v along z
+    corners[0] = {{GLfloat(col0), GLfloat(row0)}, {y0, y1}};
+    corners[1] = {{GLfloat(col1), GLfloat(row0)}, {y0, y1}};
+    corners[2] = {{GLfloat(col1), GLfloat(row1)}, {y0, y1}};
+    corners[3] = {{GLfloat(col0), GLfloat(row1)}, {y0, y1}};
+}
+
+// skybox & water cube: position, texture coordinates
+const VertexLayout cubeVertexLayout(TerrainEngine::cubeAttrNum * sizeof(GLfloat), {
+    { 0, 3, GL_FLOAT, GL_FALSE, 0 },
+    { 1, 2, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat) },
+});
+
+// lamp cube: position, normal
+const VertexLayout lampVertexLayout(TerrainEngine::lampAttrNum * sizeof(GLfloat), {
+    { 0, 3, GL_FLOAT, GL_FALSE, 0 },
+    { 1, 3, GL_FLOAT, GL_FALSE, 3 * sizeof(GLfloat) },
+});
+
+} /* anonymous namespace */
+
 const glm::vec3 lightColor{1.0f, 1.0f, 1.0f};
 glm::vec3 waterColor{0.3, 0.5, 1.0};
 glm::vec3 terranColor{1, 1, 1};
@@ -128,154 +200,598 @@ const GLfloat TerrainEngine::lampVertices[] = {
         -0.5f,  0.5f, -0.5f,  0.0f,  1.0f,  0.0f
 };
 
-TerrainEngine::TerrainEngine() :
-    heightmap_(nullptr), mapHeight_(0), mapWidth_(0), mapChannels_(0),
-    waterTexture_(0), skyboxTextures_{0}, terrainTextures_{0},
-    skyboxShader_(nullptr), waveSpeed_(0.2f), waveScale_(0.3f), waterAlpha_(0.75f)
+struct TerrainEngine::TerrainBuild
 {
-    // Set up vertex data (and buffer(s)) and attribute pointers
-    glGenVertexArrays(1, &skyboxVAO_);
-    glBindVertexArray(skyboxVAO_);
-
-    glGenBuffers(1, &skyboxVBO_);
-    glBindBuffer(GL_ARRAY_BUFFER, skyboxVBO_);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(cubeVertices), cubeVertices, GL_STATIC_DRAW);
-
-    // set vertex attribute pointers
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, cubeAttrNum * sizeof(GLfloat), (GLvoid*)0);
-    glEnableVertexAttribArray(0);
-    // texture attribute
-    glVertexAttribPointer(1, 2, GL_FLOAT, GL_FALSE, cubeAttrNum * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(1);
+    // prebuilt ones from a terrain file, else null until PrepareTerrain() builds them
+    const PackedGridVertex* vertices = nullptr;
+    const int16_t* normals = nullptr;
+    const GLuint* indices = nullptr;
+    size_t indexCount = 0;
+
+    std::unique_ptr<PackedGridVertex[]> landVerts;
+    std::vector<GLuint> landIndices;
+    std::vector<int16_t> normalData;
+    std::vector<glm::ivec2> chunkOrigins;
+    std::vector<GLuint> patchIndices;
+    std::vector<TessPatchVertex> tessVerts;
+    std::vector<GpuChunkCuller::Chunk> cullChunks;
+    bool prepared = false;
+};
 
-    // unbind VBO & VAO
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+TerrainEngine::TerrainEngine() :
+    heightmap_(nullptr), mapHeight_(0), mapWidth_(0), mapChannels_(0), gpuMeshBuild_(false),
+    terrainIndexCount_(0), frustumCulling_(true), multiDrawIndirect_(true),
+    gpuCulling_(false), gpuCulled_(false), frameViewProjection_(1.0f), patchIndexCount_(0),
+    tessPatchSize_(0), tessPatchCount_(0), tessPixelsPerEdge_(8.0f), tessPrimitives_(GL_PRIMITIVES_GENERATED),
+    tileIndexCount_(0), cameraVelocity_(0.0f), cameraFront_(0.0f),
+    renderMode_(TerrainRenderMode::MESH),
+    skyboxSamples_(GL_SAMPLES_PASSED), textureLoader_(),
+    skyboxShader_(nullptr), waveSpeed_(0.2f), waveScale_(0.3f), waterAlpha_(0.75f),
+    reflectionScale_(0.5f), reflectionWidth_(0), reflectionHeight_(0), reflectionValid_(false), reflectionAge_(0),
+    reflectionView_(1.0f), reflectionProjection_(1.0f), reflectionViewProjection_(1.0f), reflectionViewPos_(0.0f),
+    reflectionInterval_(1), reflectionMaxMove_(0.0f), reflectionMaxTurn_(0.0f),
+    cameraBlock_(), cameraValid_(false)
+{
+    // uniform buffers: the camera changes every frame, the lighting never does
+    cameraUBO_ = CreateBuffer(sizeof(CameraBlock), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    glBindBufferBase(GL_UNIFORM_BUFFER, CAMERA_BLOCK, cameraUBO_);
+
+    LightingBlock terrainLighting;
+    terrainLighting.light.position = glm::vec4(lightPos, 1.0f);
+    terrainLighting.light.ambient = glm::vec4(lightColor * glm::vec3(0.4f), 1.0f); // low influence
+    terrainLighting.light.diffuse = glm::vec4(lightColor, 1.0f);
+    terrainLighting.light.specular = glm::vec4(1.0f);
+    terrainLighting.material.ambient = glm::vec4(terranColor, 1.0f);
+    terrainLighting.material.diffuse = glm::vec4(terranColor, 1.0f);
+    terrainLighting.material.specular = glm::vec3(specularStrength * 4);
+    terrainLighting.material.shininess = shininess;
+
+    LightingBlock waterLighting;
+    waterLighting.light.position = glm::vec4(lightPos, 1.0f);
+    waterLighting.light.ambient = glm::vec4(lightColor * glm::vec3(0.6f * 0.15f), 1.0f); // low influence
+    waterLighting.light.diffuse = glm::vec4(lightColor * glm::vec3(0.6f), 1.0f); // decrease the influence
+    waterLighting.light.specular = glm::vec4(1.0f);
+    waterLighting.material.ambient = glm::vec4(waterColor, 1.0f);
+    waterLighting.material.diffuse = glm::vec4(waterColor, 1.0f);
+    waterLighting.material.specular = glm::vec3(specularStrength);
+    waterLighting.material.shininess = shininess;
+
+    lightingUBOs_[0] = CreateBuffer(sizeof(LightingBlock), &terrainLighting);
+    glBindBufferBase(GL_UNIFORM_BUFFER, TERRAIN_LIGHTING_BLOCK, lightingUBOs_[0]);
+    lightingUBOs_[1] = CreateBuffer(sizeof(LightingBlock), &waterLighting);
+    glBindBufferBase(GL_UNIFORM_BUFFER, WATER_LIGHTING_BLOCK, lightingUBOs_[1]);
 
     // Set up vertex data (and buffer(s)) and attribute pointers
-    glGenVertexArrays(1, &lampVAO_);
-    glBindVertexArray(lampVAO_);
-
-    glGenBuffers(1, &lampVBO_);
-    glBindBuffer(GL_ARRAY_BUFFER, lampVBO_);
-    glBufferData(GL_ARRAY_BUFFER, sizeof(lampVertices), lampVertices, GL_STATIC_DRAW);
-
-    // set vertex attribute pointers
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, lampAttrNum * sizeof(GLfloat), (GLvoid*)0);
-    glEnableVertexAttribArray(0);
-    // texture attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, lampAttrNum * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(1);
+    skyboxVBO_ = CreateBuffer(sizeof(cubeVertices), cubeVertices);
+    skyboxVAO_ = CreateVertexArray();
+    cubeVertexLayout.Apply(skyboxVAO_, skyboxVBO_);
 
-    // unbind VBO & VAO
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    lampVBO_ = CreateBuffer(sizeof(lampVertices), lampVertices);
+    lampVAO_ = CreateVertexArray();
+    lampVertexLayout.Apply(lampVAO_, lampVBO_);
 }
 
 TerrainEngine::~TerrainEngine()
 {
-    if (heightmap_ != nullptr) {
-        SOIL_free_image_data(heightmap_);
+    // a mapped terrain file owns its heights
+    if (heightmap_ != nullptr && terrainFile_ == nullptr) {
+        SOIL_free_image_data(const_cast<unsigned char*>(heightmap_));
     }
+}
 
-    glDeleteTextures(1, &waterTexture_);
-    glDeleteTextures(5, skyboxTextures_);
-    glDeleteTextures(2, terrainTextures_);
-
-    glDeleteVertexArrays(1, &skyboxVAO_);
-    glDeleteBuffers(1, &skyboxVBO_);
+bool TerrainEngine::LoadHeightmap(const char* heightmapFile)
+{
+    return ReadHeightmap(heightmapFile) && PrepareTerrain() && UploadTerrain();
+}
 
-    glDeleteVertexArrays(1, &lampVAO_);
-    glDeleteBuffers(1, &lampVBO_);
+bool TerrainEngine::LoadTerrainFile(const char* terrainFile)
+{
+    return MapTerrainFile(terrainFile) && PrepareTerrain() && UploadTerrain();
 }
 
-bool TerrainEngine::LoadHeightmap(const char* heightmapFile)
+bool TerrainEngine::ReadHeightmap(const char* heightmapFile)
 {
-    this->heightmap_ = SOIL_load_image(
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    unsigned char* pixels = SOIL_load_image(
         heightmapFile,
         &this->mapWidth_, &this->mapHeight_, &this->mapChannels_,
         SOIL_LOAD_L
     );
-    if (this->heightmap_ == nullptr) {
+    if (pixels == nullptr) {
         return false;
     }
+    this->heightmap_ = pixels;
+    terrainBuild_.reset(new TerrainBuild());
+    meshStats_.loadMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return true;
+}
 
-    for (int i = 0; i < mapHeight_; i++) {
-        for (int j = 0; j < mapWidth_; j++) {
-            int idx = i * mapWidth_ + j;
-            terrain_.vertices.emplace_back(
-                float(j) / mapWidth_,
-                float(heightmap_[idx]) / 256,
-                float(i) / mapHeight_
-            );
+bool TerrainEngine::MapTerrainFile(const char* terrainFile)
+{
+    using Clock = std::chrono::steady_clock;
+    auto start = Clock::now();
+    std::shared_ptr<TerrainFile> file = TerrainFile::Open(terrainFile);
+    if (file == nullptr) {
+        return false;
+    }
+    terrainFile_ = file;
+    mapWidth_ = file->Width();
+    mapHeight_ = file->Height();
+    mapChannels_ = 1;
+    heightmap_ = file->Heights();
+
+    // prebuilt indices are only usable if grouped by the same chunks, and only safe to
+    // draw if they stay inside the grid; the upload reads every index page anyway
+    bool chunked = file->ChunkSize() == terrainChunkSize;
+    if (chunked && !file->IndicesInRange()) {
+        std::cerr << "Terrain file '" << terrainFile << "': index out of range, rebuilding the indices" << std::endl;
+        chunked = false;
+    }
+    terrainBuild_.reset(new TerrainBuild());
+    terrainBuild_->vertices = file->Vertices();
+    terrainBuild_->normals = file->Normals();
+    terrainBuild_->indices = chunked ? file->Indices() : nullptr;
+    terrainBuild_->indexCount = chunked ? file->IndexCount() : 0;
+    meshStats_.loadMilliseconds = std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+    return true;
+}
 
-            terrain_.grid.push_back(idx);
+bool TerrainEngine::PrepareTerrain()
+{
+    if (terrainBuild_ == nullptr) {
+        return false;
+    }
+    TerrainBuild& build = *terrainBuild_;
+
+    using Clock = std::chrono::steady_clock;
+    auto Milliseconds = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+
+    // heights & normals straight from the heightmap, in parallel, unless prebuilt
+    // or left to the compute shader at upload
+    auto start = Clock::now();
+    const size_t vertexCount = size_t(mapWidth_) * size_t(mapHeight_);
+    meshStats_.prebuilt = build.vertices != nullptr && build.normals != nullptr;
+    meshStats_.gpuBuilt = build.vertices == nullptr && gpuMeshBuild_;
+    if (build.vertices == nullptr && !meshStats_.gpuBuilt) {
+        build.landVerts.reset(new PackedGridVertex[vertexCount]);
+        GridMeshBuilder().Build(heightmap_, mapWidth_, mapHeight_, build.landVerts.get());
+        build.vertices = build.landVerts.get();
+    }
+    meshStats_.buildMilliseconds = Milliseconds(start);
+
+    start = Clock::now();
+
+    // culling chunks and their bounds in terrain space, heights from the samples they cover
+    const int quadsX = mapWidth_ - 1;
+    const int quadsZ = mapHeight_ - 1;
+    std::vector<glm::vec3> chunkMin;
+    std::vector<glm::vec3> chunkMax;
+    const glm::ivec2 chunks = ComputeChunkBounds(heightmap_, mapWidth_, mapHeight_, terrainChunkSize, chunkMin, chunkMax);
+    const int chunksX = chunks.x;
+
+    // triangle list in vertex cache friendly order, chunk by chunk in BVH leaf order
+    // so chunks that are visible together tend to be contiguous; the same order as
+    // prebuilt indices, which are used as they are when their count matches
+    const size_t expectedIndices = size_t(std::max(quadsX, 0)) * size_t(std::max(quadsZ, 0)) * 6;
+    const bool prebuilt = build.indices != nullptr && build.indexCount == expectedIndices;
+    if (!prebuilt) {
+        build.landIndices.reserve(expectedIndices);
+    }
+    terrainChunks_.clear();
+    size_t first = 0;
+    for (int id : chunkBvh_.Build(chunkMin, chunkMax, chunksX, chunks.y)) {
+        const int col0 = (id % chunksX) * terrainChunkSize;
+        const int row0 = (id / chunksX) * terrainChunkSize;
+        const int col1 = std::min(col0 + terrainChunkSize, quadsX);
+        const int row1 = std::min(row0 + terrainChunkSize, quadsZ);
+        build.chunkOrigins.push_back(glm::ivec2(col0, row0));
+        const size_t count = size_t(row1 - row0) * size_t(col1 - col0) * 6;
+        if (!prebuilt) {
+            grid_mesh::AppendGridIndices(build.landIndices, mapWidth_, row0, row1, col0, col1);
         }
+        terrainChunks_.push_back({GLuint(first), GLsizei(count)});
+        build.cullChunks.push_back({ glm::vec4(chunkMin[id], 1.0f), glm::vec4(chunkMax[id], 1.0f), GLuint(first), GLuint(count), {0, 0} });
+        first += count;
+    }
+    meshStats_.prebuilt = meshStats_.prebuilt && prebuilt;
+    if (!prebuilt) {
+        build.indices = build.landIndices.data();
+        build.indexCount = build.landIndices.size();
+    }
+    terrainIndexCount_ = GLsizei(build.indexCount);
+
+    auto cache = grid_mesh::EstimateVertexCache(build.indices, build.indexCount);
+    meshStats_.vertexCount = vertexCount;
+    meshStats_.indexCount = build.indexCount;
+    meshStats_.vertexBytes = vertexCount * sizeof(PackedGridVertex);
+    meshStats_.indexBytes = build.indexCount * sizeof(GLuint);
+    meshStats_.chunkCount = terrainChunks_.size();
+    meshStats_.acmr = cache.acmr;
+    meshStats_.cacheHitRate = cache.hitRate;
+    meshStats_.meshMilliseconds = Milliseconds(start);
+
+    // PATCHES mode: octahedral normals for a texture, one patch of indices
+    start = Clock::now();
+    if (build.normals == nullptr && build.vertices != nullptr) {
+        build.normalData.resize(vertexCount * 2);
+        for (size_t k = 0; k < vertexCount; k++) {
+            build.normalData[2 * k] = build.vertices[k].normal[0];
+            build.normalData[2 * k + 1] = build.vertices[k].normal[1];
+        }
+        build.normals = build.normalData.data();
     }
 
-    terrain_.grid_height = mapHeight_;
-    terrain_.grid_width = mapWidth_;
+    // vertex ids of the patch are i * (terrainChunkSize + 1) + j, as terrain_patch.vert expects
+    grid_mesh::AppendGridIndices(build.patchIndices, terrainChunkSize + 1, 0, terrainChunkSize, 0, terrainChunkSize);
+    patchIndexCount_ = GLsizei(build.patchIndices.size());
+    meshStats_.patchMilliseconds = Milliseconds(start);
 
-    terrain_.triangulate_grid(false);
-    terrain_.need_normals();
+    // TESSELLATION mode: coarse patches with their height range, for culling in the control shader
+    int tessSize = terrainChunkSize;
+    while ((quadsX + tessSize - 1) / tessSize > tessMaxPatchesPerSide || (quadsZ + tessSize - 1) / tessSize > tessMaxPatchesPerSide) {
+        tessSize *= 2;
+    }
+    for (int row0 = 0; row0 < quadsZ; row0 += tessSize) {
+        for (int col0 = 0; col0 < quadsX; col0 += tessSize) {
+            build.tessVerts.resize(build.tessVerts.size() + 4);
+            FitTessPatch(heightmap_, mapWidth_, col0, row0, std::min(col0 + tessSize, quadsX), std::min(row0 + tessSize, quadsZ),
+                &build.tessVerts[build.tessVerts.size() - 4]);
+        }
+    }
+    tessPatchSize_ = tessSize;
+    tessPatchCount_ = GLsizei(build.tessVerts.size() / 4);
+    build.prepared = true;
+    return true;
+}
 
-    // VBO & VAO
-    glGenVertexArrays(1, &terrainVAO_);
-    glBindVertexArray(terrainVAO_);
+bool TerrainEngine::UploadTerrain()
+{
+    if (terrainBuild_ == nullptr || !terrainBuild_->prepared) {
+        return false;
+    }
+    // the CPU side is released once uploaded
+    std::unique_ptr<TerrainBuild> built = std::move(terrainBuild_);
+    const TerrainBuild& build = *built;
+
+    using Clock = std::chrono::steady_clock;
+    auto Milliseconds = [](Clock::time_point since) {
+        return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+    };
+    auto start = Clock::now();
+    const size_t vertexCount = size_t(mapWidth_) * size_t(mapHeight_);
+
+    // VBO & VAO, left empty for the compute shader when the vertices are generated on the GPU
+    terrainVBO_ = CreateBuffer(GLsizeiptr(vertexCount * sizeof(PackedGridVertex)), build.vertices);
+    terrainEBO_ = CreateBuffer(GLsizeiptr(build.indexCount * sizeof(GLuint)), build.indices);
+    terrainVAO_ = CreateVertexArray();
+    terrainVertexLayout.Apply(terrainVAO_, terrainVBO_);
+    glVertexArrayElementBuffer(terrainVAO_, terrainEBO_);
+    meshStats_.meshMilliseconds += Milliseconds(start);
+
+    // heightmap as a texture, for the LOD renderers' vertex texture fetch
+    heightTexture_ = CreateTexture(GL_TEXTURE_2D, 1, GL_R8, mapWidth_, mapHeight_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glTextureSubImage2D(heightTexture_, 0, 0, 0, mapWidth_, mapHeight_, GL_RED, GL_UNSIGNED_BYTE, heightmap_);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(heightTexture_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    meshStats_.heightTextureBytes = vertexCount;
+
+    // PATCHES mode: octahedral normals as a texture, one patch of indices, the chunk origins
+    start = Clock::now();
+    normalTexture_ = CreateTexture(GL_TEXTURE_2D, 1, GL_RG16_SNORM, mapWidth_, mapHeight_);
+    if (build.normals != nullptr) {
+        glTextureSubImage2D(normalTexture_, 0, 0, 0, mapWidth_, mapHeight_, GL_RG, GL_SHORT, build.normals);
+    }
+    glTextureParameteri(normalTexture_, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(normalTexture_, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    glTextureParameteri(normalTexture_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(normalTexture_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    meshStats_.normalTextureBytes = vertexCount * 2 * sizeof(int16_t);
+
+    if (meshStats_.gpuBuilt) {
+        // the objects replaced by a reload may still be shadowed as bound
+        glState_.Invalidate();
+        start = Clock::now();
+        if (!GenerateTerrainMesh(0, 0, mapWidth_, mapHeight_)) {
+            std::cerr << "Cannot generate the terrain mesh: no terrain mesh shader installed" << std::endl;
+            return false;
+        }
+        meshStats_.buildMilliseconds += Milliseconds(start);
+    }
 
-    glGenBuffers(1, &terrainVBO_);
-    glBindBuffer(GL_ARRAY_BUFFER, terrainVBO_);
+    patchEBO_ = CreateBuffer(build.patchIndices);
+    patchVAO_ = CreateVertexArray();
+    glVertexArrayElementBuffer(patchVAO_, patchEBO_);
+    chunkOriginSSBO_ = CreateBuffer(build.chunkOrigins);
+    meshStats_.patchBytes = build.patchIndices.size() * sizeof(GLuint) + build.chunkOrigins.size() * sizeof(glm::ivec2);
+    meshStats_.patchMilliseconds += Milliseconds(start);
+
+    // MESH & PATCHES modes: commands of the main and the mirrored pass, rewritten every frame
+    indirectBuffer_ = CreateBuffer(GLsizeiptr(2 * terrainChunks_.size() * sizeof(DrawCommand)), nullptr, GL_DYNAMIC_STORAGE_BIT);
+    // the same chunks for the GPU culling, bounds included
+    gpuCuller_.Build(build.cullChunks);
+
+    // TESSELLATION mode
+    // the height ranges are rewritten by UpdateHeightmap()
+    tessVBO_ = CreateBuffer(build.tessVerts, GL_DYNAMIC_STORAGE_BIT);
+    tessVAO_ = CreateVertexArray();
+    tessVertexLayout.Apply(tessVAO_, tessVBO_);
+
+    const bool lod = cdlod_.Build(heightmap_, mapWidth_, mapHeight_) && clipmap_.Build(heightmap_, mapWidth_, mapHeight_);
+    // the objects replaced by a reload were deleted, their names may still be shadowed as bound
+    glState_.Invalidate();
+    return lod;
+}
 
-    // generate array
-    std::vector<trimesh::point3> landVerts;
-    for (const auto& f : terrain_.faces) {
-        for (int i = 0; i < 3; i++) {
-            landVerts.push_back(terrain_.vertices[f[i]]);
-            landVerts.push_back(terrain_.normals[f[i]]);
+bool TerrainEngine::GenerateTerrainMesh(int x0, int z0, int x1, int z1)
+{
+    if (meshShader_ == nullptr) {
+        return false;
+    }
+    const Shader& shader = *meshShader_;
+    glState_.UseProgram(shader.Program());
+    glState_.BindTexture(2, heightTexture_);
+    glState_.BindStorageBuffer(1, terrainVBO_);
+    glBindImageTexture(0, normalTexture_, 0, GL_FALSE, 0, GL_WRITE_ONLY, GL_RG16_SNORM);
+    shader.Set("gridSize", glm::ivec2(mapWidth_, mapHeight_));
+    shader.Set("regionOrigin", glm::ivec2(x0, z0));
+    shader.Set("regionSize", glm::ivec2(x1 - x0, z1 - z0));
+    glDispatchCompute(GLuint(x1 - x0 + 7) / 8, GLuint(z1 - z0 + 7) / 8, 1);
+
+    // the vertices are read by the mesh draws, the normals by the patch shader
+    glMemoryBarrier(GL_VERTEX_ATTRIB_ARRAY_BARRIER_BIT | GL_TEXTURE_FETCH_BARRIER_BIT);
+    return true;
+}
+
+void TerrainEngine::RefitTerrainBounds(int x0, int z0, int x1, int z1)
+{
+    // what covers samples [x0, x1) x [z0, z1); a chunk or patch of n quads covers
+    // n + 1 samples per side, so one ending at x0 is included
+    auto first = [](int sample, int size) { return std::max(sample - 1, 0) / size; };
+    auto last = [](int sample, int count, int size) { return std::min((sample - 1) / size, count - 1); };
+    const int quadsX = mapWidth_ - 1;
+    const int quadsZ = mapHeight_ - 1;
+
+    // culling chunks: the BVH leaves and their ancestors, and the same chunks of the GPU culler;
+    // the leaf order only depends on the chunk grid, so every chunk keeps its index range
+    const int chunksX = (quadsX + terrainChunkSize - 1) / terrainChunkSize;
+    const int chunksZ = (quadsZ + terrainChunkSize - 1) / terrainChunkSize;
+    std::vector<std::pair<int, GpuChunkCuller::Chunk>> cullChunks;
+    for (int cz = first(z0, terrainChunkSize); cz <= last(z1, chunksZ, terrainChunkSize); cz++) {
+        for (int cx = first(x0, terrainChunkSize); cx <= last(x1, chunksX, terrainChunkSize); cx++) {
+            glm::vec3 boxMin, boxMax;
+            ChunkBounds(heightmap_, mapWidth_, mapHeight_, terrainChunkSize, cx, cz, boxMin, boxMax);
+            const int leaf = chunkBvh_.Refit(cz * chunksX + cx, boxMin, boxMax);
+            const TerrainChunk& chunk = terrainChunks_[leaf];
+            cullChunks.push_back({ leaf, { glm::vec4(boxMin, 1.0f), glm::vec4(boxMax, 1.0f), chunk.firstIndex, GLuint(chunk.indexCount), {0, 0} } });
+        }
+    }
+    // runs of chunks adjacent in leaf order are uploaded together
+    std::sort(cullChunks.begin(), cullChunks.end(), [](const auto& a, const auto& b) { return a.first < b.first; });
+    std::vector<GpuChunkCuller::Chunk> run;
+    for (size_t k = 0; k < cullChunks.size(); k++) {
+        run.push_back(cullChunks[k].second);
+        if (k + 1 == cullChunks.size() || cullChunks[k + 1].first != cullChunks[k].first + 1) {
+            gpuCuller_.UpdateChunks(GLsizei(cullChunks[k].first + 1 - run.size()), run);
+            run.clear();
+        }
+    }
+
+    cdlod_.UpdateHeights(heightmap_, x0, z0, x1, z1);
+
+    // tessellation patches, row by row of the patch grid
+    if (tessPatchCount_ > 0) {
+        const int patchesX = (quadsX + tessPatchSize_ - 1) / tessPatchSize_;
+        const int patchesZ = (quadsZ + tessPatchSize_ - 1) / tessPatchSize_;
+        const int px0 = first(x0, tessPatchSize_);
+        const int px1 = last(x1, patchesX, tessPatchSize_);
+        std::vector<TessPatchVertex> corners(size_t(px1 - px0 + 1) * 4);
+        for (int pz = first(z0, tessPatchSize_); pz <= last(z1, patchesZ, tessPatchSize_); pz++) {
+            for (int px = px0; px <= px1; px++) {
+                const int col0 = px * tessPatchSize_;
+                const int row0 = pz * tessPatchSize_;
+                FitTessPatch(heightmap_, mapWidth_, col0, row0, std::min(col0 + tessPatchSize_, quadsX),
+                    std::min(row0 + tessPatchSize_, quadsZ), &corners[size_t(px - px0) * 4]);
+            }
+            const GLintptr offset = GLintptr(pz * patchesX + px0) * 4 * GLintptr(sizeof(TessPatchVertex));
+            glNamedBufferSubData(tessVBO_, offset, GLsizeiptr(corners.size() * sizeof(TessPatchVertex)), corners.data());
         }
     }
+}
+
+bool TerrainEngine::UpdateHeightmap(int x0, int z0, int width, int height, const unsigned char* samples)
+{
+    if (heightmap_ == nullptr || heightTexture_ == 0 || samples == nullptr || width <= 0 || height <= 0) {
+        return false;
+    }
+    if (meshShader_ == nullptr) {
+        std::cerr << "Cannot update the terrain mesh: no terrain mesh shader installed" << std::endl;
+        return false;
+    }
+    // the part of the region inside the map
+    const int cx0 = std::max(x0, 0);
+    const int cz0 = std::max(z0, 0);
+    const int cx1 = std::min(x0 + width, mapWidth_);
+    const int cz1 = std::min(z0 + height, mapHeight_);
+    if (cx0 >= cx1 || cz0 >= cz1) {
+        return false;
+    }
 
-    terrainDrawSize_ = int(terrain_.faces.size() * 3);
+    // the heights of a mapped terrain file are read only: edit a copy
+    if (terrainFile_ != nullptr && heightmap_ != editedHeights_.get()) {
+        const size_t count = size_t(mapWidth_) * size_t(mapHeight_);
+        editedHeights_.reset(new unsigned char[count]);
+        std::copy(heightmap_, heightmap_ + count, editedHeights_.get());
+        heightmap_ = editedHeights_.get();
+    }
+    unsigned char* heights = const_cast<unsigned char*>(heightmap_);
+    for (int z = cz0; z < cz1; z++) {
+        const unsigned char* row = samples + size_t(z - z0) * width + (cx0 - x0);
+        std::copy(row, row + (cx1 - cx0), heights + size_t(z) * mapWidth_ + cx0);
+    }
+
+    // the height texture, then the vertices & normals around the region: a normal
+    // depends on the neighbouring heights, so one more sample on each side
+    const unsigned char* first = heights + size_t(cz0) * mapWidth_ + cx0;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, mapWidth_);
+    glTextureSubImage2D(heightTexture_, 0, cx0, cz0, cx1 - cx0, cz1 - cz0, GL_RED, GL_UNSIGNED_BYTE, first);
+    glPixelStorei(GL_UNPACK_ROW_LENGTH, 0);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    GenerateTerrainMesh(std::max(cx0 - 1, 0), std::max(cz0 - 1, 0), std::min(cx1 + 1, mapWidth_), std::min(cz1 + 1, mapHeight_));
+
+    RefitTerrainBounds(cx0, cz0, cx1, cz1);
+    clipmap_.Reload(heightmap_);
+    reflectionValid_ = false;
+    return true;
+}
 
-    glBufferData(GL_ARRAY_BUFFER, landVerts.size() * sizeof(trimesh::point3), &landVerts.front(), GL_STATIC_DRAW);
+bool TerrainEngine::EnableTileStreaming(std::unique_ptr<TileSource> source, size_t budgetBytes, int radius)
+{
+    if (source == nullptr || source->TileSize() <= 0 || source->TilesX() <= 0 || source->TilesZ() <= 0) {
+        return false;
+    }
 
-    // set vertex attribute pointers
-    // position attribute
-    glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (GLvoid*)0);
-    glEnableVertexAttribArray(0);
-    // normal attribute
-    glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, 6 * sizeof(GLfloat), (GLvoid*)(3 * sizeof(GLfloat)));
-    glEnableVertexAttribArray(1);
+    streamedTiles_.clear();
+    glState_.Invalidate();
 
-    // unbind VBO & VAO
-    glBindBuffer(GL_ARRAY_BUFFER, 0);
-    glBindVertexArray(0);
+    // every tile has the same grid, vertex (i, j) being number i * (tileSize + 1) + j
+    const int tileSize = source->TileSize();
+    std::vector<GLuint> tileIndices;
+    grid_mesh::AppendGridIndices(tileIndices, tileSize + 1, 0, tileSize, 0, tileSize);
+    tileIndexCount_ = GLsizei(tileIndices.size());
+    tileEBO_ = CreateBuffer(tileIndices);
 
+    tileStreamer_.reset(new TileStreamer(std::move(source), budgetBytes, radius));
     return true;
 }
 
-bool TerrainEngine::LoadSkybox(const char* const skyboxFiles[5])
+size_t TerrainEngine::StreamedTileBytes() const
 {
-    for (int i = 0; i < 5; i++) {
-        if ((this->skyboxTextures_[i] = LoadTexture(skyboxFiles[i])) == 0) {
-            return false;
+    if (tileStreamer_ == nullptr) {
+        return 0;
+    }
+    return streamedTiles_.size() * tileStreamer_->Source().TileSamples() * sizeof(PackedGridVertex)
+        + size_t(tileIndexCount_) * sizeof(GLuint);
+}
+
+void TerrainEngine::UpdateStreamedTiles(const glm::vec3& viewPos)
+{
+    const TileSource& source = tileStreamer_->Source();
+    const int tileSize = source.TileSize();
+    const int samples = tileSize + 1;
+
+    // the world is centered on the terrain and sampled like the loaded heightmap
+    const GLfloat unit = GLfloat(mapWidth_ > 0 ? mapWidth_ : 1024);
+    const glm::vec2 worldCenter(GLfloat(source.TilesX() * tileSize) / 2, GLfloat(source.TilesZ() * tileSize) / 2);
+    const glm::mat4 toLocal = glm::inverse(landModel);
+    const glm::vec4 local = toLocal * glm::vec4(viewPos, 1.0f);
+    const glm::vec4 velocity = toLocal * glm::vec4(cameraVelocity_, 0.0f) * unit;
+    const glm::vec4 front = toLocal * glm::vec4(cameraFront_, 0.0f);
+    TileMotion motion{ (local.x - 0.5f) * unit + worldCenter.x, (local.z - 0.5f) * unit + worldCenter.y };
+    motion.velocityX = velocity.x;
+    motion.velocityZ = velocity.z;
+    motion.frontX = front.x;
+    motion.frontZ = front.z;
+    tileStreamer_->Update(motion);
+
+    // drop the tiles that left the radius or the cache
+    const size_t resident = streamedTiles_.size();
+    for (auto it = streamedTiles_.begin(); it != streamedTiles_.end(); ) {
+        const TileId tile{ int(it->first >> 32), int(uint32_t(it->first)) };
+        if (!tileStreamer_->IsWanted(tile) || tileStreamer_->Heights(tile) == nullptr) {
+            it = streamedTiles_.erase(it);
+        } else {
+            ++it;
         }
     }
-    return true;
+    if (streamedTiles_.size() != resident) {
+        // a deleted VAO may be bound, and its name reused by the next tile
+        glState_.Invalidate();
+    }
+
+    // and build the nearest wanted tiles that are resident now
+    int builds = 0;
+    std::vector<PackedGridVertex> verts(size_t(samples) * samples);
+    for (const TileId& tile : tileStreamer_->Wanted()) {
+        if (builds == streamedTileBuildsPerFrame) {
+            break;
+        }
+        const unsigned char* heights = tileStreamer_->Heights(tile);
+        if (heights == nullptr || streamedTiles_.count(tile.Key()) != 0) {
+            continue;
+        }
+
+        // a tile is one grid of heights, normals are one-sided along its border
+        GridMeshBuilder(1).Build(heights, samples, samples, verts.data());
+        const auto range = std::minmax_element(heights, heights + size_t(samples) * samples);
+
+        StreamedTile gpu;
+        gpu.vbo = CreateBuffer(verts);
+        gpu.vao = CreateVertexArray();
+        terrainVertexLayout.Apply(gpu.vao, gpu.vbo);
+        glVertexArrayElementBuffer(gpu.vao, tileEBO_);
+
+        // the tile grid spans [0, 1) per side in the shader, one sample is 1 / unit in terrain space
+        const glm::vec3 origin((GLfloat(tile.x * tileSize) - worldCenter.x) / unit + 0.5f, 0.0f,
+            (GLfloat(tile.z * tileSize) - worldCenter.y) / unit + 0.5f);
+        const GLfloat extent = GLfloat(samples) / unit;
+        gpu.model = glm::scale(glm::translate(glm::mat4(1.0f), origin), glm::vec3(extent, 1.0f, extent));
+        gpu.boxMin = origin + glm::vec3(0.0f, GLfloat(*range.first) / 256, 0.0f);
+        gpu.boxMax = origin + glm::vec3(GLfloat(tileSize) / unit, GLfloat(*range.second) / 256, GLfloat(tileSize) / unit);
+        streamedTiles_.emplace(tile.Key(), std::move(gpu));
+        builds++;
+    }
+}
+
+bool TerrainEngine::LoadSkybox(const char* const skyboxFiles[5])
+{
+    LoadSkyboxAsync(skyboxFiles);
+    const bool loaded = textureLoader_.Finish();
+    // Finish() deleted the placeholders, whose names may still be shadowed as bound
+    glState_.Invalidate();
+    return loaded;
 }
 
 bool TerrainEngine::LoadWaterTexture(const char* waterFile)
 {
-    return (this->waterTexture_ = LoadTexture(waterFile, true)) != 0;
+    LoadWaterTextureAsync(waterFile);
+    const bool loaded = textureLoader_.Finish();
+    // Finish() deleted the placeholders, whose names may still be shadowed as bound
+    glState_.Invalidate();
+    return loaded;
 }
 
 bool TerrainEngine::LoadTerrainTexture(const char* landFile, const char* detailFile)
 {
-    this->terrainTextures_[0] = LoadTexture(landFile);
-    this->terrainTextures_[1] = LoadTexture(detailFile, true);
-    return (this->terrainTextures_[0] != 0) && (this->terrainTextures_[1] != 0);
+    LoadTerrainTextureAsync(landFile, detailFile);
+    const bool loaded = textureLoader_.Finish();
+    // Finish() deleted the placeholders, whose names may still be shadowed as bound
+    glState_.Invalidate();
+    return loaded;
+}
+
+void TerrainEngine::LoadSkyboxAsync(const char* const skyboxFiles[5])
+{
+    textureLoader_.LoadCube(skyboxFiles, glm::vec3(0.53f, 0.71f, 0.90f), &skyboxTexture_);
+}
+
+void TerrainEngine::LoadWaterTextureAsync(const char* waterFile)
+{
+    textureLoader_.Load2D(waterFile, true, waterColor, &waterTexture_);
+}
+
+void TerrainEngine::LoadTerrainTextureAsync(const char* landFile, const char* detailFile)
+{
+    // placeholders: an earthy tone, and mid grey for the detail map, which modulates around it
+    textureLoader_.Load2D(landFile, false, glm::vec3(0.45f, 0.40f, 0.30f), &terrainTextures_[0]);
+    textureLoader_.Load2D(detailFile, true, glm::vec3(0.5f), &terrainTextures_[1], detailSharpen);
 }
 
 bool TerrainEngine::InstallSkyboxShaders(const char* vert, const char* frag)
@@ -287,13 +803,74 @@ bool TerrainEngine::InstallSkyboxShaders(const char* vert, const char* frag)
 bool TerrainEngine::InstallWaterShaders(const char* vert, const char* frag)
 {
     this->waterShader_ = Shader::Create(vert, frag);
-    return this->waterShader_ != nullptr;
+    if (this->waterShader_ == nullptr) {
+        return false;
+    }
+    // the water is flat
+    const glm::vec3 normal(0.0f, 1.0f, 0.0f);
+    glProgramUniform3fv(waterShader_->Program(), waterShader_->Uniform("inNormal"), 1, glm::value_ptr(normal));
+    return true;
 }
 
 bool TerrainEngine::InstallTerrainShaders(const char* vert, const char* frag)
 {
     this->terrainShader_ = Shader::Create(vert, frag);
-    return this->terrainShader_ != nullptr;
+    if (this->terrainShader_ == nullptr) {
+        return false;
+    }
+    InitTerrainProgram(*terrainShader_);
+    return true;
+}
+
+bool TerrainEngine::InstallTerrainLodShaders(const char* vert, const char* frag)
+{
+    this->cdlodShader_ = Shader::Create(vert, frag);
+    if (this->cdlodShader_ == nullptr) {
+        return false;
+    }
+    InitTerrainProgram(*cdlodShader_);
+    return true;
+}
+
+bool TerrainEngine::InstallTerrainClipmapShaders(const char* vert, const char* frag)
+{
+    this->clipmapShader_ = Shader::Create(vert, frag);
+    if (this->clipmapShader_ == nullptr) {
+        return false;
+    }
+    InitTerrainProgram(*clipmapShader_);
+    return true;
+}
+
+bool TerrainEngine::InstallTerrainPatchShaders(const char* vert, const char* frag)
+{
+    this->patchShader_ = Shader::Create(vert, frag);
+    if (this->patchShader_ == nullptr) {
+        return false;
+    }
+    InitTerrainProgram(*patchShader_);
+    return true;
+}
+
+bool TerrainEngine::InstallTerrainTessShaders(const char* vert, const char* tesc, const char* tese, const char* frag)
+{
+    this->tessShader_ = Shader::Create(vert, tesc, tese, frag);
+    if (this->tessShader_ == nullptr) {
+        return false;
+    }
+    InitTerrainProgram(*tessShader_);
+    return true;
+}
+
+bool TerrainEngine::InstallTerrainCullShaders(const char* cull, const char* pyramid)
+{
+    return gpuCuller_.InstallShaders(cull, pyramid);
+}
+
+bool TerrainEngine::InstallTerrainMeshShader(const char* comp)
+{
+    this->meshShader_ = Shader::CreateCompute(comp);
+    return this->meshShader_ != nullptr;
 }
 
 bool TerrainEngine::InstallLampShaders(const char* vert, const char* frag)
@@ -302,39 +879,128 @@ bool TerrainEngine::InstallLampShaders(const char* vert, const char* frag)
     return this->lampShader_ != nullptr;
 }
 
-void TerrainEngine::DrawSkybox(const glm::mat4& view, const glm::mat4& projection) const
+void TerrainEngine::BeginFrame(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos)
 {
-    DrawSkybox(worldModel, view, projection);
+    frameStats_ = TerrainFrameStats();
+    frameViewProjection_ = projection * view;
+    gpuCulled_ = false;
+    Shader::ResetUniformCalls();
+    glState_.ResetStats();
+
+    // textures finished since the last frame: the water reflects the new ones;
+    // swapping them in deletes placeholders the state cache may hold as bound
+    if (textureLoader_.Pending()) {
+        if (textureLoader_.Poll() > 0) {
+            reflectionValid_ = false;
+        }
+        glState_.Invalidate();
+    }
+
+    CameraBlock camera;
+    camera.view = view;
+    camera.projection = projection;
+    camera.viewPos = glm::vec4(viewPos, 1.0f);
+    if (!cameraValid_ || std::memcmp(&camera, &cameraBlock_, sizeof(CameraBlock)) != 0) {
+        glNamedBufferSubData(cameraUBO_, 0, sizeof(CameraBlock), &camera);
+        cameraBlock_ = camera;
+        cameraValid_ = true;
+        frameStats_.uniformBlockUpdates++;
+    }
 }
 
-void TerrainEngine::DrawTerrain(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos) const
+void TerrainEngine::EndFrame()
 {
-    DrawTerrain(landModel, view, projection, 1.0f, viewPos, true);
+    if (!gpuCulled_) {
+        return;
+    }
+    // the depth buffer holds the main pass now; the culling copies what fits the viewport
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    gpuCuller_.UpdatePyramid(glState_, frameViewProjection_, viewport[2], viewport[3]);
+    gpuCuller_.EndFrame();
 }
 
-void TerrainEngine::DrawLamp(const glm::mat4& view, const glm::mat4& projection) const
+void TerrainEngine::DrawSkybox()
 {
-    lampShader_->Use();
+    skyboxSamples_.Begin();
+    DrawSkybox(worldModel);
+    skyboxSamples_.End();
+}
 
-    // Get the uniform locations
-    GLint modelLoc = glGetUniformLocation(lampShader_->Program(), "model");
-    GLint viewLoc = glGetUniformLocation(lampShader_->Program(), "view");
-    GLint projLoc = glGetUniformLocation(lampShader_->Program(), "projection");
+void TerrainEngine::DrawTerrain(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos)
+{
+    if (renderMode_ == TerrainRenderMode::STREAMED && tileStreamer_ != nullptr) {
+        UpdateStreamedTiles(viewPos);
+    }
+    DrawTerrain(landModel, view, projection, 1.0f, viewPos, true);
+}
+
+void TerrainEngine::DrawLamp(const glm::mat4& view, const glm::mat4& projection)
+{
+    glState_.UseProgram(lampShader_->Program());
+    glState_.Enable(GL_DEPTH_TEST, true);
+    glState_.Enable(GL_CLIP_DISTANCE0, false);
+    glState_.DepthFunc(GL_LESS);
 
     // Pass the matrices to the shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(lampModel));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    lampShader_->Set("model", lampModel);
+    lampShader_->Set("view", view);
+    lampShader_->Set("projection", projection);
 
-    glUniform3fv(glGetUniformLocation(lampShader_->Program(), "lightColor"), 1, glm::value_ptr(glm::vec3(1.0f, 1.0f, 0.0f)));
+    lampShader_->Set("lightColor", glm::vec3(1.0f, 1.0f, 0.0f));
 
-    glBindVertexArray(lampVAO_);
+    glState_.BindVertexArray(lampVAO_);
     glDrawArrays(GL_TRIANGLES, 0, 36);
-    glBindVertexArray(0);
 }
 
 
-void TerrainEngine::DrawWater(const glm::mat4& view, const glm::mat4& projection, GLfloat deltaTime, const glm::vec3& viewPos) const
+bool TerrainEngine::ResizeReflection(GLsizei width, GLsizei height)
+{
+    if (reflectionFBO_ != 0 && width == reflectionWidth_ && height == reflectionHeight_) {
+        return true;
+    }
+
+    // immutable storage: a new size takes new attachments, the old ones are deleted
+    if (reflectionFBO_ == 0) {
+        reflectionFBO_ = CreateFramebuffer();
+    }
+    reflectionTexture_ = CreateTexture(GL_TEXTURE_2D, 1, GL_RGBA8, width, height);
+    glTextureParameteri(reflectionTexture_, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTextureParameteri(reflectionTexture_, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTextureParameteri(reflectionTexture_, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTextureParameteri(reflectionTexture_, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    reflectionDepth_ = CreateRenderbuffer(GL_DEPTH_COMPONENT24, width, height);
+
+    glNamedFramebufferTexture(reflectionFBO_, GL_COLOR_ATTACHMENT0, reflectionTexture_, 0);
+    glNamedFramebufferRenderbuffer(reflectionFBO_, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, reflectionDepth_);
+    bool complete = glCheckNamedFramebufferStatus(reflectionFBO_, GL_FRAMEBUFFER) == GL_FRAMEBUFFER_COMPLETE;
+
+    reflectionWidth_ = complete ? width : 0;
+    reflectionHeight_ = complete ? height : 0;
+    reflectionValid_ = false;
+    glState_.Invalidate();
+    return complete;
+}
+
+bool TerrainEngine::ReflectionNeedsUpdate(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos) const
+{
+    if (!reflectionValid_ || projection != reflectionProjection_) {
+        return true;
+    }
+    if (reflectionInterval_ > 0 && reflectionAge_ + 1 >= reflectionInterval_) {
+        return true;
+    }
+    if (glm::distance(viewPos, reflectionViewPos_) > reflectionMaxMove_) {
+        return true;
+    }
+
+    // angle of the rotation between the two camera orientations
+    const glm::mat3 relative = glm::mat3(view) * glm::transpose(glm::mat3(reflectionView_));
+    const GLfloat cosAngle = (relative[0][0] + relative[1][1] + relative[2][2] - 1.0f) / 2;
+    return cosAngle < std::cos(glm::radians(reflectionMaxTurn_));
+}
+
+void TerrainEngine::DrawReflection(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos)
 {
     const static glm::mat4 mirrorMat({
         {1, 0, 0, 0},
@@ -342,39 +1008,68 @@ void TerrainEngine::DrawWater(const glm::mat4& view, const glm::mat4& projection
         {0, 0, 1, 0},
         {0, 0, 0, 1}});
 
-    // draw a mirrored sky
-    const static glm::mat4 mirrorSkyModel = mirrorMat * worldModel;
+    GLint viewport[4];
+    glGetIntegerv(GL_VIEWPORT, viewport);
+    const GLsizei width = std::max(GLsizei(viewport[2] * reflectionScale_), 1);
+    const GLsizei height = std::max(GLsizei(viewport[3] * reflectionScale_), 1);
+    if (!ResizeReflection(width, height)) {
+        return;
+    }
 
-    DrawSkybox(mirrorSkyModel, view, projection);
+    if (!ReflectionNeedsUpdate(view, projection, viewPos)) {
+        reflectionAge_++;
+        frameStats_.reflectionReused = true;
+        return;
+    }
+    reflectionValid_ = true;
+    reflectionAge_ = 0;
+    reflectionView_ = view;
+    reflectionProjection_ = projection;
+    reflectionViewProjection_ = projection * view;
+    reflectionViewPos_ = viewPos;
+
+    // same camera as the main pass, so the texture lines up with the screen
+    GLint previous = 0;
+    glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &previous);
+    glBindFramebuffer(GL_FRAMEBUFFER, reflectionFBO_);
+    glViewport(0, 0, width, height);
+    glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 
     // draw a mirrored terrain, y of "world up" should be -1
     const static glm::mat4 mirrorLandModel = mirrorMat * landModel;
 
     DrawTerrain(mirrorLandModel, view, projection, -1.0f, viewPos, false);
 
-    // --------------------------------
+    // draw a mirrored sky behind it
+    const static glm::mat4 mirrorSkyModel = mirrorMat * worldModel;
+
+    DrawSkybox(mirrorSkyModel);
 
-    glDepthMask(GL_FALSE);
-    glEnable(GL_BLEND);
+    glBindFramebuffer(GL_FRAMEBUFFER, previous);
+    glViewport(viewport[0], viewport[1], viewport[2], viewport[3]);
+}
 
-    // semi-transparent water
-    glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
-    
-    waterShader_->Use();
-    glBindVertexArray(skyboxVAO_);
+void TerrainEngine::DrawWater(const glm::mat4& view, const glm::mat4& projection, GLfloat deltaTime, const glm::vec3& viewPos)
+{
+    DrawReflection(view, projection, viewPos);
 
-    // Get the uniform locations
-    GLint modelLoc = glGetUniformLocation(skyboxShader_->Program(), "model");
-    GLint viewLoc = glGetUniformLocation(skyboxShader_->Program(), "view");
-    GLint projLoc = glGetUniformLocation(skyboxShader_->Program(), "projection");
+    // --------------------------------
 
-    // Pass the matrices to the shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(worldModel));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    // water mixed over the reflection by waterAlpha in the shader, no blending;
+    // it writes depth so the sky drawn afterwards leaves it alone
+    glState_.UseProgram(waterShader_->Program());
+    glState_.BindVertexArray(skyboxVAO_);
+    glState_.Enable(GL_DEPTH_TEST, true);
+    glState_.Enable(GL_BLEND, false);
+    glState_.Enable(GL_CLIP_DISTANCE0, false);
+    glState_.DepthFunc(GL_LESS);
+    glState_.DepthMask(GL_TRUE);
 
-    GLint xShiftLoc = glGetUniformLocation(waterShader_->Program(), "xShift");
-    GLint yShiftLoc = glGetUniformLocation(waterShader_->Program(), "yShift");
+    // camera & lighting come from the uniform blocks
+    waterShader_->Set("model", worldModel);
+
+    // the water is projected into the reflection texture through the camera of its last redraw
+    waterShader_->Set("reflectionViewProjection", reflectionViewProjection_);
 
     static GLfloat xShift = 0;
     static GLfloat yShift = 0;
@@ -382,176 +1077,237 @@ void TerrainEngine::DrawWater(const glm::mat4& view, const glm::mat4& projection
     xShift += deltaTime * waveSpeed_;
     yShift += deltaTime * waveSpeed_ * 0.8f;
 
-    glUniform1f(xShiftLoc, waveScale_ * sinf(xShift));
-    glUniform1f(yShiftLoc, waveScale_ * cosf(yShift));
-
-    GLint alphaLoc = glGetUniformLocation(waterShader_->Program(), "waterAlpha");
-    glUniform1f(alphaLoc, waterAlpha_);
-    glUniform1f(glGetUniformLocation(waterShader_->Program(), "time"), xShift);
-
-    // lighting
-    glUniform3f(glGetUniformLocation(waterShader_->Program(), "inNormal"), 0.0f, 1.0f, 0.0f);
-
-    GLint lightPosLoc = glGetUniformLocation(waterShader_->Program(), "light.position");
-    GLint viewPosLoc = glGetUniformLocation(waterShader_->Program(), "viewPos");
-    glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
-    glUniform3fv(viewPosLoc, 1, glm::value_ptr(viewPos));
-
-    // light properties
-    glm::vec3 diffuseColor = lightColor * glm::vec3(0.6f); // decrease the influence
-    glm::vec3 ambientColor = diffuseColor * glm::vec3(0.15f); // low influence
-    GLint lightAmbientLoc = glGetUniformLocation(waterShader_->Program(), "light.ambient");
-    GLint lightDiffuseLoc = glGetUniformLocation(waterShader_->Program(), "light.diffuse");
-    GLint lightSpecularLoc = glGetUniformLocation(waterShader_->Program(), "light.specular");
-    glUniform3fv(lightAmbientLoc, 1, glm::value_ptr(ambientColor));
-    glUniform3fv(lightDiffuseLoc, 1, glm::value_ptr(diffuseColor));
-    glUniform3f(lightSpecularLoc, 1.0f, 1.0f, 1.0f);
-
-    // material properties
-    GLint matAmbientLoc = glGetUniformLocation(waterShader_->Program(), "material.ambient");
-    GLint matDiffuseLoc = glGetUniformLocation(waterShader_->Program(), "material.diffuse");
-    GLint matSpecularLoc = glGetUniformLocation(waterShader_->Program(), "material.specular");
-    GLint matShineLoc = glGetUniformLocation(waterShader_->Program(), "material.shininess");
-    glUniform3fv(matAmbientLoc, 1, glm::value_ptr(waterColor));
-    glUniform3fv(matDiffuseLoc, 1, glm::value_ptr(waterColor));
-    glUniform3f(matSpecularLoc, specularStrength, specularStrength, specularStrength);
-    glUniform1f(matShineLoc, shininess);
+    waterShader_->Set("xShift", waveScale_ * sinf(xShift));
+    waterShader_->Set("yShift", waveScale_ * cosf(yShift));
+
+    waterShader_->Set("waterAlpha", waterAlpha_);
+    waterShader_->Set("time", xShift);
 
     // texture
-    glActiveTexture(GL_TEXTURE0 + 0);
-    glBindTexture(GL_TEXTURE_2D, waterTexture_);
+    glState_.BindTexture(0, waterTexture_);
+    glState_.BindTexture(1, reflectionTexture_);
 
     glDrawArrays(GL_TRIANGLES, 5 * 6, 6);
-    
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindVertexArray(0);
-
-    glDisable(GL_BLEND);
-    glDepthMask(GL_TRUE);
 }
 
 
-void TerrainEngine::DrawSkybox(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) const
+void TerrainEngine::DrawSkybox(const glm::mat4& model)
 {
-    skyboxShader_->Use();
-    glBindVertexArray(skyboxVAO_);
+    glState_.UseProgram(skyboxShader_->Program());
+    glState_.BindVertexArray(skyboxVAO_);
+    glState_.Enable(GL_DEPTH_TEST, true);
+    glState_.Enable(GL_CLIP_DISTANCE0, false);
 
-    // Get the uniform locations
-    GLint modelLoc = glGetUniformLocation(skyboxShader_->Program(), "model");
-    GLint viewLoc = glGetUniformLocation(skyboxShader_->Program(), "view");
-    GLint projLoc = glGetUniformLocation(skyboxShader_->Program(), "projection");
+    // view & projection come from the camera block
+    skyboxShader_->Set("model", model);
 
-    // Pass the matrices to the shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
+    glState_.BindTexture(0, skyboxTexture_);
 
-    for (int i = 0; i < 5; i++) {
-        glActiveTexture(GL_TEXTURE0 + 0);
-        glBindTexture(GL_TEXTURE_2D, skyboxTextures_[i]);
-        // erase border
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-        glTexParameterf(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-        glDrawArrays(GL_TRIANGLES, i * 6, 6);
-        glBindTexture(GL_TEXTURE_2D, 0);
-    }
-
-    glBindVertexArray(0);
+    // the shader puts the sky on the far plane, where the cleared depth still passes
+    glState_.DepthFunc(GL_LEQUAL);
+    // all faces but the bottom one, which is the water
+    glDrawArrays(GL_TRIANGLES, 0, 5 * 6);
+    frameStats_.skyboxDrawCalls++;
 }
 
-void TerrainEngine::DrawTerrain(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, GLfloat upY, const glm::vec3& viewPos, bool useLight) const
+void TerrainEngine::DrawTerrain(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, GLfloat upY, const glm::vec3& viewPos, bool useLight)
 {
-    terrainShader_->Use();
-    glBindVertexArray(terrainVAO_);
-
-    // Get the uniform locations
-    GLint modelLoc = glGetUniformLocation(terrainShader_->Program(), "model");
-    GLint viewLoc = glGetUniformLocation(terrainShader_->Program(), "view");
-    GLint projLoc = glGetUniformLocation(terrainShader_->Program(), "projection");
-
-    // Pass the matrices to the shader
-    glUniformMatrix4fv(modelLoc, 1, GL_FALSE, glm::value_ptr(model));
-    glUniformMatrix4fv(viewLoc, 1, GL_FALSE, glm::value_ptr(view));
-    glUniformMatrix4fv(projLoc, 1, GL_FALSE, glm::value_ptr(projection));
-
-    // scale of detail
-    GLint scaleLoc = glGetUniformLocation(terrainShader_->Program(), "detailScale");
-    glUniform1f(scaleLoc, 30.0f);
-
-    // terrain textures
-    GLint colorLoc = glGetUniformLocation(terrainShader_->Program(), "texColor");
-    GLint detailLoc = glGetUniformLocation(terrainShader_->Program(), "texDetail");
-    glUniform1i(colorLoc, 0);
-    glUniform1i(detailLoc, 1);
-
-    // y of world up
-    GLint upYLoc = glGetUniformLocation(terrainShader_->Program(), "upY");
-    glUniform1f(upYLoc, upY);
-
-    // lighting
-    if (useLight) {
-        glUniform1i(glGetUniformLocation(terrainShader_->Program(), "useLight"), 1);
-        glUniform3f(glGetUniformLocation(terrainShader_->Program(), "inNormal"), 0.0f, 1.0f, 0.0f);
-
-        GLint lightPosLoc = glGetUniformLocation(terrainShader_->Program(), "light.position");
-        GLint viewPosLoc = glGetUniformLocation(terrainShader_->Program(), "viewPos");
-        glUniform3fv(lightPosLoc, 1, glm::value_ptr(lightPos));
-        glUniform3fv(viewPosLoc, 1, glm::value_ptr(viewPos));
-
-        // light properties
-        glm::vec3 diffuseColor = lightColor * glm::vec3(1); // decrease the influence
-        glm::vec3 ambientColor = diffuseColor * glm::vec3(0.4f); // low influence
-        GLint lightAmbientLoc = glGetUniformLocation(terrainShader_->Program(), "light.ambient");
-        GLint lightDiffuseLoc = glGetUniformLocation(terrainShader_->Program(), "light.diffuse");
-        GLint lightSpecularLoc = glGetUniformLocation(terrainShader_->Program(), "light.specular");
-        glUniform3fv(lightAmbientLoc, 1, glm::value_ptr(ambientColor));
-        glUniform3fv(lightDiffuseLoc, 1, glm::value_ptr(diffuseColor));
-        glUniform3f(lightSpecularLoc, 1.0f, 1.0f, 1.0f);
-
-        // material properties
-        GLint matAmbientLoc = glGetUniformLocation(terrainShader_->Program(), "material.ambient");
-        GLint matDiffuseLoc = glGetUniformLocation(terrainShader_->Program(), "material.diffuse");
-        GLint matSpecularLoc = glGetUniformLocation(terrainShader_->Program(), "material.specular");
-        GLint matShineLoc = glGetUniformLocation(terrainShader_->Program(), "material.shininess");
-        glUniform3fv(matAmbientLoc, 1, glm::value_ptr(terranColor));
-        glUniform3fv(matDiffuseLoc, 1, glm::value_ptr(terranColor));
-        glUniform3f(matSpecularLoc, specularStrength * 4, specularStrength * 4, specularStrength * 4);
-        glUniform1f(matShineLoc, shininess);
-    } else {
-        glUniform1i(glGetUniformLocation(terrainShader_->Program(), "useLight"), 0);
+    // fall back to the mesh when a renderer is not available
+    TerrainRenderMode mode = renderMode_;
+    if ((mode == TerrainRenderMode::CDLOD && (cdlodShader_ == nullptr || cdlod_.Empty()))
+        || (mode == TerrainRenderMode::CLIPMAP && (clipmapShader_ == nullptr || clipmap_.Empty()))
+        || (mode == TerrainRenderMode::PATCHES && (patchShader_ == nullptr || normalTexture_ == 0))
+        || (mode == TerrainRenderMode::TESSELLATION && (tessShader_ == nullptr || tessPatchCount_ == 0))
+        || (mode == TerrainRenderMode::STREAMED && tileStreamer_ == nullptr)) {
+        mode = TerrainRenderMode::MESH;
+    }
+    const Shader& shader = mode == TerrainRenderMode::CDLOD ? *cdlodShader_
+        : mode == TerrainRenderMode::CLIPMAP ? *clipmapShader_
+        : mode == TerrainRenderMode::PATCHES ? *patchShader_
+        : mode == TerrainRenderMode::TESSELLATION ? *tessShader_ : *terrainShader_;
+
+    glState_.UseProgram(shader.Program());
+    glState_.Enable(GL_DEPTH_TEST, true);
+    glState_.DepthFunc(GL_LESS);
+
+    // view, projection, viewPos & lighting come from the uniform blocks
+    shader.Set("model", model);
+
+    // keep the side of the water plane (world y = 0) that "world up" points to;
+    // clipped in the vertex stage so the fragment shader keeps early depth testing
+    glState_.Enable(GL_CLIP_DISTANCE0, true);
+    shader.Set("clipPlane", glm::vec4(0.0f, upY, 0.0f, 0.0f));
+
+    shader.Set("useLight", useLight ? 1 : 0);
+    if (mode == TerrainRenderMode::MESH || mode == TerrainRenderMode::PATCHES) {
+        // grid position of a vertex is implicit in its index
+        shader.Set("gridSize", glm::ivec2(mapWidth_, mapHeight_));
     }
 
     // assign texutres
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, terrainTextures_[0]);
-
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, terrainTextures_[1]);
+    glState_.BindTexture(0, terrainTextures_[0]);
+    glState_.BindTexture(1, terrainTextures_[1]);
+
+    size_t triangles = 0;
+    if (mode == TerrainRenderMode::CDLOD) {
+        glState_.BindTexture(2, heightTexture_);
+
+        // viewport height / (2 tan(fovy / 2)): projected size in pixels of a unit at unit distance
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        cdlod_.Select(model, projection * view, viewPos, projection[1][1] * GLfloat(viewport[3]) / 2);
+        cdlod_.Draw(shader, glState_);
+        triangles = cdlod_.LastStats().triangles;
+        frameStats_.drawCalls += cdlod_.LastStats().selectedNodes;
+    } else if (mode == TerrainRenderMode::CLIPMAP) {
+        clipmap_.Update(model, viewPos);
+        clipmap_.Draw(shader, glState_, 2);
+        triangles = clipmap_.LastStats().triangles;
+        frameStats_.drawCalls += ClipmapTerrain::kLevels;
+    } else if (mode == TerrainRenderMode::TESSELLATION) {
+        glState_.BindTexture(2, heightTexture_);
+
+        // patches are culled and subdivided in the control shader, in terrain space
+        const Frustum frustum = Frustum::FromMatrix(projection * view * model);
+        GLint viewport[4];
+        glGetIntegerv(GL_VIEWPORT, viewport);
+        shader.Set("mapSize", glm::vec2(GLfloat(mapWidth_), GLfloat(mapHeight_)));
+        shader.Set(shader.Uniform("frustumPlanes"), frustum.planes, Frustum::PLANE_NUM);
+        shader.Set("viewportHeight", GLfloat(viewport[3]));
+        shader.Set("pixelsPerEdge", tessPixelsPerEdge_);
+
+        // the generated primitives are counted for the main pass only
+        const bool countPrimitives = upY > 0;
+        if (countPrimitives) {
+            tessPrimitives_.Begin();
+        }
+        glState_.PatchVertices(4);
+        glState_.BindVertexArray(tessVAO_);
+        glDrawArrays(GL_PATCHES, 0, 4 * tessPatchCount_);
+        if (countPrimitives) {
+            tessPrimitives_.End();
+        }
+        frameStats_.drawCalls++;
+        frameStats_.tessPatches += size_t(tessPatchCount_);
+    } else if (mode == TerrainRenderMode::STREAMED) {
+        const GLint samples = tileStreamer_->Source().TileSize() + 1;
+        shader.Set("gridSize", glm::ivec2(samples, samples));
+
+        // tiles are culled one by one, in terrain space like the chunks
+        const Frustum frustum = Frustum::FromMatrix(projection * view * model);
+        for (const auto& entry : streamedTiles_) {
+            const StreamedTile& tile = entry.second;
+            frameStats_.chunksTested++;
+            if (frustumCulling_ && !frustum.IntersectsBox(tile.boxMin, tile.boxMax)) {
+                continue;
+            }
+            shader.Set("model", model * tile.model);
+            glState_.BindVertexArray(tile.vao);
+            glDrawElements(GL_TRIANGLES, tileIndexCount_, GL_UNSIGNED_INT, (GLvoid*)0);
+            frameStats_.chunksDrawn++;
+            frameStats_.drawCalls++;
+            triangles += size_t(tileIndexCount_) / 3;
+        }
+    } else if (gpuCulling_ && gpuCuller_.Ready()) {
+        // the chunks are culled and compacted into draw commands by a compute shader;
+        // the main pass is also tested against the depth of the last one
+        const int pass = upY < 0 ? 1 : 0;
+        const bool patches = mode == TerrainRenderMode::PATCHES;
+        gpuCuller_.Cull(glState_, pass, projection * view * model, model, frustumCulling_, pass == 0,
+            patches ? patchIndexCount_ : 0);
+        gpuCulled_ = gpuCulled_ || pass == 0;
+
+        // the dispatch used its own program; the uniforms set above stay with the terrain's
+        glState_.UseProgram(shader.Program());
+        if (patches) {
+            glState_.BindTexture(2, heightTexture_);
+            glState_.BindTexture(3, normalTexture_);
+            glState_.BindStorageBuffer(0, chunkOriginSSBO_);
+            shader.Set("patchSize", GLint(terrainChunkSize));
+            glState_.BindVertexArray(patchVAO_);
+        } else {
+            glState_.BindVertexArray(terrainVAO_);
+        }
+        gpuCuller_.Draw(glState_, pass);
+        frameStats_.drawCalls++;
+
+        // the CPU only learns the outcome from the counters read back since
+        const GpuChunkCuller::PassCounters& counters = gpuCuller_.LastStats().passes[pass];
+        frameStats_.gpuCulled = true;
+        frameStats_.chunksDrawn += counters.drawn;
+        triangles = counters.indices / 3;
+    } else {
+        // chunks intersecting the frustum, tested in terrain space so the mirrored pass is covered too
+        visibleChunks_.clear();
+        if (frustumCulling_) {
+            ChunkBvh::CullStats cull;
+            chunkBvh_.Cull(Frustum::FromMatrix(projection * view * model), visibleChunks_, cull);
+            frameStats_.chunksTested += cull.nodesTested;
+        } else {
+            for (int i = 0; i < int(terrainChunks_.size()); i++) {
+                visibleChunks_.push_back(i);
+            }
+        }
+        frameStats_.chunksDrawn += visibleChunks_.size();
+
+        // one command per run of consecutive chunks: consecutive instances of the patch
+        // (the chunk origins are read at gl_BaseInstance + gl_InstanceID), or contiguous indices
+        drawCommands_.clear();
+        for (size_t i = 0; i < visibleChunks_.size(); ) {
+            const TerrainChunk& first = terrainChunks_[visibleChunks_[i]];
+            GLuint count = GLuint(first.indexCount);
+            size_t j = i + 1;
+            for (; j < visibleChunks_.size() && visibleChunks_[j] == visibleChunks_[j - 1] + 1; j++) {
+                count += GLuint(terrainChunks_[visibleChunks_[j]].indexCount);
+            }
+            if (mode == TerrainRenderMode::PATCHES) {
+                drawCommands_.push_back({ GLuint(patchIndexCount_), GLuint(j - i), 0, 0, GLuint(visibleChunks_[i]) });
+            } else {
+                drawCommands_.push_back({ count, 1, first.firstIndex, 0, 0 });
+            }
+            triangles += size_t(drawCommands_.back().count) * drawCommands_.back().instanceCount / 3;
+            i = j;
+        }
 
-    glDrawArrays(GL_TRIANGLES, 0, terrainDrawSize_);
+        if (mode == TerrainRenderMode::PATCHES) {
+            glState_.BindTexture(2, heightTexture_);
+            glState_.BindTexture(3, normalTexture_);
+            glState_.BindStorageBuffer(0, chunkOriginSSBO_);
+            shader.Set("patchSize", GLint(terrainChunkSize));
+            glState_.BindVertexArray(patchVAO_);
+        } else {
+            glState_.BindVertexArray(terrainVAO_);
+        }
+        SubmitDrawCommands(upY < 0 ? 1 : 0);
+    }
 
-    glActiveTexture(GL_TEXTURE0);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glActiveTexture(GL_TEXTURE1);
-    glBindTexture(GL_TEXTURE_2D, 0);
-    glBindVertexArray(0);
+    frameStats_.trianglesSubmitted += triangles;
+    if (upY < 0) {
+        frameStats_.reflectionTriangles += triangles;
+    }
 }
 
-GLuint TerrainEngine::LoadTexture(const char* src, bool repeat)
+void TerrainEngine::SubmitDrawCommands(int pass)
 {
-    auto flags = SOIL_FLAG_MIPMAPS | SOIL_FLAG_INVERT_Y | SOIL_FLAG_NTSC_SAFE_RGB | SOIL_FLAG_COMPRESS_TO_DXT;
-    if (repeat) {
-        flags |= SOIL_FLAG_TEXTURE_REPEATS;
+    if (drawCommands_.empty()) {
+        return;
+    }
+    frameStats_.drawCommands += drawCommands_.size();
+
+    if (multiDrawIndirect_) {
+        // each pass has its own region, the commands of the main pass are not overwritten by the mirrored one
+        const GLintptr offset = GLintptr(pass) * GLintptr(terrainChunks_.size() * sizeof(DrawCommand));
+        glNamedBufferSubData(indirectBuffer_, offset, GLsizeiptr(drawCommands_.size() * sizeof(DrawCommand)), drawCommands_.data());
+        glState_.BindDrawIndirectBuffer(indirectBuffer_);
+        glMultiDrawElementsIndirect(GL_TRIANGLES, GL_UNSIGNED_INT, (GLvoid*)offset, GLsizei(drawCommands_.size()), 0);
+        frameStats_.drawCalls++;
+        return;
+    }
+    for (const DrawCommand& command : drawCommands_) {
+        glDrawElementsInstancedBaseInstance(GL_TRIANGLES, GLsizei(command.count), GL_UNSIGNED_INT,
+            (GLvoid*)(size_t(command.firstIndex) * sizeof(GLuint)), GLsizei(command.instanceCount), command.baseInstance);
+        frameStats_.drawCalls++;
     }
-    auto res = SOIL_load_OGL_texture(
-        src,
-        SOIL_LOAD_AUTO,
-        SOIL_CREATE_NEW_ID,
-        flags
-    );
-    // to fix SOIL not unbind texture after loading flaw
-    glBindTexture(GL_TEXTURE_2D, 0);
-    return res;
 }
 
 } /* namespace cg */
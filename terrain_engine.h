@@ -3,21 +3,100 @@
 #include <glad/glad.h>
 #include <glm/glm.hpp>
 
-#include <trimesh2/TriMesh.h>
-
 #include "shader.hpp"
+#include "cdlod_terrain.h"
+#include "clipmap_terrain.h"
+#include "chunk_bvh.h"
+#include "gl_handle.hpp"
+#include "gl_state.hpp"
+#include "gpu_culler.h"
+#include "gpu_timer.hpp"
+#include "terrain_file.h"
+#include "texture_loader.h"
+#include "tile_streamer.h"
+#include "uniform_blocks.hpp"
 
 namespace cg
 {
 
+/* Memory and vertex cache figures of the uploaded terrain mesh */
+struct TerrainMeshStats
+{
+	size_t vertexCount = 0;
+	size_t indexCount = 0;
+	size_t vertexBytes = 0;
+	size_t indexBytes = 0;
+	size_t chunkCount = 0;      // culling chunks, see TerrainEngine::terrainChunkSize
+	double acmr = 0.0;          // transformed vertices per triangle (FIFO cache model)
+	double cacheHitRate = 0.0;  // fraction of indices hitting the post-transform cache
+
+	// vertex-buffer-free patches: geometry is one patch plus the chunk origins,
+	// heights & normals are textures (the height texture is shared with CDLOD)
+	size_t patchBytes = 0;
+	size_t heightTextureBytes = 0;
+	size_t normalTextureBytes = 0;
+
+	// load time, CPU side, in milliseconds
+	double buildMilliseconds = 0.0;     // heights to quantized vertices & normals, shared
+	double meshMilliseconds = 0.0;      // chunk index buffer, VBO & IBO upload
+	double patchMilliseconds = 0.0;     // normal texture & patch upload
+	double loadMilliseconds = 0.0;      // heightmap decoded (image) or mapped (terrain file)
+	bool prebuilt = false;              // vertices, normals & indices came from a terrain file
+	bool gpuBuilt = false;              // vertices & normals generated on upload by a compute shader
+};
+
+/* Terrain work submitted since the last BeginFrame(), summed over the
+ * main and the mirrored (reflection) passes
+ */
+struct TerrainFrameStats
+{
+	size_t chunksTested = 0;           // BVH nodes tested against the frustum, inner nodes included
+	size_t chunksDrawn = 0;
+	size_t trianglesSubmitted = 0;
+	size_t reflectionTriangles = 0;    // the mirrored pass' share of trianglesSubmitted
+	bool reflectionReused = false;     // the reflection texture was reprojected, not redrawn
+	size_t drawCalls = 0;
+	size_t drawCommands = 0;           // chunk draws of MESH & PATCHES, in one multi-draw per pass when indirect
+	bool gpuCulled = false;            // MESH & PATCHES chunks were culled on the GPU: chunksDrawn and the
+	                                   // triangles are those of the last counters read back, a few frames old
+	size_t tessPatches = 0;            // coarse patches submitted by the tessellation path
+	size_t skyboxDrawCalls = 0;
+	size_t uniformBlockUpdates = 0;
+};
+
+/* How DrawTerrain renders the land */
+enum class TerrainRenderMode
+{
+	MESH,     // full resolution indexed mesh
+	CDLOD,    // chunked quadtree LOD with geomorphing
+	CLIPMAP,  // camera-centered geometry clipmap
+	PATCHES,  // full resolution, one instanced patch per chunk reading height & normal textures
+	TESSELLATION, // coarse patch grid subdivided on the GPU by projected edge length
+	STREAMED  // tiles of a world larger than memory, streamed around the camera (see EnableTileStreaming)
+};
+
 class TerrainEngine
 {
 public:
 	static constexpr glm::vec3 skyboxSize{400.0f, 210.0f, 400.0f};
 	static constexpr glm::vec3 terrainSize{30.0f, 7.0f, 30.0f};
 
+	// quads per side of a frustum culling chunk of the terrain mesh
+	static constexpr int terrainChunkSize = 32;
+
+	// the tessellation patch grid has at most this many patches per side,
+	// patches grow (from terrainChunkSize samples, doubling) with the heightmap
+	static constexpr int tessMaxPatchesPerSide = 64;
+
+	// vertex buffers built per frame for streamed tiles that became resident,
+	// bounds the hitch of crossing into a new tile
+	static constexpr int streamedTileBuildsPerFrame = 4;
+
 	static constexpr glm::vec3 lightPos{-200, 115, 120};
 
+	// unsharp mask of the detail texture's mipmaps, keeps it from fading out with distance
+	static constexpr GLfloat detailSharpen = 0.5f;
+
 	static constexpr GLsizei cubeVertNum = 36;
 	static constexpr GLsizei cubeAttrNum = 5;
 	static constexpr GLsizei lampAttrNum = 6;
@@ -43,70 +122,314 @@ public:
 	int HeightmapWidth() const { return mapWidth_; }
 	int HeightmapHeight() const { return mapHeight_; }
 	int HeightmapChannels() const { return mapChannels_; }
+	/* The terrain file mapped by MapTerrainFile(), or null */
+	std::shared_ptr<const TerrainFile> MappedTerrainFile() const { return terrainFile_; }
 	GLuint WaterTexture() const { return waterTexture_; }
 	GLuint TerrainTexture(int idx) const { return terrainTextures_[idx]; }
-	GLuint SkyboxTexture(int idx) const { return skyboxTextures_[idx]; }
+	GLuint SkyboxTexture() const { return skyboxTexture_; }
+	/* Sky pixels shaded by the main pass, averaged since the last call to ResetSkyboxSamples() */
+	double SkyboxSamples() const { return skyboxSamples_.AverageResult(); }
+	void ResetSkyboxSamples() { skyboxSamples_.Reset(); }
+	/* Primitives generated by the tessellator in the main pass, averaged since the last call to ResetTessPrimitives() */
+	double TessPrimitives() const { return tessPrimitives_.AverageResult(); }
+	void ResetTessPrimitives() { tessPrimitives_.Reset(); }
+	GLsizei TessPatchCount() const { return tessPatchCount_; }
+	GLfloat TessPixelsPerEdge() const { return tessPixelsPerEdge_; }
+	const TerrainMeshStats& MeshStats() const { return meshStats_; }
+	GLuint HeightTexture() const { return heightTexture_; }
+	TerrainRenderMode RenderMode() const { return renderMode_; }
+	const CdlodTerrain& Cdlod() const { return cdlod_; }
+	const ClipmapTerrain& Clipmap() const { return clipmap_; }
+	const TerrainFrameStats& FrameStats() const { return frameStats_; }
+	bool FrustumCulling() const { return frustumCulling_; }
+	bool MultiDrawIndirect() const { return multiDrawIndirect_; }
+	bool GpuCulling() const { return gpuCulling_; }
+	bool GpuMeshBuild() const { return gpuMeshBuild_; }
+	/* Counters of the GPU culling passes, the most recent read back */
+	const GpuChunkCuller::Stats& GpuCullStats() const { return gpuCuller_.LastStats(); }
+	/* GL state calls issued and skipped by the draws since BeginFrame() */
+	const GlState::Stats& GlCalls() const { return glState_.GetStats(); }
+	bool StateCache() const { return glState_.Enabled(); }
+	/* nullptr until EnableTileStreaming() */
+	const TileStreamer* Streamer() const { return tileStreamer_.get(); }
+	size_t StreamedTileCount() const { return streamedTiles_.size(); }
+	size_t StreamedTileBytes() const;
+	/* Textures still decoding or uploading, see the Load*Async() functions */
+	bool TexturesPending() const { return textureLoader_.Pending(); }
+	const AsyncTextureLoader::Stats& TextureStats() const { return textureLoader_.GetStats(); }
+	unsigned TextureThreads() const { return textureLoader_.Threads(); }
+	const std::vector<TextureTiming>& TextureTimings() const { return textureLoader_.Timings(); }
 
 	GLfloat WaveSpeed() const { return waveSpeed_; }
 	GLfloat WaveScale() const { return waveScale_; }
 	GLfloat WaterAlpha() const { return waterAlpha_; }
+	GLfloat ReflectionScale() const { return reflectionScale_; }
+	GLuint ReflectionTexture() const { return reflectionTexture_; }
+	int ReflectionInterval() const { return reflectionInterval_; }
 
 	/* Setters */
 	void SetWaveSpeed(GLfloat newSpeed) { waveSpeed_ = newSpeed; }
 	void SetWaveScale(GLfloat newScale) { waveScale_ = newScale; }
 	void SetWaterAlpha(GLfloat newAlpha) { waterAlpha_ = newAlpha; }
+	void SetReflectionScale(GLfloat scale) { reflectionScale_ = scale; }
+	/* Redraw the reflection at least every `frames` frames (1: every frame, 0: only on camera
+	 * motion), or as soon as the camera moved `distance` or turned `degrees` since the last
+	 * redraw; in between the last one is reprojected to the current view.
+	 */
+	void SetReflectionUpdate(int frames, GLfloat distance, GLfloat degrees)
+	{
+		reflectionInterval_ = frames;
+		reflectionMaxMove_ = distance;
+		reflectionMaxTurn_ = degrees;
+	}
+	void InvalidateReflection() { reflectionValid_ = false; }
+	void SetRenderMode(TerrainRenderMode mode) { renderMode_ = mode; reflectionValid_ = false; }
+	void SetLodPixelError(GLfloat pixels) { cdlod_.SetPixelError(pixels); }
+	/* Target projected length, in pixels, of the edges the tessellator generates */
+	void SetTessPixelsPerEdge(GLfloat pixels) { tessPixelsPerEdge_ = pixels; }
+	void SetFrustumCulling(bool enable) { frustumCulling_ = enable; }
+	/* On: the visible chunks of MESH & PATCHES are drawn with one glMultiDrawElementsIndirect
+	 * per pass; off: with one draw call per run of consecutive chunks
+	 */
+	void SetMultiDrawIndirect(bool enable) { multiDrawIndirect_ = enable; }
+	/* On: MESH & PATCHES chunks are culled against the frustum and last frame's depth
+	 * by a compute shader, and drawn with the count it wrote (see GpuChunkCuller);
+	 * needs InstallTerrainCullShaders()
+	 */
+	void SetGpuCulling(bool enable) { gpuCulling_ = enable; }
+	/* On: the vertices & normals of the heightmaps loaded from now on are generated on upload
+	 * by a compute shader reading the height texture, instead of on the CPU by PrepareTerrain();
+	 * needs InstallTerrainMeshShader(). Prebuilt vertices of a terrain file are used as they are.
+	 */
+	void SetGpuMeshBuild(bool enable) { gpuMeshBuild_ = enable; }
+	/* Off: the draws issue every state call, redundant or not */
+	void SetStateCache(bool enable) { glState_.SetEnabled(enable); }
+	/* Draw the tiles of `source` in STREAMED mode, sampled at the loaded heightmap's
+	 * resolution and centered on it. At most budgetBytes of heights stay in memory;
+	 * the tiles within `radius` tiles of the camera get vertex buffers.
+	 */
+	bool EnableTileStreaming(std::unique_ptr<TileSource> source, size_t budgetBytes, int radius);
+	/* Camera velocity (world units per second) and view direction, for prefetching the
+	 * tiles the camera is heading to; `seconds` of the path are prefetched
+	 */
+	void SetCameraMotion(const glm::vec3& velocity, const glm::vec3& front) { cameraVelocity_ = velocity; cameraFront_ = front; }
+	void SetTilePrefetch(float seconds) { if (tileStreamer_ != nullptr) tileStreamer_->SetLookahead(seconds); }
+	/* Keep the textures loaded from now on compressed, with their mipmaps, in directory dir (see AsyncTextureLoader) */
+	bool EnableTextureCache(const std::string& dir) { return textureLoader_.EnableCache(dir); }
+	/* Mipmap filter of the textures loaded from now on (see MipmapBuilder) */
+	void SetTextureMipFilter(MipmapBuilder::Filter filter) { textureLoader_.SetMipFilter(filter); }
 
 	/* load images */
 	bool LoadHeightmap(const char* heightmapFile);
+	/* Same as LoadHeightmap() from a mapped binary terrain file (see terrain_file.h),
+	 * uploading its prebuilt vertices, normals and indices straight from the mapping
+	 */
+	bool LoadTerrainFile(const char* terrainFile);
+	/* The steps of the two above, for running them apart (see LoadGraph): ReadHeightmap()
+	 * or MapTerrainFile(), then PrepareTerrain() build everything on the CPU and may run
+	 * on any thread; UploadTerrain() creates the GL objects on the GL thread
+	 */
+	bool ReadHeightmap(const char* heightmapFile);
+	bool MapTerrainFile(const char* terrainFile);
+	bool PrepareTerrain();
+	bool UploadTerrain();
+	/* Replace the heights of samples [x0, x0 + width) x [z0, z0 + height) by `samples` (row by row,
+	 * width per row) and regenerate the vertices and normals of that region only, on the GPU
+	 * (needs InstallTerrainMeshShader()). The bounds of the culling chunks, CDLOD nodes and
+	 * tessellation patches over the region are refit, and the clipmap reloaded.
+	 */
+	bool UpdateHeightmap(int x0, int z0, int width, int height, const unsigned char* samples);
 	bool LoadSkybox(const char* const skyboxFiles[5]);
 	bool LoadWaterTexture(const char* waterFile);
 	bool LoadTerrainTexture(const char* landFile, const char* detailFile);
+	/* Same as above without waiting: the textures are plain colors until their images
+	 * are decoded and uploaded, BeginFrame() swaps them in. Errors are only reported.
+	 */
+	void LoadSkyboxAsync(const char* const skyboxFiles[5]);
+	void LoadWaterTextureAsync(const char* waterFile);
+	void LoadTerrainTextureAsync(const char* landFile, const char* detailFile);
 
 	/* load shaders */
 	bool InstallSkyboxShaders(const char* vert, const char* frag);
 	bool InstallWaterShaders(const char* vert, const char* frag);
 	bool InstallTerrainShaders(const char* vert, const char* frag);
+	bool InstallTerrainLodShaders(const char* vert, const char* frag);
+	bool InstallTerrainClipmapShaders(const char* vert, const char* frag);
+	bool InstallTerrainPatchShaders(const char* vert, const char* frag);
+	bool InstallTerrainTessShaders(const char* vert, const char* tesc, const char* tese, const char* frag);
+	/* compute shaders of the GPU culling: chunk culling and depth pyramid reduction */
+	bool InstallTerrainCullShaders(const char* cull, const char* pyramid);
+	/* compute shader generating the terrain vertices, see SetGpuMeshBuild() & UpdateHeightmap() */
+	bool InstallTerrainMeshShader(const char* comp);
 	bool InstallLampShaders(const char* vert, const char* frag);
 
 	/* drawing */
-	void DrawSkybox(const glm::mat4& view, const glm::mat4& projection) const;
-	void DrawWater(const glm::mat4& view, const glm::mat4& projection, GLfloat deltaTime, const glm::vec3& viewPos) const;
-	void DrawTerrain(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos) const;
-	void DrawLamp(const glm::mat4& view, const glm::mat4& projection) const;
+	/* Start a frame: reset the frame statistics, swap in the textures loaded since the last
+	 * frame and upload the camera block shared by all programs
+	 */
+	void BeginFrame(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos);
+	/* after the opaque geometry and the water: the sky only shades the pixels left uncovered;
+	 * the camera is the one of BeginFrame()
+	 */
+	void DrawSkybox();
+	void DrawWater(const glm::mat4& view, const glm::mat4& projection, GLfloat deltaTime, const glm::vec3& viewPos);
+	void DrawTerrain(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos);
+	void DrawLamp(const glm::mat4& view, const glm::mat4& projection);
+	/* End a frame, after everything opaque: with GPU culling, build the depth pyramid the
+	 * next frame tests against and queue the read back of the culling counters
+	 */
+	void EndFrame();
 
 private:
 	GLfloat waveSpeed_;
 	GLfloat waveScale_;
 	GLfloat waterAlpha_;
 
+	// mirrored sky & terrain, rendered at reflectionScale_ of the viewport size
+	GLfloat reflectionScale_;
+	GlFramebuffer reflectionFBO_;
+	GlTexture reflectionTexture_;
+	GlRenderbuffer reflectionDepth_;
+	GLsizei reflectionWidth_;
+	GLsizei reflectionHeight_;
+
+	// reflection reuse: camera of the last redraw and the update policy
+	bool reflectionValid_;
+	int reflectionAge_;
+	glm::mat4 reflectionView_;
+	glm::mat4 reflectionProjection_;
+	glm::mat4 reflectionViewProjection_;
+	glm::vec3 reflectionViewPos_;
+	int reflectionInterval_;
+	GLfloat reflectionMaxMove_;
+	GLfloat reflectionMaxTurn_;
+
 	int mapWidth_;
 	int mapHeight_; 
 	int mapChannels_;
-	unsigned char* heightmap_;
-	trimesh::TriMesh terrain_;
-	int terrainDrawSize_;
+	const unsigned char* heightmap_;
+	std::shared_ptr<TerrainFile> terrainFile_;   // mapped terrain file the heights live in, if any
+	std::unique_ptr<unsigned char[]> editedHeights_;   // copy of the mapped heights, once edited
+	bool gpuMeshBuild_;
+	GLsizei terrainIndexCount_;
+	TerrainMeshStats meshStats_;
+	// CPU side of the terrain between PrepareTerrain() and UploadTerrain()
+	struct TerrainBuild;
+	std::unique_ptr<TerrainBuild> terrainBuild_;
+	TerrainFrameStats frameStats_;
+	// program, bindings & fixed function state last set by the draws
+	GlState glState_;
+
+	// uniform buffers, see uniform_blocks.hpp
+	GlBuffer cameraUBO_;
+	GlBuffer lightingUBOs_[2];
+	CameraBlock cameraBlock_;
+	bool cameraValid_;
+
+	GlVertexArray lampVAO_;
+	GlBuffer lampVBO_;
+
+	GlVertexArray skyboxVAO_;
+	GlBuffer skyboxVBO_;
+
+	GlVertexArray terrainVAO_;
+	GlBuffer terrainVBO_;
+	GlBuffer terrainEBO_;
+
+	// index range of a chunk; chunks are stored in BVH leaf order
+	struct TerrainChunk
+	{
+		GLuint firstIndex;
+		GLsizei indexCount;
+	};
+	std::vector<TerrainChunk> terrainChunks_;
+	ChunkBvh chunkBvh_;
+	std::vector<int> visibleChunks_;
+	bool frustumCulling_;
+
+	// layout of GL_DRAW_INDIRECT_BUFFER commands for glMultiDrawElementsIndirect
+	struct DrawCommand
+	{
+		GLuint count;
+		GLuint instanceCount;
+		GLuint firstIndex;
+		GLint baseVertex;
+		GLuint baseInstance;
+	};
+	// commands of the visible chunks; the indirect buffer has room for one per chunk and pass
+	std::vector<DrawCommand> drawCommands_;
+	GlBuffer indirectBuffer_;
+	bool multiDrawIndirect_;
+
+	// chunks culled on the GPU instead, against the frustum and the main pass' depth
+	GpuChunkCuller gpuCuller_;
+	bool gpuCulling_;
+	bool gpuCulled_;                  // the main pass was culled on the GPU this frame
+	glm::mat4 frameViewProjection_;   // camera of the main pass, for the depth pyramid
+
+	GlTexture heightTexture_;
+	GlTexture normalTexture_;
+
+	// PATCHES mode: a chunk-sized grid patch (indices only) and the chunk origins in leaf order
+	GlVertexArray patchVAO_;
+	GlBuffer patchEBO_;
+	GlBuffer chunkOriginSSBO_;
+	GLsizei patchIndexCount_;
 
-	GLuint lampVAO_;
-	GLuint lampVBO_;
+	// TESSELLATION mode: 4 corners per coarse patch (GL_PATCHES)
+	GlVertexArray tessVAO_;
+	GlBuffer tessVBO_;
+	int tessPatchSize_;       // quads per side of a patch
+	GLsizei tessPatchCount_;
+	GLfloat tessPixelsPerEdge_;
+	GpuQuery tessPrimitives_;
 
-	GLuint skyboxVAO_;
-	GLuint skyboxVBO_;
+	// STREAMED mode: one VBO per wanted resident tile, all sharing one index buffer
+	struct StreamedTile
+	{
+		GlVertexArray vao;
+		GlBuffer vbo;
+		glm::mat4 model;     // tile grid to terrain space
+		glm::vec3 boxMin;    // bounds in terrain space
+		glm::vec3 boxMax;
+	};
+	std::unique_ptr<TileStreamer> tileStreamer_;
+	std::unordered_map<uint64_t, StreamedTile> streamedTiles_;
+	GlBuffer tileEBO_;
+	GLsizei tileIndexCount_;
+	glm::vec3 cameraVelocity_;
+	glm::vec3 cameraFront_;
 
-	GLuint terrainVAO_;
-	GLuint terrainVBO_;
+	TerrainRenderMode renderMode_;
+	CdlodTerrain cdlod_;
+	ClipmapTerrain clipmap_;
 
-	GLuint waterTexture_;
-	GLuint terrainTextures_[2];
-	GLuint skyboxTextures_[5];
+	GlTexture waterTexture_;
+	GlTexture terrainTextures_[2];
+	GlTexture skyboxTexture_;
+	GpuQuery skyboxSamples_;
+	AsyncTextureLoader textureLoader_;
 
 	std::unique_ptr<Shader> lampShader_;
 	std::unique_ptr<Shader> skyboxShader_;
 	std::unique_ptr<Shader> waterShader_;
 	std::unique_ptr<Shader> terrainShader_;
+	std::unique_ptr<Shader> cdlodShader_;
+	std::unique_ptr<Shader> clipmapShader_;
+	std::unique_ptr<Shader> patchShader_;
+	std::unique_ptr<Shader> tessShader_;
+	std::unique_ptr<Shader> meshShader_;
 
-	GLuint LoadTexture(const char* src, bool repeat = false);
-	void DrawSkybox(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection) const;
-	void DrawTerrain(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, GLfloat upY, const glm::vec3& viewPos, bool useLight) const;
+	bool ResizeReflection(GLsizei width, GLsizei height);
+	void UpdateStreamedTiles(const glm::vec3& viewPos);
+	bool ReflectionNeedsUpdate(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos) const;
+	void DrawReflection(const glm::mat4& view, const glm::mat4& projection, const glm::vec3& viewPos);
+	void DrawSkybox(const glm::mat4& model);
+	void DrawTerrain(const glm::mat4& model, const glm::mat4& view, const glm::mat4& projection, GLfloat upY, const glm::vec3& viewPos, bool useLight);
+	void SubmitDrawCommands(int pass);
+	bool GenerateTerrainMesh(int x0, int z0, int x1, int z1);
+	// bounds of the chunks, CDLOD nodes and tessellation patches over samples [x0, x1) x [z0, z1)
+	void RefitTerrainBounds(int x0, int z0, int x1, int z1);
 };
 
 } /* namespace cg */
@@ -0,0 +1,262 @@
+#include "terrain_file.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#include "file_util.hpp"
+
+namespace cg
+{
+
+namespace
+{
+
+constexpr char kMagic[4] = {'C', 'G', 'T', 'F'};
+
+uint64_t Align(uint64_t offset)
+{
+    return (offset + kTerrainFileAlignment - 1) / kTerrainFileAlignment * kTerrainFileAlignment;
+}
+
+// zero padding up to `offset`, then the payload
+bool WriteAt(std::ofstream& out, uint64_t offset, const void* data, size_t bytes)
+{
+    static const char zeros[kTerrainFileAlignment] = {};
+    uint64_t position = uint64_t(out.tellp());
+    while (position < offset) {
+        const size_t pad = size_t(std::min<uint64_t>(offset - position, sizeof(zeros)));
+        out.write(zeros, std::streamsize(pad));
+        position += pad;
+    }
+    out.write(static_cast<const char*>(data), std::streamsize(bytes));
+    return bool(out);
+}
+
+} /* anonymous namespace */
+
+std::shared_ptr<TerrainFile> TerrainFile::Open(const std::string& filename)
+{
+    std::shared_ptr<TerrainFile> file(new TerrainFile());
+
+#ifdef _WIN32
+    HANDLE handle = CreateFileA(filename.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr, OPEN_EXISTING,
+        FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (handle == INVALID_HANDLE_VALUE) {
+        std::cerr << "Error opening terrain file '" << filename << "'" << std::endl;
+        return nullptr;
+    }
+    LARGE_INTEGER size;
+    HANDLE mapping = nullptr;
+    if (GetFileSizeEx(handle, &size) && size.QuadPart > 0) {
+        mapping = CreateFileMappingA(handle, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    }
+    if (mapping != nullptr) {
+        file->data_ = static_cast<const unsigned char*>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+        file->size_ = size_t(size.QuadPart);
+        // the view keeps the file mapped
+        CloseHandle(mapping);
+    }
+    CloseHandle(handle);
+#else
+    const int fd = open(filename.c_str(), O_RDONLY);
+    if (fd < 0) {
+        std::cerr << "Error opening terrain file '" << filename << "'" << std::endl;
+        return nullptr;
+    }
+    struct stat info;
+    if (fstat(fd, &info) == 0 && info.st_size > 0) {
+        void* data = mmap(nullptr, size_t(info.st_size), PROT_READ, MAP_PRIVATE, fd, 0);
+        if (data != MAP_FAILED) {
+            file->data_ = static_cast<const unsigned char*>(data);
+            file->size_ = size_t(info.st_size);
+        }
+    }
+    // the mapping keeps the file open
+    close(fd);
+#endif
+
+    if (file->data_ == nullptr) {
+        std::cerr << "Error mapping terrain file '" << filename << "'" << std::endl;
+        return nullptr;
+    }
+    file->header_ = reinterpret_cast<const TerrainFileHeader*>(file->data_);
+    if (!file->Validate(filename)) {
+        return nullptr;
+    }
+    return file;
+}
+
+TerrainFile::~TerrainFile()
+{
+    if (data_ == nullptr) {
+        return;
+    }
+#ifdef _WIN32
+    UnmapViewOfFile(data_);
+#else
+    munmap(const_cast<unsigned char*>(data_), size_);
+#endif
+}
+
+bool TerrainFile::Validate(const std::string& filename) const
+{
+    auto fail = [&](const char* what) {
+        std::cerr << "Error reading terrain file '" << filename << "': " << what << std::endl;
+        return false;
+    };
+
+    if (size_ < sizeof(TerrainFileHeader) || std::memcmp(header_->magic, kMagic, sizeof(kMagic)) != 0) {
+        return fail("not a terrain file");
+    }
+    if (header_->version != kTerrainFileVersion) {
+        return fail("unsupported version, convert the heightmap again");
+    }
+    if (header_->width < 2 || header_->height < 2 || header_->chunkSize == 0 || header_->tileSize == 0
+        || header_->tilesX == 0 || header_->tilesZ == 0) {
+        return fail("bad dimensions");
+    }
+
+    // present sections are aligned, inside the file and of the size their contents imply
+    const uint64_t samples = uint64_t(header_->width) * header_->height;
+    const uint64_t quads = uint64_t(header_->width - 1) * (header_->height - 1);
+    const uint64_t tiles = uint64_t(header_->tilesX) * header_->tilesZ;
+    auto valid = [&](const TerrainFileSection& section, bool required, uint64_t bytes) {
+        if (section.offset == 0) {
+            return !required;
+        }
+        return section.offset % kTerrainFileAlignment == 0 && section.offset <= size_ && section.bytes <= size_ - section.offset
+            && section.bytes == bytes;
+    };
+    if (!valid(header_->heights, true, samples) || !valid(header_->vertices, false, samples * sizeof(PackedGridVertex))
+        || !valid(header_->normals, false, samples * 2 * sizeof(int16_t))
+        || !valid(header_->indices, false, quads * 6 * sizeof(uint32_t))
+        || !valid(header_->tiles, true, tiles * sizeof(TerrainFileTile))) {
+        return fail("truncated or corrupt section");
+    }
+
+    const uint64_t tileSamples = uint64_t(header_->tileSize + 1) * (header_->tileSize + 1);
+    const TerrainFileTile* directory = Section<TerrainFileTile>(header_->tiles);
+    for (uint64_t t = 0; t < tiles; t++) {
+        if (directory[t].offset == 0 || directory[t].offset > size_ || tileSamples > size_ - directory[t].offset) {
+            return fail("truncated or corrupt tile");
+        }
+    }
+    return true;
+}
+
+bool TerrainFile::IndicesInRange() const
+{
+    const uint32_t* indices = Indices();
+    const uint64_t samples = uint64_t(header_->width) * header_->height;
+    return indices == nullptr || IndexCount() == 0 || *std::max_element(indices, indices + IndexCount()) < samples;
+}
+
+const TerrainFileTile& TerrainFile::Tile(TileId tile) const
+{
+    return Section<TerrainFileTile>(header_->tiles)[size_t(tile.z) * header_->tilesX + size_t(tile.x)];
+}
+
+bool TerrainFile::Write(const std::string& filename, const unsigned char* heights, int width, int height,
+    const PackedGridVertex* vertices, const int16_t* normals, const std::vector<uint32_t>& indices,
+    int chunkSize, int tileSize)
+{
+    const size_t samples = size_t(width) * size_t(height);
+    const int tileSamples = tileSize + 1;
+
+    TerrainFileHeader header = {};
+    std::memcpy(header.magic, kMagic, sizeof(kMagic));
+    header.version = kTerrainFileVersion;
+    header.width = uint32_t(width);
+    header.height = uint32_t(height);
+    header.chunkSize = uint32_t(chunkSize);
+    header.tileSize = uint32_t(tileSize);
+    header.tilesX = uint32_t(std::max((width - 1 + tileSize - 1) / tileSize, 1));
+    header.tilesZ = uint32_t(std::max((height - 1 + tileSize - 1) / tileSize, 1));
+
+    // lay the sections out one after the other
+    uint64_t offset = Align(sizeof(TerrainFileHeader));
+    auto place = [&](TerrainFileSection& section, bool present, uint64_t bytes) {
+        section = {0, 0};
+        if (present) {
+            section = {offset, bytes};
+            offset = Align(offset + bytes);
+        }
+    };
+    place(header.heights, true, samples);
+    place(header.vertices, vertices != nullptr, samples * sizeof(PackedGridVertex));
+    place(header.normals, normals != nullptr, samples * 2 * sizeof(int16_t));
+    place(header.indices, !indices.empty(), indices.size() * sizeof(uint32_t));
+    place(header.tiles, true, uint64_t(header.tilesX) * header.tilesZ * sizeof(TerrainFileTile));
+
+    std::vector<TerrainFileTile> directory(size_t(header.tilesX) * header.tilesZ);
+    for (auto& tile : directory) {
+        tile = {};
+        tile.offset = offset;
+        offset = Align(offset + uint64_t(tileSamples) * tileSamples);
+    }
+
+    // the directory needs the height ranges, so the tiles are cut first
+    std::vector<std::vector<unsigned char>> tiles(directory.size());
+    for (uint32_t tz = 0; tz < header.tilesZ; tz++) {
+        for (uint32_t tx = 0; tx < header.tilesX; tx++) {
+            const size_t id = size_t(tz) * header.tilesX + tx;
+            std::vector<unsigned char>& tile = tiles[id];
+            tile.resize(size_t(tileSamples) * tileSamples);
+            for (int i = 0; i < tileSamples; i++) {
+                const int row = std::min(int(tz) * tileSize + i, height - 1);
+                for (int j = 0; j < tileSamples; j++) {
+                    const int col = std::min(int(tx) * tileSize + j, width - 1);
+                    tile[size_t(i) * tileSamples + j] = heights[size_t(row) * width + col];
+                }
+            }
+            const auto range = std::minmax_element(tile.begin(), tile.end());
+            directory[id].minHeight = *range.first;
+            directory[id].maxHeight = *range.second;
+        }
+    }
+
+    std::string error;
+    const bool written = WriteFileAtomically(filename, [&](std::ofstream& out) {
+        bool ok = WriteAt(out, 0, &header, sizeof(header)) && WriteAt(out, header.heights.offset, heights, samples);
+        if (ok && vertices != nullptr) {
+            ok = WriteAt(out, header.vertices.offset, vertices, samples * sizeof(PackedGridVertex));
+        }
+        if (ok && normals != nullptr) {
+            ok = WriteAt(out, header.normals.offset, normals, samples * 2 * sizeof(int16_t));
+        }
+        if (ok && !indices.empty()) {
+            ok = WriteAt(out, header.indices.offset, indices.data(), indices.size() * sizeof(uint32_t));
+        }
+        ok = ok && WriteAt(out, header.tiles.offset, directory.data(), directory.size() * sizeof(TerrainFileTile));
+        for (size_t id = 0; ok && id < tiles.size(); id++) {
+            ok = WriteAt(out, directory[id].offset, tiles[id].data(), tiles[id].size());
+        }
+        return ok;
+    }, error);
+    if (!written) {
+        std::cerr << "Error writing terrain file '" << filename << "': " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+bool MappedTileSource::ReadTile(TileId tile, unsigned char* heights)
+{
+    std::memcpy(heights, file_->TileHeights(tile), TileSamples());
+    return true;
+}
+
+} /* namespace cg */
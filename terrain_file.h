@@ -0,0 +1,144 @@
+#ifndef CG_TERRAIN_FILE_H_
+#define CG_TERRAIN_FILE_H_
+
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "grid_mesh_builder.h"
+#include "tile_streamer.h"
+
+namespace cg
+{
+
+/* Binary terrain file (.cgt), little endian, used in place through a read-only
+ * memory mapping. After the header come the sections, each starting on a
+ * multiple of kTerrainFileAlignment:
+ *
+ *   heights   width * height 8-bit samples, row by row
+ *   vertices  width * height PackedGridVertex, the terrain VBO as is (optional)
+ *   normals   width * height octahedral normals, 2 x int16, the PATCHES normal texture (optional)
+ *   indices   uint32 triangle list, 6 per grid quad, chunk by chunk in ChunkBvh leaf order for chunkSize (optional)
+ *   tiles     tilesX * tilesZ TerrainFileTile, row by row, each pointing at the
+ *             (tileSize + 1)^2 heights of a tile laid out as TileSource expects
+ *
+ * An absent section has a zero offset. Any change of the layout bumps kTerrainFileVersion.
+ */
+constexpr uint32_t kTerrainFileVersion = 1;
+
+// page aligned, so a section starts on its own page of the mapping and can be handed to GL as is
+constexpr uint64_t kTerrainFileAlignment = 4096;
+
+struct TerrainFileSection
+{
+	uint64_t offset;
+	uint64_t bytes;
+};
+
+struct TerrainFileHeader
+{
+	char magic[4];           // "CGTF"
+	uint32_t version;
+	uint32_t width;
+	uint32_t height;
+	uint32_t chunkSize;      // quads per side of the chunks the indices are grouped by
+	uint32_t tileSize;       // quads per side of a tile
+	uint32_t tilesX;
+	uint32_t tilesZ;
+	TerrainFileSection heights;
+	TerrainFileSection vertices;
+	TerrainFileSection normals;
+	TerrainFileSection indices;
+	TerrainFileSection tiles;
+};
+
+struct TerrainFileTile
+{
+	uint64_t offset;         // of the tile heights
+	uint8_t minHeight;
+	uint8_t maxHeight;
+	uint8_t reserved[6];
+};
+
+static_assert(sizeof(TerrainFileHeader) == 112, "TerrainFileHeader is part of the file format");
+static_assert(sizeof(TerrainFileTile) == 16, "TerrainFileTile is part of the file format");
+
+/* A mapped terrain file. Pages are only read from disk when first touched, so
+ * opening costs the same whatever the terrain size; the pointers returned stay
+ * valid as long as the TerrainFile lives.
+ */
+class TerrainFile
+{
+public:
+	/* nullptr, with the reason on std::cerr, if the file cannot be mapped or is not a valid terrain file */
+	static std::shared_ptr<TerrainFile> Open(const std::string& filename);
+
+	/* Write a terrain file; vertices, normals and indices may be null / empty to leave them out.
+	 * The tiles are cut from the heights, the last ones clamped to the heightmap border.
+	 */
+	static bool Write(const std::string& filename, const unsigned char* heights, int width, int height,
+		const PackedGridVertex* vertices, const int16_t* normals, const std::vector<uint32_t>& indices,
+		int chunkSize, int tileSize);
+
+	TerrainFile(const TerrainFile&) = delete;
+	TerrainFile& operator=(const TerrainFile&) = delete;
+
+	virtual ~TerrainFile();
+
+	int Width() const { return int(header_->width); }
+	int Height() const { return int(header_->height); }
+	int ChunkSize() const { return int(header_->chunkSize); }
+	int TileSize() const { return int(header_->tileSize); }
+	int TilesX() const { return int(header_->tilesX); }
+	int TilesZ() const { return int(header_->tilesZ); }
+	size_t MappedBytes() const { return size_; }
+
+	const unsigned char* Heights() const { return Section<unsigned char>(header_->heights); }
+	const PackedGridVertex* Vertices() const { return Section<PackedGridVertex>(header_->vertices); }
+	const int16_t* Normals() const { return Section<int16_t>(header_->normals); }
+	const uint32_t* Indices() const { return Section<uint32_t>(header_->indices); }
+	size_t IndexCount() const { return size_t(header_->indices.bytes / sizeof(uint32_t)); }
+
+	/* Whether the indices only address the grid. Reads every index, so Open() leaves it to
+	 * the callers: TerrainEngine::MapTerrainFile() before using them, the converter after writing.
+	 */
+	bool IndicesInRange() const;
+
+	const TerrainFileTile& Tile(TileId tile) const;
+	const unsigned char* TileHeights(TileId tile) const { return data_ + Tile(tile).offset; }
+
+private:
+	const unsigned char* data_ = nullptr;
+	size_t size_ = 0;
+	const TerrainFileHeader* header_ = nullptr;
+
+	TerrainFile() = default;
+
+	template <typename T>
+	const T* Section(const TerrainFileSection& section) const
+	{
+		return section.offset != 0 ? reinterpret_cast<const T*>(data_ + section.offset) : nullptr;
+	}
+
+	bool Validate(const std::string& filename) const;
+};
+
+/* The tiles of a terrain file, copied out of its mapping */
+class MappedTileSource : public TileSource
+{
+public:
+	explicit MappedTileSource(std::shared_ptr<const TerrainFile> file) : file_(std::move(file)) {}
+
+	int TileSize() const override { return file_->TileSize(); }
+	int TilesX() const override { return file_->TilesX(); }
+	int TilesZ() const override { return file_->TilesZ(); }
+	bool ReadTile(TileId tile, unsigned char* heights) override;
+
+private:
+	std::shared_ptr<const TerrainFile> file_;
+};
+
+} /* namespace cg */
+
+#endif /* CG_TERRAIN_FILE_H_ */
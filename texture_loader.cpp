@@ -0,0 +1,695 @@
+#include "texture_loader.h"
+
+#include <algorithm>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+
+#include <SOIL2/SOIL2.h>
+
+#include "file_util.hpp"
+
+namespace cg
+{
+
+namespace
+{
+
+// EXT_texture_compression_s3tc, left out of the core profile loader
+constexpr GLenum kCompressedRgbDxt1 = 0x83F0;
+constexpr GLenum kCompressedRgbaDxt5 = 0x83F3;
+
+constexpr uint32_t FourCC(char a, char b, char c, char d)
+{
+    return uint32_t(uint8_t(a)) | uint32_t(uint8_t(b)) << 8 | uint32_t(uint8_t(c)) << 16 | uint32_t(uint8_t(d)) << 24;
+}
+
+// DDS file header, the magic included
+struct DdsPixelFormat
+{
+    uint32_t size;
+    uint32_t flags;
+    uint32_t fourCC;
+    uint32_t rgbBitCount;
+    uint32_t masks[4];
+};
+
+struct DdsHeader
+{
+    char magic[4];
+    uint32_t size;
+    uint32_t flags;
+    uint32_t height;
+    uint32_t width;
+    uint32_t linearSize;
+    uint32_t depth;
+    uint32_t mipMapCount;
+    uint32_t reserved1[11];   // [0] kDdsMarker, [1] kTextureCacheVersion, [2] cold load time in microseconds
+    DdsPixelFormat format;
+    uint32_t caps;
+    uint32_t caps2;
+    uint32_t caps3;
+    uint32_t caps4;
+    uint32_t reserved2;
+};
+static_assert(sizeof(DdsHeader) == 128, "DDS header is 128 bytes");
+
+constexpr uint32_t kDdsFlags = 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000;  // caps, height, width, pixel format, mip count, linear size
+constexpr uint32_t kDdsFourCC = 0x4;
+constexpr uint32_t kDdsCaps = 0x8 | 0x1000 | 0x400000;                       // complex, texture, mipmap
+constexpr uint32_t kDdsCubeMap = 0x200 | 0xFC00;                             // cube map with all six faces
+constexpr uint32_t kDdsMarker = FourCC('C', 'G', 'T', 'X');
+
+// compressed format by channel count; grey images use the single and dual channel RGTC formats
+GLenum CompressedFormat(int channels)
+{
+    static const GLenum formats[4] = { GL_COMPRESSED_RED_RGTC1, GL_COMPRESSED_RG_RGTC2, kCompressedRgbDxt1, kCompressedRgbaDxt5 };
+    return formats[channels - 1];
+}
+
+uint32_t CompressedFourCC(int channels)
+{
+    static const uint32_t codes[4] = { FourCC('B', 'C', '4', 'U'), FourCC('B', 'C', '5', 'U'), FourCC('D', 'X', 'T', '1'), FourCC('D', 'X', 'T', '5') };
+    return codes[channels - 1];
+}
+
+// bytes per 4 x 4 block
+size_t BlockBytes(GLenum compressed)
+{
+    return compressed == kCompressedRgbDxt1 || compressed == GL_COMPRESSED_RED_RGTC1 ? 8 : 16;
+}
+
+bool ReadFile(const std::string& filename, std::vector<unsigned char>& contents)
+{
+    std::ifstream file(filename, std::ios::in | std::ios::binary | std::ios::ate);
+    if (!file) {
+        return false;
+    }
+    contents.resize(size_t(file.tellg()));
+    file.seekg(0);
+    return bool(file.read(reinterpret_cast<char*>(contents.data()), std::streamsize(contents.size())));
+}
+
+// 16 .. 235, what SOIL_FLAG_NTSC_SAFE_RGB produces; alpha is left alone
+void ScaleToNtscSafe(unsigned char* pixels, size_t count, int channels)
+{
+    unsigned char lut[256];
+    for (int i = 0; i < 256; i++) {
+        lut[i] = (unsigned char)((235.499f - 15.501f) * float(i) / 255.0f + 15.501f);
+    }
+    const int colors = (channels == 2 || channels == 4) ? channels - 1 : channels;
+    for (size_t k = 0; k < count; k++) {
+        for (int c = 0; c < colors; c++) {
+            pixels[k * channels + c] = lut[pixels[k * channels + c]];
+        }
+    }
+}
+
+GLuint CreatePlaceholder(bool cube, const glm::vec3& color)
+{
+    const unsigned char texel[3] = {
+        (unsigned char)(std::clamp(color.x, 0.0f, 1.0f) * 255.0f + 0.5f),
+        (unsigned char)(std::clamp(color.y, 0.0f, 1.0f) * 255.0f + 0.5f),
+        (unsigned char)(std::clamp(color.z, 0.0f, 1.0f) * 255.0f + 0.5f),
+    };
+    GlTexture texture = CreateTexture(cube ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D, 1, GL_RGB8, 1, 1);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    if (cube) {
+        for (int face = 0; face < 6; face++) {
+            glTextureSubImage3D(texture, 0, 0, 0, face, 1, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, texel);
+        }
+    } else {
+        glTextureSubImage2D(texture, 0, 0, 0, 1, 1, GL_RGB, GL_UNSIGNED_BYTE, texel);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTextureParameteri(texture, GL_TEXTURE_MIN_FILTER, GL_NEAREST);
+    glTextureParameteri(texture, GL_TEXTURE_MAG_FILTER, GL_NEAREST);
+    // the slot takes it over
+    return texture.Release();
+}
+
+double MillisecondsSince(std::chrono::steady_clock::time_point start)
+{
+    return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count();
+}
+
+} /* anonymous namespace */
+
+void FlipRows(unsigned char* pixels, int width, int height, int channels)
+{
+    const size_t pitch = size_t(width) * channels;
+    for (int i = 0; i < height / 2; i++) {
+        std::swap_ranges(pixels + i * pitch, pixels + (i + 1) * pitch, pixels + (height - 1 - i) * pitch);
+    }
+}
+
+void FlipColumns(unsigned char* pixels, int width, int height, int channels)
+{
+    for (int i = 0; i < height; i++) {
+        unsigned char* row = pixels + size_t(i) * width * channels;
+        for (int j = 0; j < width / 2; j++) {
+            std::swap_ranges(row + j * channels, row + (j + 1) * channels, row + (width - 1 - j) * channels);
+        }
+    }
+}
+
+AsyncTextureLoader::AsyncTextureLoader(unsigned threads) :
+    created_(std::chrono::steady_clock::now()), uploadBudget_(size_t(32) << 20),
+    mipFilter_(MipmapBuilder::Filter::KAISER), stop_(false), stored_(0)
+{
+    if (threads == 0) {
+        threads = std::min(std::max(std::thread::hardware_concurrency(), 1u), 4u);
+    }
+    for (unsigned t = 0; t < threads; t++) {
+        workers_.emplace_back(&AsyncTextureLoader::WorkerLoop, this);
+    }
+}
+
+AsyncTextureLoader::~AsyncTextureLoader()
+{
+    // cache files not written yet are dropped, the one being written is finished
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+        queue_.clear();
+    }
+    wake_.notify_all();
+    for (auto& worker : workers_) {
+        worker.join();
+    }
+
+    // the placeholders belong to the slots
+    for (const auto& job : jobs_) {
+        if (job->fence != nullptr) {
+            glDeleteSync(job->fence);
+        }
+        glDeleteTextures(1, &job->texture);
+    }
+}
+
+bool AsyncTextureLoader::EnableCache(const std::string& dir)
+{
+    // RGTC is core, S3TC an extension every desktop driver has; the compressor is the driver's
+    GLint count = 0;
+    glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+    std::vector<GLint> formats(size_t(std::max(count, 0)));
+    if (count > 0) {
+        glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats.data());
+    }
+    if (std::find(formats.begin(), formats.end(), GLint(kCompressedRgbDxt1)) == formats.end()
+        || std::find(formats.begin(), formats.end(), GLint(kCompressedRgbaDxt5)) == formats.end()) {
+        std::cerr << "Texture cache: the driver has no S3TC compression, cache disabled" << std::endl;
+        return false;
+    }
+    std::error_code error;
+    std::filesystem::create_directories(dir, error);
+    if (error) {
+        std::cerr << "Texture cache: cannot create cache directory '" << dir << "': " << error.message() << std::endl;
+        return false;
+    }
+    cacheDir_ = dir;
+    return true;
+}
+
+void AsyncTextureLoader::Load2D(const char* file, bool repeat, const glm::vec3& placeholder, GlTexture* slot, float sharpen)
+{
+    auto job = std::make_shared<Job>();
+    job->files.push_back(file);
+    job->repeat = repeat;
+    job->sharpen = sharpen;
+    job->slot = slot;
+    job->placeholder = CreatePlaceholder(false, placeholder);
+    Enqueue(job);
+}
+
+void AsyncTextureLoader::LoadCube(const char* const files[5], const glm::vec3& placeholder, GlTexture* slot)
+{
+    auto job = std::make_shared<Job>();
+    job->cube = true;
+    job->files.assign(files, files + 5);
+    job->slot = slot;
+    job->placeholder = CreatePlaceholder(true, placeholder);
+    Enqueue(job);
+}
+
+void AsyncTextureLoader::Enqueue(std::shared_ptr<Job> job)
+{
+    // the slot's previous texture is replaced right away
+    job->slot->Reset(job->placeholder);
+    job->cacheDir = cacheDir_;
+    job->filter = mipFilter_;
+    job->requested = std::chrono::steady_clock::now();
+    stats_.requested++;
+    jobs_.push_back(job);
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        queue_.push_back(std::move(job));
+    }
+    wake_.notify_one();
+}
+
+void AsyncTextureLoader::WorkerLoop()
+{
+    for (;;) {
+        std::shared_ptr<Job> job;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stop_ || !queue_.empty(); });
+            if (stop_ && queue_.empty()) {
+                return;
+            }
+            job = std::move(queue_.front());
+            queue_.pop_front();
+        }
+
+        if (job->storing) {
+            if (StoreCached(*job)) {
+                stored_++;
+            }
+            continue;
+        }
+
+        Decode(*job);
+
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            job->decoded = true;
+        }
+        decoded_.notify_all();
+    }
+}
+
+size_t AsyncTextureLoader::LayOut(int width, int height, int levelCount, int channels, GLenum compressed, std::vector<MipLevel>& levels)
+{
+    if (compressed == 0) {
+        return MipmapBuilder::LayOut(width, height, levelCount, channels, levels);
+    }
+    levels.clear();
+    size_t offset = 0;
+    for (int l = 0; l < levelCount; l++) {
+        const int w = std::max(width >> l, 1);
+        const int h = std::max(height >> l, 1);
+        const size_t bytes = size_t((w + 3) / 4) * size_t((h + 3) / 4) * BlockBytes(compressed);
+        levels.push_back({ w, h, offset, bytes });
+        offset += bytes;
+    }
+    return offset;
+}
+
+void AsyncTextureLoader::Decode(Job& job)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<std::vector<unsigned char>> contents(job.files.size());
+    job.ok = true;
+    for (size_t i = 0; i < job.files.size() && job.ok; i++) {
+        job.ok = ReadFile(job.files[i], contents[i]);
+    }
+
+    // the cache file is named after the image files' contents and how they are mipmapped,
+    // so edited images are decoded again
+    if (job.ok && !job.cacheDir.empty()) {
+        uint64_t hash = kFnv1aBasis;
+        uint32_t sharpen;
+        std::memcpy(&sharpen, &job.sharpen, sizeof(sharpen));
+        const uint32_t key[5] = { kTextureCacheVersion, job.cube ? 1u : 0u, job.repeat ? 1u : 0u, uint32_t(job.filter), sharpen };
+        hash = Fnv1a(hash, key, sizeof(key));
+        for (const auto& content : contents) {
+            const uint64_t bytes = content.size();
+            hash = Fnv1a(hash, &bytes, sizeof(bytes));
+            hash = Fnv1a(hash, content.data(), content.size());
+        }
+        std::ostringstream name;
+        name << std::hex << std::setw(16) << std::setfill('0') << hash << ".dds";
+        job.cacheFile = (std::filesystem::path(job.cacheDir) / name.str()).string();
+        if (LoadCached(job)) {
+            job.cached = true;
+            job.decodeMilliseconds = MillisecondsSince(start);
+            return;
+        }
+    }
+
+    if (job.ok && !job.cube) {
+        unsigned char* pixels = SOIL_load_image_from_memory(contents[0].data(), int(contents[0].size()),
+            &job.width, &job.height, &job.channels, SOIL_LOAD_AUTO);
+        job.ok = pixels != nullptr;
+        if (job.ok) {
+            const int levelCount = MipmapBuilder::LevelCount(job.width, job.height);
+            job.faceBytes = LayOut(job.width, job.height, levelCount, job.channels, 0, job.levels);
+            job.pixels.resize(job.faceBytes);
+            std::memcpy(job.pixels.data(), pixels, job.levels[0].bytes);
+            SOIL_free_image_data(pixels);
+            // images are stored top row first, GL wants the bottom row first
+            FlipRows(job.pixels.data(), job.width, job.height, job.channels);
+            ScaleToNtscSafe(job.pixels.data(), size_t(job.width) * size_t(job.height), job.channels);
+        }
+    } else if (job.ok) {
+        // GL target order +x, -x, +y, -y, +z, -z of the files back, right, front, left, top
+        const int faceOf[5] = { 5, 0, 4, 1, 2 };
+        job.channels = 3;
+        for (int i = 0; i < 5 && job.ok; i++) {
+            int width, height, channels;
+            unsigned char* pixels = SOIL_load_image_from_memory(contents[i].data(), int(contents[i].size()),
+                &width, &height, &channels, SOIL_LOAD_RGB);
+            // cube faces must be square and of the same size
+            job.ok = pixels != nullptr && width == height && (i == 0 || width == job.width);
+            if (job.ok) {
+                if (i == 0) {
+                    job.width = width;
+                    job.height = height;
+                    const int levelCount = MipmapBuilder::LevelCount(width, height);
+                    job.faceBytes = LayOut(width, height, levelCount, 3, 0, job.levels);
+                    job.pixels.resize(job.faceBytes * 6);
+                }
+                // images are stored top row first; cube map side faces also start at the top
+                // but run mirrored along s, the top face starts at the row towards -z
+                if (i == 4) {
+                    FlipRows(pixels, width, height, 3);
+                } else {
+                    FlipColumns(pixels, width, height, 3);
+                }
+                std::memcpy(job.pixels.data() + faceOf[i] * job.faceBytes, pixels, job.levels[0].bytes);
+                // nothing is drawn below the horizon: the bottom repeats the top to complete the cube
+                if (i == 4) {
+                    std::memcpy(job.pixels.data() + 3 * job.faceBytes, pixels, job.levels[0].bytes);
+                }
+            }
+            if (pixels != nullptr) {
+                SOIL_free_image_data(pixels);
+            }
+        }
+    }
+
+    // the mip chain is built here rather than by glGenerateMipmap, which filters sRGB
+    // values as if they were linear; to be cached, GL compresses it
+    if (job.ok) {
+        MipmapBuilder builder;
+        builder.SetFilter(job.filter);
+        builder.SetSharpen(job.sharpen);
+        for (size_t face = 0; face < job.pixels.size() / job.faceBytes; face++) {
+            // cube faces meet other faces at their edges, which clamping approximates best
+            builder.Build(job.pixels.data() + face * job.faceBytes, job.levels, job.channels, job.repeat && !job.cube);
+        }
+        if (!job.cacheDir.empty()) {
+            job.compressed = CompressedFormat(job.channels);
+        }
+    }
+
+    if (!job.ok) {
+        job.pixels.clear();
+    }
+    job.decodeMilliseconds = MillisecondsSince(start);
+}
+
+bool AsyncTextureLoader::LoadCached(Job& job)
+{
+    std::ifstream file(job.cacheFile, std::ios::in | std::ios::binary);
+    if (!file) {
+        return false;
+    }
+
+    // anything unexpected is rejected and the images are decoded instead
+    DdsHeader header;
+    int channels = 0;
+    if (file.read(reinterpret_cast<char*>(&header), sizeof(header)) && std::memcmp(header.magic, "DDS ", 4) == 0
+        && header.size == 124 && header.format.size == 32 && (header.format.flags & kDdsFourCC) != 0
+        && header.reserved1[0] == kDdsMarker && header.reserved1[1] == kTextureCacheVersion) {
+        for (int c = 1; c <= 4; c++) {
+            channels = header.format.fourCC == CompressedFourCC(c) ? c : channels;
+        }
+    }
+    const bool cube = (header.caps2 & kDdsCubeMap) == kDdsCubeMap;
+    const int width = int(header.width);
+    const int height = int(header.height);
+    if (channels == 0 || cube != job.cube || width < 1 || height < 1 || width > 16384 || height > 16384
+        || (cube && width != height) || int(header.mipMapCount) != MipmapBuilder::LevelCount(width, height)) {
+        job.rejected = true;
+        return false;
+    }
+
+    const GLenum compressed = CompressedFormat(channels);
+    std::vector<MipLevel> levels;
+    const size_t faceBytes = LayOut(width, height, int(header.mipMapCount), channels, compressed, levels);
+    std::vector<unsigned char> pixels(faceBytes * (cube ? 6 : 1));
+    if (!file.read(reinterpret_cast<char*>(pixels.data()), std::streamsize(pixels.size())) || file.peek() != EOF) {
+        job.rejected = true;
+        return false;
+    }
+
+    job.width = width;
+    job.height = height;
+    job.channels = channels;
+    job.compressed = compressed;
+    job.levels.swap(levels);
+    job.faceBytes = faceBytes;
+    job.pixels.swap(pixels);
+    job.coldMilliseconds = double(header.reserved1[2]) / 1000.0;
+    return true;
+}
+
+bool AsyncTextureLoader::StoreCached(const Job& job)
+{
+    DdsHeader header = {};
+    std::memcpy(header.magic, "DDS ", 4);
+    header.size = 124;
+    header.flags = kDdsFlags;
+    header.height = uint32_t(job.height);
+    header.width = uint32_t(job.width);
+    header.linearSize = uint32_t(job.levels[0].bytes);
+    header.mipMapCount = uint32_t(job.levels.size());
+    header.reserved1[0] = kDdsMarker;
+    header.reserved1[1] = kTextureCacheVersion;
+    header.reserved1[2] = uint32_t(std::min((job.decodeMilliseconds + job.uploadMilliseconds) * 1000.0, 4.0e9));
+    header.format.size = 32;
+    header.format.flags = kDdsFourCC;
+    header.format.fourCC = CompressedFourCC(job.channels);
+    header.caps = kDdsCaps;
+    header.caps2 = job.cube ? kDdsCubeMap : 0;
+
+    std::string error;
+    const bool written = WriteFileAtomically(job.cacheFile, [&](std::ofstream& file) {
+        file.write(reinterpret_cast<const char*>(&header), sizeof(header));
+        return bool(file.write(reinterpret_cast<const char*>(job.blocks.data()), std::streamsize(job.blocks.size())));
+    }, error);
+    if (!written) {
+        std::cerr << "Texture cache: cannot store '" << job.cacheFile << "': " << error << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void AsyncTextureLoader::StartUpload(Job& job)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    static const GLenum formats[4] = { GL_RED, GL_RG, GL_RGB, GL_RGBA };
+    static const GLenum internalFormats[4] = { GL_R8, GL_RG8, GL_RGB8, GL_RGBA8 };
+    const GLenum format = formats[job.channels - 1];
+    const GLenum internalFormat = job.compressed != 0 ? job.compressed : internalFormats[job.channels - 1];
+
+    // decoded pixels to the unpack buffer, the driver copies from there asynchronously
+    job.pbo = CreateBuffer(GLsizeiptr(job.pixels.size()), job.pixels.data());
+    const size_t faces = job.pixels.size() / job.faceBytes;
+    std::vector<unsigned char>().swap(job.pixels);
+
+    // cached: the compressed levels as they are; else the levels, compressed by GL if to be cached.
+    // Faces are the layers of a cube map.
+    const GLenum target = job.cube ? GL_TEXTURE_CUBE_MAP : GL_TEXTURE_2D;
+    job.texture = CreateTexture(target, GLsizei(job.levels.size()), internalFormat, job.levels[0].width, job.levels[0].height).Release();
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job.pbo);
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (size_t face = 0; face < faces; face++) {
+        for (size_t l = 0; l < job.levels.size(); l++) {
+            const MipLevel& level = job.levels[l];
+            const GLvoid* offset = (GLvoid*)(face * job.faceBytes + level.offset);
+            if (job.cached && job.cube) {
+                glCompressedTextureSubImage3D(job.texture, GLint(l), 0, 0, GLint(face), level.width, level.height, 1,
+                    job.compressed, GLsizei(level.bytes), offset);
+            } else if (job.cached) {
+                glCompressedTextureSubImage2D(job.texture, GLint(l), 0, 0, level.width, level.height,
+                    job.compressed, GLsizei(level.bytes), offset);
+            } else if (job.cube) {
+                glTextureSubImage3D(job.texture, GLint(l), 0, 0, GLint(face), level.width, level.height, 1, format, GL_UNSIGNED_BYTE, offset);
+            } else {
+                glTextureSubImage2D(job.texture, GLint(l), 0, 0, level.width, level.height, format, GL_UNSIGNED_BYTE, offset);
+            }
+        }
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+    glTextureParameteri(job.texture, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+    glTextureParameteri(job.texture, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    const GLint wrap = job.repeat ? GL_REPEAT : GL_CLAMP_TO_EDGE;
+    glTextureParameteri(job.texture, GL_TEXTURE_WRAP_S, wrap);
+    glTextureParameteri(job.texture, GL_TEXTURE_WRAP_T, wrap);
+    if (job.cube) {
+        glTextureParameteri(job.texture, GL_TEXTURE_WRAP_R, GL_CLAMP_TO_EDGE);
+        glEnable(GL_TEXTURE_CUBE_MAP_SEAMLESS);
+    }
+    // grey and grey-alpha images read as they did with luminance formats
+    if (job.channels <= 2) {
+        const GLint swizzle[4] = { GL_RED, GL_RED, GL_RED, job.channels == 2 ? GL_GREEN : GL_ONE };
+        glTextureParameteriv(job.texture, GL_TEXTURE_SWIZZLE_RGBA, swizzle);
+    }
+
+    job.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+    job.state = State::UPLOADING;
+    job.uploadMilliseconds += MillisecondsSince(start);
+}
+
+bool AsyncTextureLoader::ReadBack(Job& job)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    std::vector<MipLevel> levels;
+    const size_t faceBytes = LayOut(job.width, job.height, int(job.levels.size()), job.channels, job.compressed, levels);
+    const size_t faces = job.cube ? 6 : 1;
+    job.blocks.resize(faceBytes * faces);
+
+    // nothing is bound: a cube map face is the z offset of a sub-image, and the faces of
+    // immutable storage share their level sizes
+    bool ok = true;
+    for (size_t l = 0; l < levels.size() && ok; l++) {
+        // a driver that kept the texture uncompressed has nothing to cache
+        GLint compressed = GL_FALSE;
+        GLint bytes = 0;
+        glGetTextureLevelParameteriv(job.texture, GLint(l), GL_TEXTURE_COMPRESSED, &compressed);
+        glGetTextureLevelParameteriv(job.texture, GLint(l), GL_TEXTURE_COMPRESSED_IMAGE_SIZE, &bytes);
+        // drivers differ on whether a cube map's size is that of a face or of all six
+        ok = compressed == GL_TRUE && (size_t(bytes) == levels[l].bytes || size_t(bytes) == levels[l].bytes * faces);
+        for (size_t face = 0; face < faces && ok; face++) {
+            glGetCompressedTextureSubImage(job.texture, GLint(l), 0, 0, GLint(face), levels[l].width, levels[l].height, 1,
+                GLsizei(levels[l].bytes), job.blocks.data() + face * faceBytes + levels[l].offset);
+        }
+    }
+    job.uploadMilliseconds += MillisecondsSince(start);
+
+    if (!ok) {
+        std::cerr << "Texture cache: '" << job.files[0] << "' was not compressed as expected, not cached" << std::endl;
+        return false;
+    }
+    job.levels.swap(levels);
+    job.faceBytes = faceBytes;
+    job.storing = true;
+    return true;
+}
+
+int AsyncTextureLoader::Poll()
+{
+    return Advance(false);
+}
+
+bool AsyncTextureLoader::Finish()
+{
+    const size_t failed = stats_.failed;
+    while (Pending()) {
+        Advance(true);
+    }
+    return stats_.failed == failed;
+}
+
+int AsyncTextureLoader::Advance(bool block)
+{
+    const auto start = std::chrono::steady_clock::now();
+
+    if (block) {
+        // at least the first job still decoding is done before going on
+        for (const auto& job : jobs_) {
+            if (job->state == State::DECODING) {
+                std::unique_lock<std::mutex> lock(mutex_);
+                decoded_.wait(lock, [&] { return job->decoded.load(); });
+                break;
+            }
+        }
+    }
+
+    size_t uploaded = 0;
+    bool fenced = false;
+    int swapped = 0;
+    for (auto it = jobs_.begin(); it != jobs_.end(); ) {
+        Job& job = **it;
+        if (job.state == State::DECODING && job.decoded) {
+            if (job.rejected) {
+                std::cerr << "Texture cache: '" << job.cacheFile << "' is invalid, decoding '" << job.files[0] << "' again" << std::endl;
+                stats_.cacheRejected++;
+                job.rejected = false;
+            }
+            if (!job.ok) {
+                std::cerr << "Error loading texture '" << job.files[0] << "'" << (job.cube ? " (cube map)" : "") << std::endl;
+                stats_.decodeMilliseconds += job.decodeMilliseconds;
+                stats_.failed++;
+                it = jobs_.erase(it);
+                continue;
+            }
+            if (block || uploaded == 0 || uploaded + job.pixels.size() <= uploadBudget_) {
+                stats_.decodeMilliseconds += job.decodeMilliseconds;
+                if (!job.cacheDir.empty()) {
+                    (job.cached ? stats_.cacheHits : stats_.cacheMisses)++;
+                }
+                uploaded += job.pixels.size();
+                StartUpload(job);
+                fenced = true;
+            }
+        }
+        ++it;
+    }
+    if (fenced) {
+        // get the fences to the GPU so they can signal without a flush from the waits
+        glFlush();
+    }
+
+    for (auto it = jobs_.begin(); it != jobs_.end(); ) {
+        Job& job = **it;
+        if (job.state == State::UPLOADING) {
+            const GLenum status = glClientWaitSync(job.fence, 0, block ? GLuint64(1000000000) : 0);
+            // a failed wait cannot be retried, the texture is used as it is
+            if (status == GL_ALREADY_SIGNALED || status == GL_CONDITION_SATISFIED || status == GL_WAIT_FAILED) {
+                glDeleteSync(job.fence);
+                job.fence = nullptr;
+                job.pbo.Reset();
+                // deletes the placeholder
+                job.slot->Reset(job.texture);
+
+                TextureTiming timing;
+                timing.file = job.files[0];
+                timing.cached = job.cached;
+                timing.workerMilliseconds = job.decodeMilliseconds;
+                timing.readyMilliseconds = MillisecondsSince(job.requested);
+                timing.coldMilliseconds = job.coldMilliseconds;
+                // decoded with the cache on: the compressed levels are read back for a worker to store
+                const bool store = !job.cached && job.compressed != 0 && ReadBack(job);
+                timing.uploadMilliseconds = job.uploadMilliseconds;
+                // faceBytes counts every level of the mip chain
+                timing.bytes = (job.cube ? 6 : 1) * job.faceBytes;
+                timings_.push_back(timing);
+                if (store) {
+                    {
+                        std::lock_guard<std::mutex> lock(mutex_);
+                        queue_.push_back(*it);
+                    }
+                    wake_.notify_one();
+                }
+
+                stats_.ready++;
+                swapped++;
+                it = jobs_.erase(it);
+                continue;
+            }
+        }
+        ++it;
+    }
+
+    const auto now = std::chrono::steady_clock::now();
+    stats_.uploadMilliseconds += std::chrono::duration<double, std::milli>(now - start).count();
+    stats_.cacheStored = stored_;
+    if (swapped > 0) {
+        stats_.readyMilliseconds = std::chrono::duration<double, std::milli>(now - created_).count();
+    }
+    return swapped;
+}
+
+} /* namespace cg */
@@ -0,0 +1,199 @@
+#ifndef CG_TEXTURE_LOADER_H_
+#define CG_TEXTURE_LOADER_H_
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+#include "gl_handle.hpp"
+#include "mipmap_builder.h"
+
+namespace cg
+{
+
+/* Flip an image upside down / left to right, in place */
+void FlipRows(unsigned char* pixels, int width, int height, int channels);
+void FlipColumns(unsigned char* pixels, int width, int height, int channels);
+
+/* Version of the decoding done before a texture is cached; bump it whenever that changes */
+constexpr uint32_t kTextureCacheVersion = 2;
+
+/* Load times of one texture */
+struct TextureTiming
+{
+	std::string file;                 // first file of a cube map
+	bool cached = false;              // uploaded from the compressed cache
+	double workerMilliseconds = 0.0;  // read & decode, or read of the cached mip chain
+	double uploadMilliseconds = 0.0;  // on the GL thread, with the read back of a compressed texture to cache
+	double readyMilliseconds = 0.0;   // from the request to the swap in
+	double coldMilliseconds = 0.0;    // cached: worker + upload time of the load that stored it
+	size_t bytes = 0;                 // texture storage, all levels
+};
+
+/* Loads textures without blocking the render loop.
+ *
+ * Images are decoded by worker threads, which also build their mipmaps
+ * (gamma correct, see MipmapBuilder). Poll(), called once per
+ * frame on the GL thread, copies the decoded images into pixel unpack buffers,
+ * starts the texture uploads from them into immutable storage and fences each
+ * upload. No texture is bound on the way, so Poll() leaves the draw state alone. Once its fence
+ * has signalled, a texture replaces the placeholder in its slot and its buffer
+ * is released. Until then the slot holds a 1 x 1 texture of the placeholder
+ * color, so drawing can start right away.
+ *
+ * With the cache enabled, textures are stored compressed (DXT1/DXT5, RGTC for
+ * grey images) with all their mipmaps in a DDS file named after a hash of the
+ * image files. Later loads of the same images upload that mip chain as is,
+ * skipping the decode, the mipmap generation and the compression.
+ */
+class AsyncTextureLoader
+{
+public:
+	struct Stats
+	{
+		size_t requested = 0;
+		size_t ready = 0;
+		size_t failed = 0;
+		double decodeMilliseconds = 0.0;   // summed over the workers
+		double uploadMilliseconds = 0.0;   // spent in Poll() on the GL thread
+		double readyMilliseconds = 0.0;    // since the loader was created, when the last texture was swapped in
+		size_t cacheHits = 0;              // textures uploaded from the cache
+		size_t cacheMisses = 0;            // textures decoded with the cache enabled
+		size_t cacheRejected = 0;          // cache files unreadable or not matching, decoded instead
+		size_t cacheStored = 0;            // cache files written
+	};
+
+	// threads == 0 means one per hardware thread, at most 4
+	explicit AsyncTextureLoader(unsigned threads = 0);
+
+	AsyncTextureLoader(const AsyncTextureLoader&) = delete;
+	AsyncTextureLoader& operator=(const AsyncTextureLoader&) = delete;
+
+	virtual ~AsyncTextureLoader();
+
+	/* Keep compressed mip chains in directory dir, created if needed, for the
+	 * textures requested from now on. Returns false (and leaves caching off) if
+	 * the driver lacks S3TC compression or the directory cannot be created.
+	 */
+	bool EnableCache(const std::string& dir);
+
+	/* Mipmapped 2D texture, flipped so the first row of the image is at t = 1;
+	 * `*slot` gets a placeholder now and the texture once uploaded. The mipmaps
+	 * are sharpened by `sharpen` (see MipmapBuilder::SetSharpen()).
+	 */
+	void Load2D(const char* file, bool repeat, const glm::vec3& placeholder, GlTexture* slot, float sharpen = 0.0f);
+
+	/* Cube map from five square images: back, right, front, left, top (see
+	 * TerrainEngine::cubeVertices); the bottom repeats the top
+	 */
+	void LoadCube(const char* const files[5], const glm::vec3& placeholder, GlTexture* slot);
+
+	/* Start the uploads of decoded images, up to the upload budget, and swap in
+	 * the finished textures. Returns the number of textures swapped in.
+	 */
+	int Poll();
+
+	/* Block until every texture requested is swapped in or failed; false if any failed */
+	bool Finish();
+
+	bool Pending() const { return !jobs_.empty(); }
+	const Stats& GetStats() const { return stats_; }
+	/* Textures swapped in, in that order */
+	const std::vector<TextureTiming>& Timings() const { return timings_; }
+	unsigned Threads() const { return unsigned(workers_.size()); }
+
+	/* Bytes copied into unpack buffers per Poll(), one image at least */
+	void SetUploadBudget(size_t bytes) { uploadBudget_ = bytes; }
+	/* Mipmap filter of the textures requested from now on */
+	void SetMipFilter(MipmapBuilder::Filter filter) { mipFilter_ = filter; }
+
+private:
+	enum class State
+	{
+		DECODING,
+		UPLOADING,
+	};
+
+	struct Job
+	{
+		bool cube = false;
+		std::vector<std::string> files;
+		bool repeat = false;
+		GlTexture* slot = nullptr;
+		GLuint placeholder = 0;           // owned by the slot
+		std::string cacheDir;             // empty: no caching
+		MipmapBuilder::Filter filter = MipmapBuilder::Filter::KAISER;
+		float sharpen = 0.0f;
+		std::chrono::steady_clock::time_point requested;
+
+		// written by a worker before `decoded` is set
+		std::vector<unsigned char> pixels;    // faces in GL target order, each with its levels
+		std::vector<MipLevel> levels;         // of one face, faces follow each other
+		size_t faceBytes = 0;
+		int width = 0;
+		int height = 0;
+		int channels = 0;
+		GLenum compressed = 0;                // format of the pixels if cached, else the one to compress to
+		bool cached = false;
+		bool rejected = false;
+		std::string cacheFile;
+		double coldMilliseconds = 0.0;
+		bool ok = false;
+		double decodeMilliseconds = 0.0;
+		std::atomic<bool> decoded{false};
+
+		// GL thread only
+		State state = State::DECODING;
+		GlBuffer pbo;
+		GLuint texture = 0;               // owned by the slot once swapped in
+		GLsync fence = nullptr;
+		double uploadMilliseconds = 0.0;
+
+		// queued again with the compressed levels read back, for a worker to store
+		bool storing = false;
+		std::vector<unsigned char> blocks;
+	};
+
+	std::chrono::steady_clock::time_point created_;
+	Stats stats_;
+	std::vector<TextureTiming> timings_;
+	size_t uploadBudget_;
+	std::string cacheDir_;
+	MipmapBuilder::Filter mipFilter_;
+	std::vector<std::shared_ptr<Job>> jobs_;     // GL thread, in request order
+
+	// shared with the workers
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::condition_variable decoded_;
+	std::deque<std::shared_ptr<Job>> queue_;
+	bool stop_;
+	std::atomic<size_t> stored_;
+	std::vector<std::thread> workers_;
+
+	/* Levels of a face of width x height pixels (or blocks of `compressed` if not 0); returns the bytes per face */
+	static size_t LayOut(int width, int height, int levelCount, int channels, GLenum compressed, std::vector<MipLevel>& levels);
+
+	void Enqueue(std::shared_ptr<Job> job);
+	void WorkerLoop();
+	static void Decode(Job& job);
+	static bool LoadCached(Job& job);
+	static bool StoreCached(const Job& job);
+	void StartUpload(Job& job);
+	bool ReadBack(Job& job);
+	int Advance(bool block);
+};
+
+} /* namespace cg */
+
+#endif /* CG_TEXTURE_LOADER_H_ */
@@ -0,0 +1,322 @@
+#include "tile_streamer.h"
+
+#include <algorithm>
+#include <cmath>
+#include <fstream>
+#include <iostream>
+#include <utility>
+
+namespace cg
+{
+
+namespace
+{
+
+// index into [0, size) of sample i of a row repeated mirrored every other time
+int MirrorIndex(int i, int size)
+{
+    if (size <= 1) {
+        return 0;
+    }
+    const int period = 2 * (size - 1);
+    const int m = i % period;
+    return m < size ? m : period - m;
+}
+
+} /* anonymous namespace */
+
+std::unique_ptr<DirectoryTileSource> DirectoryTileSource::Open(const std::string& dir)
+{
+    std::ifstream desc(dir + "/tiles.txt");
+    if (!desc) {
+        std::cerr << "Error opening tile directory '" << dir << "'" << std::endl;
+        return nullptr;
+    }
+
+    std::unique_ptr<DirectoryTileSource> source(new DirectoryTileSource());
+    source->dir_ = dir;
+    if (!(desc >> source->tileSize_ >> source->tilesX_ >> source->tilesZ_) ||
+        source->tileSize_ <= 0 || source->tilesX_ <= 0 || source->tilesZ_ <= 0) {
+        std::cerr << "Error reading '" << dir << "/tiles.txt', expected \"<tileSize> <tilesX> <tilesZ>\"" << std::endl;
+        return nullptr;
+    }
+    return source;
+}
+
+bool DirectoryTileSource::ReadTile(TileId tile, unsigned char* heights)
+{
+    const std::string filename = dir_ + "/tile_" + std::to_string(tile.x) + "_" + std::to_string(tile.z) + ".r8";
+    std::ifstream file(filename, std::ios::binary);
+    if (!file.read(reinterpret_cast<char*>(heights), std::streamsize(TileSamples()))) {
+        std::cerr << "Error reading tile '" << filename << "'" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+MirroredTileSource::MirroredTileSource(const unsigned char* heights, int width, int height, int tileSize, int tilesX, int tilesZ) :
+    heights_(heights, heights + size_t(width) * size_t(height)),
+    width_(width), height_(height), tileSize_(tileSize), tilesX_(tilesX), tilesZ_(tilesZ)
+{
+}
+
+bool MirroredTileSource::ReadTile(TileId tile, unsigned char* heights)
+{
+    const int samples = tileSize_ + 1;
+    for (int i = 0; i < samples; i++) {
+        const int row = MirrorIndex(tile.z * tileSize_ + i, height_);
+        const unsigned char* src = heights_.data() + size_t(row) * size_t(width_);
+        for (int j = 0; j < samples; j++) {
+            *heights++ = src[MirrorIndex(tile.x * tileSize_ + j, width_)];
+        }
+    }
+    return true;
+}
+
+TileStreamer::TileStreamer(std::unique_ptr<TileSource> source, size_t budgetBytes, int radius) :
+    source_(std::move(source)), budgetBytes_(budgetBytes), radius_(radius),
+    center_{0, 0}, predicted_{0, 0}, centered_(false), lookahead_(0.5f), stop_(false)
+{
+    const size_t wantedBytes = size_t(2 * radius + 1) * size_t(2 * radius + 1) * source_->TileSamples();
+    if (wantedBytes > budgetBytes_) {
+        std::cerr << "Warning: tile budget of " << budgetBytes_ << " bytes is below the "
+            << wantedBytes << " bytes of tiles wanted at once, tiles will be read again and again" << std::endl;
+    }
+    ioThread_ = std::thread(&TileStreamer::IoLoop, this);
+}
+
+TileStreamer::~TileStreamer()
+{
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_one();
+    ioThread_.join();
+}
+
+bool TileStreamer::IsWanted(TileId tile) const
+{
+    return centered_ && std::abs(tile.x - center_.x) <= radius_ && std::abs(tile.z - center_.z) <= radius_ &&
+        tile.x >= 0 && tile.x < source_->TilesX() && tile.z >= 0 && tile.z < source_->TilesZ();
+}
+
+const unsigned char* TileStreamer::Heights(TileId tile) const
+{
+    auto it = cache_.find(tile.Key());
+    return it != cache_.end() ? it->second.heights.data() : nullptr;
+}
+
+void TileStreamer::Update(const TileMotion& motion)
+{
+    std::vector<Loaded> completed;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        completed.swap(completed_);
+        stats_.queueDepth = requests_.size();
+    }
+    stats_.maxQueueDepth = std::max(stats_.maxQueueDepth, stats_.queueDepth);
+    for (auto& loaded : completed) {
+        const uint64_t key = loaded.tile.Key();
+        inFlight_.erase(key);
+        if (!loaded.ok || cache_.count(key) != 0) {
+            continue;
+        }
+        lru_.push_front(key);
+        stats_.residentBytes += loaded.heights.size();
+        cache_.emplace(key, Entry{ std::move(loaded.heights), lru_.begin() });
+        stats_.tilesLoaded++;
+        if (needed_.count(key) == 0) {
+            prefetched_.insert(key);
+            stats_.prefetchLoaded++;
+        }
+    }
+
+    // replan when the camera enters another tile or is heading to another one
+    const float size = float(source_->TileSize());
+    const TileId center{ int(std::floor(motion.x / size)), int(std::floor(motion.z / size)) };
+    const TileId predicted{ int(std::floor((motion.x + motion.velocityX * lookahead_) / size)),
+        int(std::floor((motion.z + motion.velocityZ * lookahead_) / size)) };
+    if (!centered_ || !(center == center_) || !(predicted == predicted_)) {
+        center_ = center;
+        predicted_ = predicted;
+        centered_ = true;
+        Plan(motion);
+    }
+
+    Evict();
+
+    stats_.missingTiles = 0;
+    for (const auto& tile : wanted_) {
+        stats_.missingTiles += cache_.count(tile.Key()) == 0 ? 1 : 0;
+    }
+    stats_.residentTiles = cache_.size();
+    stats_.pendingTiles = inFlight_.size();
+}
+
+void TileStreamer::Plan(const TileMotion& motion)
+{
+    const float size = float(source_->TileSize());
+    auto inWorld = [&](int tx, int tz) {
+        return tx >= 0 && tx < source_->TilesX() && tz >= 0 && tz < source_->TilesZ();
+    };
+
+    // needed: the tiles within the radius, the ones in front of the camera counting as nearer
+    std::vector<TileId> needed;
+    for (int tz = center_.z - radius_; tz <= center_.z + radius_; tz++) {
+        for (int tx = center_.x - radius_; tx <= center_.x + radius_; tx++) {
+            if (inWorld(tx, tz)) {
+                needed.push_back({ tx, tz });
+            }
+        }
+    }
+    const float frontLength = std::sqrt(motion.frontX * motion.frontX + motion.frontZ * motion.frontZ);
+    auto priority = [&](TileId t) {
+        const float dx = (float(t.x) + 0.5f) * size - motion.x;
+        const float dz = (float(t.z) + 0.5f) * size - motion.z;
+        const float distance = std::sqrt(dx * dx + dz * dz);
+        const float facing = frontLength > 0.0f && distance > 0.0f ? (dx * motion.frontX + dz * motion.frontZ) / (distance * frontLength) : 0.0f;
+        return distance * (1.0f - 0.5f * facing);
+    };
+    std::sort(needed.begin(), needed.end(), [&](TileId a, TileId b) { return priority(a) < priority(b); });
+
+    // prefetched: the tiles around the points of the predicted path, in the order they are reached,
+    // as many as the budget holds next to the needed ones
+    std::vector<TileId> prefetch;
+    std::unordered_set<uint64_t> needing;
+    for (const auto& tile : needed) {
+        needing.insert(tile.Key());
+    }
+    const float speed = std::sqrt(motion.velocityX * motion.velocityX + motion.velocityZ * motion.velocityZ);
+    const size_t budgetTiles = budgetBytes_ / source_->TileSamples();
+    const size_t room = budgetTiles > needed.size() ? budgetTiles - needed.size() : 0;
+    if (lookahead_ > 0.0f && speed > 0.0f && room > 0) {
+        // half a tile per step so no tile on the way is skipped, the path at most a few radii long
+        const int steps = std::min(int(std::ceil(speed * lookahead_ / (0.5f * size))), 8 * (radius_ + 1));
+        std::unordered_set<uint64_t> seen = needing;
+        TileId last = center_;
+        for (int k = 1; k <= steps && prefetch.size() < room; k++) {
+            const float t = lookahead_ * float(k) / float(steps);
+            const float px = motion.x + motion.velocityX * t;
+            const float pz = motion.z + motion.velocityZ * t;
+            const TileId at{ int(std::floor(px / size)), int(std::floor(pz / size)) };
+            if (at == last) {
+                continue;
+            }
+            last = at;
+
+            std::vector<TileId> entering;
+            for (int tz = at.z - radius_; tz <= at.z + radius_; tz++) {
+                for (int tx = at.x - radius_; tx <= at.x + radius_; tx++) {
+                    if (inWorld(tx, tz) && seen.insert(TileId{ tx, tz }.Key()).second) {
+                        entering.push_back({ tx, tz });
+                    }
+                }
+            }
+            auto distance = [&](TileId tile) {
+                const float dx = (float(tile.x) + 0.5f) * size - px;
+                const float dz = (float(tile.z) + 0.5f) * size - pz;
+                return dx * dx + dz * dz;
+            };
+            std::sort(entering.begin(), entering.end(), [&](TileId a, TileId b) { return distance(a) < distance(b); });
+            for (size_t e = 0; e < entering.size() && prefetch.size() < room; e++) {
+                prefetch.push_back(entering[e]);
+            }
+        }
+    }
+
+    // tiles entering the radius: resident ones are hits, the others will be late
+    for (const auto& tile : needed) {
+        const uint64_t key = tile.Key();
+        if (needed_.count(key) != 0) {
+            continue;
+        }
+        if (cache_.count(key) != 0) {
+            stats_.hits++;
+            if (prefetched_.erase(key) != 0) {
+                stats_.prefetchUsed++;
+            }
+        } else {
+            stats_.lateTiles++;
+        }
+    }
+
+    // touch the resident ones, last requested first so needed tiles end up the most recent
+    std::vector<TileId> missing;
+    for (const auto* list : { &prefetch, &needed }) {
+        for (auto it = list->rbegin(); it != list->rend(); ++it) {
+            auto entry = cache_.find(it->Key());
+            if (entry != cache_.end()) {
+                lru_.splice(lru_.begin(), lru_, entry->second.lru);
+            }
+        }
+    }
+    for (const auto* list : { &needed, &prefetch }) {
+        for (const auto& tile : *list) {
+            if (cache_.count(tile.Key()) == 0) {
+                if (inFlight_.count(tile.Key()) == 0) {
+                    stats_.misses++;
+                }
+                missing.push_back(tile);
+            }
+        }
+    }
+
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        // queued requests that are no longer wanted are dropped unread;
+        // what stays in inFlight_ is being read or waiting to be taken in
+        for (const auto& tile : requests_) {
+            inFlight_.erase(tile.Key());
+        }
+        requests_.clear();
+        for (const auto& tile : missing) {
+            if (inFlight_.insert(tile.Key()).second) {
+                requests_.push_back(tile);
+            }
+        }
+    }
+    wake_.notify_one();
+
+    wanted_.swap(needed);
+    prefetch_.swap(prefetch);
+    needed_.swap(needing);
+}
+
+void TileStreamer::Evict()
+{
+    while (stats_.residentBytes > budgetBytes_ && !lru_.empty()) {
+        auto entry = cache_.find(lru_.back());
+        stats_.residentBytes -= entry->second.heights.size();
+        if (prefetched_.erase(entry->first) != 0) {
+            stats_.prefetchWasted++;
+        }
+        cache_.erase(entry);
+        lru_.pop_back();
+        stats_.evictions++;
+    }
+}
+
+void TileStreamer::IoLoop()
+{
+    for (;;) {
+        TileId tile;
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return stop_ || !requests_.empty(); });
+            if (stop_) {
+                return;
+            }
+            tile = requests_.front();
+            requests_.pop_front();
+        }
+
+        Loaded loaded{ tile, std::vector<unsigned char>(source_->TileSamples()), false };
+        loaded.ok = source_->ReadTile(tile, loaded.heights.data());
+
+        std::lock_guard<std::mutex> lock(mutex_);
+        completed_.push_back(std::move(loaded));
+    }
+}
+
+} /* namespace cg */
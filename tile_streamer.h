@@ -0,0 +1,223 @@
+#ifndef CG_TILE_STREAMER_H_
+#define CG_TILE_STREAMER_H_
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace cg
+{
+
+/* A tile of the world, in tile units */
+struct TileId
+{
+	int x;
+	int z;
+
+	bool operator==(const TileId& other) const { return x == other.x && z == other.z; }
+	uint64_t Key() const { return (uint64_t(uint32_t(x)) << 32) | uint32_t(z); }
+};
+
+/* Where the tiles of a world come from. A world is TilesX() x TilesZ() tiles of
+ * TileSize() quads; a tile stores (TileSize() + 1)^2 8-bit heights, row by row,
+ * its last row and column repeating the first ones of the next tiles so that
+ * neighbouring tile meshes meet exactly.
+ */
+class TileSource
+{
+public:
+	virtual ~TileSource() = default;
+
+	virtual int TileSize() const = 0;
+	virtual int TilesX() const = 0;
+	virtual int TilesZ() const = 0;
+
+	size_t TileSamples() const { return size_t(TileSize() + 1) * size_t(TileSize() + 1); }
+
+	/* Fill heights[0 .. TileSamples()); called from the I/O thread only */
+	virtual bool ReadTile(TileId tile, unsigned char* heights) = 0;
+};
+
+/* Tiles as raw files <dir>/tile_<x>_<z>.r8, described by <dir>/tiles.txt
+ * holding "<tileSize> <tilesX> <tilesZ>"
+ */
+class DirectoryTileSource : public TileSource
+{
+public:
+	static std::unique_ptr<DirectoryTileSource> Open(const std::string& dir);
+
+	int TileSize() const override { return tileSize_; }
+	int TilesX() const override { return tilesX_; }
+	int TilesZ() const override { return tilesZ_; }
+	bool ReadTile(TileId tile, unsigned char* heights) override;
+
+private:
+	std::string dir_;
+	int tileSize_ = 0;
+	int tilesX_ = 0;
+	int tilesZ_ = 0;
+};
+
+/* An in-memory heightmap repeated, mirrored every other time so it stays
+ * continuous, over a world of tilesX x tilesZ tiles. Lets the streaming be
+ * exercised on worlds far larger than any file at hand.
+ */
+class MirroredTileSource : public TileSource
+{
+public:
+	MirroredTileSource(const unsigned char* heights, int width, int height, int tileSize, int tilesX, int tilesZ);
+
+	int TileSize() const override { return tileSize_; }
+	int TilesX() const override { return tilesX_; }
+	int TilesZ() const override { return tilesZ_; }
+	bool ReadTile(TileId tile, unsigned char* heights) override;
+
+private:
+	std::vector<unsigned char> heights_;
+	int width_;
+	int height_;
+	int tileSize_;
+	int tilesX_;
+	int tilesZ_;
+};
+
+/* Where the camera is and where it is heading, in heightmap samples of the whole world */
+struct TileMotion
+{
+	float x;
+	float z;
+	float velocityX = 0.0f;   // samples per second
+	float velocityZ = 0.0f;
+	float frontX = 0.0f;      // view direction on the ground, any length, zero if unknown
+	float frontZ = 0.0f;
+};
+
+/* Keeps the tiles around a point of the world in memory, and those the point
+ * is heading to.
+ *
+ * Update() works out the tiles within `radius` tiles of the camera (the needed
+ * tiles) and, extrapolating its velocity over the lookahead time, the tiles
+ * within the radius of where it will be (prefetched tiles). Missing tiles are
+ * queued for a background I/O thread: needed ones first, those in front of the
+ * camera before those behind, then prefetched ones in the order the camera will
+ * reach them. The queue is replaced whenever the camera enters another tile or
+ * the prediction changes, so stale requests never get read. Loaded tiles go
+ * into an LRU cache bounded by a byte budget: tiles are evicted, least recently
+ * wanted first, once the heights held exceed it; prefetching stops short of
+ * the budget so it never evicts needed tiles.
+ */
+class TileStreamer
+{
+public:
+	struct Stats
+	{
+		size_t hits = 0;          // tiles resident when they became needed
+		size_t misses = 0;        // tiles, needed or prefetched, not resident when they became wanted
+		size_t lateTiles = 0;     // tiles not resident yet when they became needed
+		size_t missingTiles = 0;  // needed tiles not resident after the last Update()
+		size_t evictions = 0;
+		size_t tilesLoaded = 0;
+		size_t residentTiles = 0;
+		size_t residentBytes = 0;
+		size_t pendingTiles = 0;  // requested, not loaded yet
+		size_t queueDepth = 0;    // requests waiting for the I/O thread after the last Update()
+		size_t maxQueueDepth = 0;
+		size_t prefetchLoaded = 0;  // tiles loaded before they were needed
+		size_t prefetchUsed = 0;    // ... that became needed while resident
+		size_t prefetchWasted = 0;  // ... that were evicted without being needed
+
+		/* Share of the settled prefetches that paid off */
+		double PrefetchAccuracy() const
+		{
+			return prefetchUsed + prefetchWasted > 0 ? double(prefetchUsed) / double(prefetchUsed + prefetchWasted) : 0.0;
+		}
+	};
+
+	TileStreamer(std::unique_ptr<TileSource> source, size_t budgetBytes, int radius);
+
+	TileStreamer(const TileStreamer&) = delete;
+	TileStreamer& operator=(const TileStreamer&) = delete;
+
+	virtual ~TileStreamer();
+
+	const TileSource& Source() const { return *source_; }
+	size_t BudgetBytes() const { return budgetBytes_; }
+	int Radius() const { return radius_; }
+	const Stats& GetStats() const { return stats_; }
+	float Lookahead() const { return lookahead_; }
+
+	/* How far ahead, in seconds, the camera's path is prefetched; 0 disables prefetching */
+	void SetLookahead(float seconds) { lookahead_ = seconds; }
+
+	/* Center the needed tiles on the camera, prefetch along its path,
+	 * and take in the tiles read since the last call
+	 */
+	void Update(const TileMotion& motion);
+	void Update(float x, float z) { Update(TileMotion{ x, z }); }
+
+	/* Tiles within the radius of the last Update(), in request order */
+	const std::vector<TileId>& Wanted() const { return wanted_; }
+	bool IsWanted(TileId tile) const;
+
+	/* Tiles along the predicted path and not needed yet, in request order */
+	const std::vector<TileId>& Prefetched() const { return prefetch_; }
+
+	/* Heights of a resident tile, nullptr otherwise; valid until the next Update() */
+	const unsigned char* Heights(TileId tile) const;
+
+private:
+	struct Entry
+	{
+		std::vector<unsigned char> heights;
+		std::list<uint64_t>::iterator lru;
+	};
+
+	struct Loaded
+	{
+		TileId tile;
+		std::vector<unsigned char> heights;
+		bool ok;
+	};
+
+	std::unique_ptr<TileSource> source_;
+	size_t budgetBytes_;
+	int radius_;
+	Stats stats_;
+
+	// cache, main thread only; front of lru_ is the most recently wanted tile
+	std::unordered_map<uint64_t, Entry> cache_;
+	std::list<uint64_t> lru_;
+	std::unordered_set<uint64_t> inFlight_;
+	std::vector<TileId> wanted_;
+	std::vector<TileId> prefetch_;
+	std::unordered_set<uint64_t> needed_;       // keys of wanted_
+	std::unordered_set<uint64_t> prefetched_;   // resident, loaded before they were needed and not needed since
+	TileId center_;
+	TileId predicted_;
+	bool centered_;
+	float lookahead_;
+
+	// shared with the I/O thread
+	std::mutex mutex_;
+	std::condition_variable wake_;
+	std::deque<TileId> requests_;
+	std::vector<Loaded> completed_;
+	bool stop_;
+	std::thread ioThread_;
+
+	void IoLoop();
+	void Plan(const TileMotion& motion);
+	void Evict();
+};
+
+} /* namespace cg */
+
+#endif /* CG_TILE_STREAMER_H_ */
@@ -0,0 +1,143 @@
+/*
+ * Converts a heightmap image into a binary terrain file (see terrain_file.h)
+ * holding the heights, the terrain VBO, the normal texture, the chunked index
+ * buffer and the streaming tiles, then compares the CPU side of loading both:
+ * image decode plus mesh build against mapping the file.
+ *
+ * Standalone, e.g.:
+ *   g++ -O2 -mavx2 -std=c++17 -pthread -I. tools/terrain_convert.cpp terrain_file.cpp
+ *       tile_streamer.cpp grid_mesh_builder.cpp chunk_bvh.cpp -lsoil2
+ *
+ * Usage: terrain_convert [heightmap.bmp] [heightmap.cgt] [tileSize]
+ */
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <memory>
+#include <vector>
+
+#include <SOIL2/SOIL2.h>
+
+#include "../chunk_bvh.h"
+#include "../grid_mesh.hpp"
+#include "../grid_mesh_builder.h"
+#include "../terrain_file.h"
+
+using namespace cg;
+
+namespace
+{
+
+// must match TerrainEngine::terrainChunkSize for the indices to be used
+constexpr int kChunkSize = 32;
+
+using Clock = std::chrono::steady_clock;
+
+double Milliseconds(Clock::time_point since)
+{
+	return std::chrono::duration<double, std::milli>(Clock::now() - since).count();
+}
+
+// what TerrainEngine::LoadHeightmap() computes on the CPU
+struct Mesh
+{
+	std::vector<PackedGridVertex> vertices;
+	std::vector<int16_t> normals;
+	std::vector<uint32_t> indices;
+};
+
+Mesh BuildMesh(const unsigned char* heights, int width, int height)
+{
+	Mesh mesh;
+	const size_t samples = size_t(width) * size_t(height);
+	mesh.vertices.resize(samples);
+	GridMeshBuilder().Build(heights, width, height, mesh.vertices.data());
+
+	mesh.normals.resize(samples * 2);
+	for (size_t k = 0; k < samples; k++) {
+		mesh.normals[2 * k] = mesh.vertices[k].normal[0];
+		mesh.normals[2 * k + 1] = mesh.vertices[k].normal[1];
+	}
+
+	// chunk by chunk in BVH leaf order, as the engine orders them
+	std::vector<glm::vec3> chunkMin;
+	std::vector<glm::vec3> chunkMax;
+	const glm::ivec2 chunks = ComputeChunkBounds(heights, width, height, kChunkSize, chunkMin, chunkMax);
+	ChunkBvh bvh;
+	for (int id : bvh.Build(chunkMin, chunkMax, chunks.x, chunks.y)) {
+		const int col0 = (id % chunks.x) * kChunkSize;
+		const int row0 = (id / chunks.x) * kChunkSize;
+		grid_mesh::AppendGridIndices(mesh.indices, width,
+			row0, std::min(row0 + kChunkSize, height - 1), col0, std::min(col0 + kChunkSize, width - 1));
+	}
+	return mesh;
+}
+
+} /* anonymous namespace */
+
+int main(int argc, char* argv[])
+{
+	const char* input = argc > 1 ? argv[1] : "assets/heightmap.bmp";
+	const char* output = argc > 2 ? argv[2] : "assets/heightmap.cgt";
+	const int tileSize = argc > 3 ? std::atoi(argv[3]) : 256;
+	if (tileSize <= 0) {
+		std::cerr << "Usage: terrain_convert [heightmap.bmp] [heightmap.cgt] [tileSize]" << std::endl;
+		return 1;
+	}
+
+	// the image path, as at startup without a terrain file
+	auto start = Clock::now();
+	int width = 0, height = 0, channels = 0;
+	unsigned char* heights = SOIL_load_image(input, &width, &height, &channels, SOIL_LOAD_L);
+	if (heights == nullptr) {
+		std::cerr << "Error loading heightmap '" << input << "'" << std::endl;
+		return 1;
+	}
+	const double decodeMs = Milliseconds(start);
+	start = Clock::now();
+	const Mesh mesh = BuildMesh(heights, width, height);
+	const double buildMs = Milliseconds(start);
+
+	const bool written = TerrainFile::Write(output, heights, width, height,
+		mesh.vertices.data(), mesh.normals.data(), mesh.indices, kChunkSize, tileSize);
+	SOIL_free_image_data(heights);
+	if (!written) {
+		return 1;
+	}
+
+	// the mapped path: everything the engine uploads is touched once, as the upload would
+	start = Clock::now();
+	std::shared_ptr<TerrainFile> file = TerrainFile::Open(output);
+	if (file == nullptr) {
+		return 1;
+	}
+	const double mapMs = Milliseconds(start);
+	start = Clock::now();
+	const size_t samples = size_t(width) * size_t(height);
+	unsigned checksum = 0;
+	auto touch = [&](const void* data, size_t bytes) {
+		const unsigned char* p = static_cast<const unsigned char*>(data);
+		for (size_t k = 0; k < bytes; k += 4096) {
+			checksum += p[k];
+		}
+	};
+	touch(file->Heights(), samples);
+	touch(file->Vertices(), samples * sizeof(PackedGridVertex));
+	touch(file->Normals(), samples * 2 * sizeof(int16_t));
+	touch(file->Indices(), file->IndexCount() * sizeof(uint32_t));
+	const double touchMs = Milliseconds(start);
+	// after the timing, this reads every index
+	if (!file->IndicesInRange()) {
+		std::cerr << "Error writing terrain file '" << output << "': index out of range" << std::endl;
+		return 1;
+	}
+
+	std::cout << input << " (" << width << " x " << height << ") -> " << output << ": "
+		<< file->MappedBytes() / 1024 << " KiB, " << file->TilesX() << " x " << file->TilesZ()
+		<< " tiles of " << tileSize << " quads" << std::endl;
+	std::cout << "image: decode " << decodeMs << " ms + mesh build " << buildMs << " ms = " << decodeMs + buildMs << " ms" << std::endl;
+	std::cout << "terrain file: map " << mapMs << " ms + first touch " << touchMs << " ms = " << mapMs + touchMs
+		<< " ms (checksum " << checksum << ")" << std::endl;
+	return 0;
+}
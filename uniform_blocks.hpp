@@ -0,0 +1,55 @@
+#ifndef CG_UNIFORM_BLOCKS_H_
+#define CG_UNIFORM_BLOCKS_H_
+
+#include <glad/glad.h>
+#include <glm/glm.hpp>
+
+namespace cg
+{
+
+/* std140 uniform blocks shared by the shader programs. The layouts must match
+ * the block declarations in shaders/ (vec3 members take 16 bytes, hence the
+ * vec4s); binding points are fixed with layout(binding = ...) in GLSL.
+ */
+enum UniformBlockBinding : GLuint
+{
+	CAMERA_BLOCK = 0,              // view, projection & camera position, once per frame
+	TERRAIN_LIGHTING_BLOCK = 1,    // light & material of the terrain, static
+	WATER_LIGHTING_BLOCK = 2,      // light & material of the water, static
+};
+
+struct CameraBlock
+{
+	glm::mat4 view;
+	glm::mat4 projection;
+	glm::vec4 viewPos;
+};
+
+struct LightBlock
+{
+	glm::vec4 position;
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec4 specular;
+};
+
+struct MaterialBlock
+{
+	glm::vec4 ambient;
+	glm::vec4 diffuse;
+	glm::vec3 specular;
+	GLfloat shininess;
+};
+
+struct LightingBlock
+{
+	LightBlock light;
+	MaterialBlock material;
+};
+
+static_assert(sizeof(CameraBlock) == 144, "CameraBlock must match the std140 layout");
+static_assert(sizeof(LightingBlock) == 112, "LightingBlock must match the std140 layout");
+
+} /* namespace cg */
+
+#endif /* CG_UNIFORM_BLOCKS_H_ */
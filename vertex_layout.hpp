@@ -0,0 +1,72 @@
+#ifndef CG_VERTEX_LAYOUT_H_
+#define CG_VERTEX_LAYOUT_H_
+
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <type_traits>
+#include <vector>
+
+#include <glad/glad.h>
+
+namespace cg
+{
+
+/* GL component type of a C++ vertex member type */
+template <typename T> struct GlComponent;
+template <> struct GlComponent<GLfloat> { static constexpr GLenum type = GL_FLOAT; };
+template <> struct GlComponent<int8_t> { static constexpr GLenum type = GL_BYTE; };
+template <> struct GlComponent<uint8_t> { static constexpr GLenum type = GL_UNSIGNED_BYTE; };
+template <> struct GlComponent<int16_t> { static constexpr GLenum type = GL_SHORT; };
+template <> struct GlComponent<uint16_t> { static constexpr GLenum type = GL_UNSIGNED_SHORT; };
+template <> struct GlComponent<int32_t> { static constexpr GLenum type = GL_INT; };
+template <> struct GlComponent<uint32_t> { static constexpr GLenum type = GL_UNSIGNED_INT; };
+
+/* One vertex attribute read by the vertex shader as a float vector */
+struct VertexAttribute
+{
+	GLuint location;
+	GLint components;
+	GLenum type;
+	GLboolean normalized;  // integers map to [0, 1] / [-1, 1] instead of converting as is
+	size_t offset;
+
+	/* Component type and count taken from the member type M (a scalar or an array of scalars) */
+	template <typename M>
+	static VertexAttribute Of(GLuint location, size_t offset, bool normalized = false)
+	{
+		using Component = std::remove_all_extents_t<M>;
+		constexpr size_t count = std::is_array<M>::value ? std::extent<M>::value : 1;
+		static_assert(count >= 1 && count <= 4, "a vertex attribute has 1 to 4 components");
+		return { location, GLint(count), GlComponent<Component>::type, normalized ? GLboolean(GL_TRUE) : GLboolean(GL_FALSE), offset };
+	}
+};
+
+/* Attribute of a member of a vertex struct, e.g. CG_VERTEX_ATTRIBUTE(0, GridVertex, position, false) */
+#define CG_VERTEX_ATTRIBUTE(location, Vertex, member, normalized) \
+	::cg::VertexAttribute::Of<decltype(Vertex::member)>((location), offsetof(Vertex, member), (normalized))
+
+/* Interleaved layout of one vertex buffer */
+struct VertexLayout
+{
+	GLsizei stride;
+	std::vector<VertexAttribute> attributes;
+
+	VertexLayout(GLsizei stride, std::initializer_list<VertexAttribute> attributes) :
+		stride(stride), attributes(attributes) {}
+
+	/* Point the attributes of `vao` at `buffer` through vertex buffer binding `binding`; binds nothing */
+	void Apply(GLuint vao, GLuint buffer, GLuint binding = 0) const
+	{
+		glVertexArrayVertexBuffer(vao, binding, buffer, 0, stride);
+		for (const auto& a : attributes) {
+			glVertexArrayAttribFormat(vao, a.location, a.components, a.type, a.normalized, GLuint(a.offset));
+			glVertexArrayAttribBinding(vao, a.location, binding);
+			glEnableVertexArrayAttrib(vao, a.location);
+		}
+	}
+};
+
+} /* namespace cg */
+
+#endif /* CG_VERTEX_LAYOUT_H_ */